@@ -1,6 +1,8 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include "pico/stdlib.h"
@@ -11,10 +13,15 @@
 #include "pico/multicore.h"
 #include "hardware/flash.h"
 #include "pico/mutex.h"
+#include "pico/unique_id.h"
+#include "pico/stdio_usb.h"
+#include "lwip/tcp.h"
+#include "lwip/dhcp.h"
 #include "example_http_client_util.h"
 #include "hardware/structs/resets.h"
 #include "hardware/sync.h"
 #include "hardware/pwm.h"
+#include "hardware/adc.h"
 
 // ========== CONFIGURAÇÕES ==========
 // Ajuste seu SSID/SENHA se necessário
@@ -24,6 +31,16 @@
 #ifndef WIFI_PASSWORD
 #define WIFI_PASSWORD "9988776655"
 #endif
+// IP fixo opcional (vazio = DHCP): a reconexão não espera o DHCP
+#ifndef WIFI_STATIC_IP
+#define WIFI_STATIC_IP      ""
+#endif
+#ifndef WIFI_STATIC_NETMASK
+#define WIFI_STATIC_NETMASK "255.255.255.0"
+#endif
+#ifndef WIFI_STATIC_GATEWAY
+#define WIFI_STATIC_GATEWAY "192.168.18.1"
+#endif
 
 #define HOST        "192.168.18.184"
 #define PORT        5000
@@ -52,9 +69,24 @@
 #define LCD_BACKLIGHT 0x08
 #define LCD_ENABLE_BIT 0x04
 
+// I2C com tempo limitado: orçamento por transação = bytes * I2C_BYTE_US + I2C_SLACK_US
+// (um byte leva ~90 us a 100 kHz), com I2C_MAX_RETRIES nova(s) tentativa(s) após limpar
+// o barramento. Após I2C_FAIL_LIMIT falhas seguidas o barramento fica em espera por
+// I2C_BACKOFF_MS e as transações retornam na hora: um LCD desconectado custa no
+// máximo I2C_FAIL_LIMIT * (1 + I2C_MAX_RETRIES) transações a cada I2C_BACKOFF_MS.
+#define I2C_BAUD          (100 * 1000)
+#define I2C_BYTE_US       100
+#define I2C_SLACK_US      300
+#define I2C_MAX_RETRIES   1
+#define I2C_FAIL_LIMIT    3
+#define I2C_BACKOFF_MS    2000
+
 // Flag para configurar o RTC na primeira gravação
 #define SET_RTC_TIME 0
 
+// Monitor de queda de energia (divisor de VSYS no GP26); sem o divisor fica desligado sozinho
+#define PF_MONITOR_ENABLED 1
+
 // Debounce (ms)
 const uint32_t MIN_EVENT_INTERVAL = 10;
 
@@ -62,16 +94,76 @@ const uint32_t MIN_EVENT_INTERVAL = 10;
 const uint32_t WIFI_INIT_RETRY_MS    = 10000;
 const uint32_t WIFI_CONNECT_RETRY_MS = 3000;
 const uint32_t WIFI_SEND_RETRY_MS    = 5000;
+const uint32_t WIFI_FAST_JOIN_TIMEOUT_MS = 2000; // associação direcionada sem resposta -> varredura completa
+const uint32_t WIFI_LINK_CHECK_MS    = 500;      // conectado: intervalo de checagem do enlace
+const uint32_t WIFI_LEASE_MARGIN_S   = 60;       // lease gravado só é usado se ainda valer por mais que isso
+const uint32_t WIFI_LEASE_MAX_S      = 7 * 24 * 3600;
 const int      SEND_FAILS_TO_RECONNECT = 3;
 
+// Telemetria USB (fallback quando o Wi-Fi está fora)
+const uint32_t USB_FALLBACK_AFTER_MS = 10000; // Wi-Fi fora por mais que isso -> envia pela USB
+const uint32_t USB_SEND_RETRY_MS     = 1000;  // sem ACK da ponte -> reenvia
+const uint32_t USB_SEND_MIN_GAP_MS   = 200;   // intervalo mínimo entre quadros de contador
+
+// Status local (GET /status servido pelo próprio Pico, sem depender do servidor)
+#define STATUS_HTTP_PORT        80
+#define STATUS_MAX_CONNS        2    // conexões simultâneas; as demais são recusadas na hora
+#define STATUS_BUF_SIZE         2048 // resposta completa (cabeçalho + JSON)
+#define STATUS_PERF_REFRESH_MS  1000 // contadores de desempenho entram no snapshot no máximo 1x/s
+#define STATUS_IDLE_POLLS       4    // tcp_poll a cada 500 ms: conexão que não terminou em 2 s é abortada
+
+// Reconciliação com o servidor (totais por turno guardados na flash)
+const uint32_t SYNC_INTERVAL_MS = 15 * 60 * 1000; // entre reconciliações bem-sucedidas
+const uint32_t SYNC_RETRY_MS    = 60 * 1000;      // após falha (e primeira, após o boot)
+#define SYNC_BUCKET_DAYS     7   // faixa de datas resumida por um hash
+#define SYNC_MAX_BUCKETS     16  // faixas mais recentes comparadas por rodada (limite do servidor)
+#define SYNC_MAX_FIX_BUCKETS 8   // faixas corrigidas por rodada
+
 // ========== SALVAMENTO EM FLASH (SEGURANÇA) ==========
 #define FLASH_TARGET_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
 #define NV_PAGES_PER_SECTOR (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
 #define NV_RECORD_MAGIC 0xA5A55A5Au
 
+// Totais por turno encerrado: setor logo abaixo do contador, registros de 32 bytes
+// anexados em sequência (o último de cada turno vale); setor cheio -> compacta
+#define LEDGER_TARGET_OFFSET (PICO_FLASH_SIZE_BYTES - 2 * FLASH_SECTOR_SIZE)
+#define LEDGER_MAGIC         0x4C454447u // 'LEDG'
+#define LEDGER_SLOT_SIZE     32
+#define LEDGER_SLOTS         (FLASH_SECTOR_SIZE / LEDGER_SLOT_SIZE)
+#define LEDGER_SLOTS_PER_PAGE (FLASH_PAGE_SIZE / LEDGER_SLOT_SIZE)
+#define LEDGER_MAX_SHIFTS    64 // ~1 mês com dois turnos por dia
+
 // Critérios para pedir gravação (no core1):
 const uint32_t SAVE_EVENT_THRESHOLD = 5;      // grava ao alcançar +5 eventos além do último salvo
 const uint32_t SAVE_TIME_THRESHOLD_MS = 5000; // grava pelo menos a cada 5s se tiver mudança
+// Com o monitor de queda de energia armado, a queda é coberta pela gravação de emergência;
+// as periódicas só limitam a perda num reset sem queda (watchdog, travamento, gravação)
+const uint32_t SAVE_EVENT_THRESHOLD_PF = 200;
+const uint32_t SAVE_TIME_THRESHOLD_PF_MS = 5 * 60 * 1000;
+
+// Gravação de emergência: setor mantido apagado pelo core0; na queda o core1 só programa
+// uma página (~1 ms, sem apagar). O último registro (maior seq) dos dois setores vale.
+#define EMERGENCY_TARGET_OFFSET (PICO_FLASH_SIZE_BYTES - 3 * FLASH_SECTOR_SIZE)
+
+// Monitor de queda de energia: VSYS por um divisor externo (ex.: 200k/100k) no ADC0 (GP26).
+// O VSYS/3 interno do Pico W (GP29) é compartilhado com o SPI do chip Wi-Fi e só pode ser
+// lido pelo core0 com o driver parado, então não serve para amostrar a cada 1 ms no core1.
+// Reserva necessária: de PF_TRIP_MV até ~1,8 V (mínimo do regulador) o capacitor em VSYS
+// deve sustentar detecção (PF_TRIP_SAMPLES ms) + espera do lockout + programação da
+// página (~1 ms; até 3 ms): com ~300 mA de pico do Wi-Fi, >= 1000 uF.
+#define PF_ADC_GPIO          26
+#define PF_ADC_INPUT         0
+#define PF_DIVIDER           3      // VSYS = leitura do ADC x PF_DIVIDER
+#define PF_PRESENT_MAX_MV    5600   // fora de PF_REARM_MV..PF_PRESENT_MAX_MV no boot: sem divisor
+#define PF_TRIP_MV           4300   // VSYS abaixo disso: grava o contador na hora
+#define PF_REARM_MV          4500   // acima disso por PF_REARM_MS: rearma
+#define PF_TRIP_SAMPLES      2      // leituras seguidas (1 por volta do laço, ~1 ms) abaixo do limiar
+#define PF_REARM_MS          500
+// Ainda vivo PF_HOLDUP_MS após o disparo: não era queda (a reserva do capacitor dura
+// dezenas de ms), e sim fonte fraca ou afundamento longo. O monitor desarma até VSYS
+// voltar a PF_REARM_MV e as gravações periódicas voltam aos limiares sem monitor.
+#define PF_HOLDUP_MS         1000
+#define PF_LOCKOUT_TIMEOUT_US 2000  // espera máxima para parar o core0 antes de gravar
 
 // Estrutura armazenada em cada página (no início da página)
 typedef struct {
@@ -113,6 +205,9 @@ static uint32_t crc32_compute(const uint8_t *data, size_t len) {
 // ========== VARIÁVEIS COMPARTILHADAS ENTRE CORES ==========
 static volatile uint32_t event_counter = 0;
 static volatile uint32_t latest_pending = 0;
+// Horário (RTC, segundos desde 1970 em hora local) do último evento pendente de envio;
+// o servidor usa para medir o atraso de ingestão
+static volatile uint32_t latest_pending_ts = 0;
 static volatile bool has_pending_data = false;
 
 // Wi-Fi flags
@@ -126,6 +221,57 @@ static volatile bool http_req_in_progress = false;
 static EXAMPLE_HTTP_REQUEST_T http_req_state;
 static char http_req_path[128];
 
+// Identidade do dispositivo: ID único da placa (flash QSPI) em hexadecimal,
+// enviado em cada /update para o servidor separar os contadores por linha
+static char device_id[2 * PICO_UNIQUE_BOARD_ID_SIZE_BYTES + 1];
+
+// ID bruto (8 bytes) enviado nos quadros binários da telemetria USB
+static pico_unique_board_id_t board_uid;
+
+// Core1 sinaliza a troca de turno (contador zerado) para o core0 reportar pela USB
+static volatile bool shift_reset_event = false;
+
+// Hora do RTC (epoch) publicada pelo core1 a cada segundo; 0 até a primeira leitura
+static volatile uint32_t shared_rtc_epoch = 0;
+
+// Maior seq gravado no setor normal (core0); a gravação de emergência usa um seq acima dele
+static volatile uint32_t nv_last_seq = 0;
+// Setor de emergência apagado e pronto (core0 garante) e próxima página livre (core1 consome)
+static volatile bool emergency_ready = false;
+static volatile uint8_t emergency_next_page = 0;
+// Monitor de queda de energia (escritos pelo core1)
+static volatile bool pf_monitor_present = false;
+static volatile uint32_t pf_vsys_mv = 0;
+static volatile uint32_t pf_trips = 0;
+static volatile uint32_t pf_emergency_saves = 0;
+static volatile uint32_t pf_emergency_fail = 0;
+static volatile bool pf_tripped = false; // VSYS baixo: core0 não apaga a flash
+
+// Turno corrente (ShiftState) e maior duração do laço do core1, publicados para o status local
+static volatile uint8_t shared_shift_state = 2; // INTERVALO até a primeira leitura do RTC
+// Data (AAAAMMDD) de início do turno corrente; 0 em INTERVALO
+static volatile uint32_t shared_shift_date = 0;
+static volatile uint32_t core1_loop_max_us = 0;
+
+// Gravações e envios feitos pelo core0 (status local)
+static struct {
+    uint32_t saves;
+    uint32_t save_max_us;
+    uint32_t last_save_value;
+    uint32_t last_save_s;     // uptime (s) da última gravação
+    uint32_t uploads_ok;
+    uint32_t uploads_fail;
+    uint32_t upload_max_ms;
+    uint32_t last_upload_value;
+    uint32_t last_upload_s;   // uptime (s) do último envio (ok ou não)
+    int8_t last_upload;       // -1 nunca, 0 falhou, 1 ok pelo Wi-Fi, 2 ok pela USB
+    uint32_t loop_max_us;
+    uint32_t syncs;           // reconciliações concluídas
+    uint32_t sync_fixed;      // turnos corrigidos (na flash ou no servidor)
+    uint32_t last_sync_s;
+    int8_t last_sync;         // -1 nunca, 0 falhou, 1 ok
+} core0_stats = { .last_upload = -1, .last_sync = -1 };
+
 // Mutex para LCD
 static mutex_t lcd_mutex;
 
@@ -137,28 +283,159 @@ static volatile uint8_t flash_save_month = 0;
 static volatile uint8_t flash_save_year = 0;
 static volatile uint8_t flash_save_hour = 0;
 
-// ========== I2C / LCD (PCF8574 + HD44780 4-bit) ==========
-static void pcf_write_byte(uint8_t data) {
-    i2c_write_blocking(I2C_PORT, LCD_ADDR, &data, 1, false);
+// Totais de turnos encerrados a registrar na flash: fila core1 (produtor) -> core0
+#define LEDGER_QUEUE_LEN 4
+static volatile struct {
+    uint32_t date;
+    uint8_t turno;
+    uint32_t total;
+} ledger_queue[LEDGER_QUEUE_LEN];
+static volatile uint8_t ledger_queue_head = 0; // escrito só pelo core1
+static volatile uint8_t ledger_queue_tail = 0; // escrito só pelo core0
+
+// ========== I2C COM PRAZO, RECUPERAÇÃO DO BARRAMENTO E CONTADORES (CORE1) ==========
+typedef struct {
+    i2c_inst_t *port;
+    uint sda;
+    uint scl;
+    const char *name;
+    // Saúde do barramento (lidos pelo core0 apenas para diagnóstico)
+    volatile uint32_t transfers;
+    volatile uint32_t errors;     // transações que falharam (NACK ou timeout), inclusive retentadas
+    volatile uint32_t timeouts;
+    volatile uint32_t recoveries; // limpezas do barramento + reinicialização do controlador
+    volatile uint32_t skipped;    // transações descartadas durante a espera (backoff)
+    uint8_t consecutive_fail;
+    bool down;                    // em espera até backoff_until_ms
+    volatile bool came_back;      // voltou da espera: o dispositivo pode ter perdido o estado
+    uint32_t backoff_until_ms;
+} i2c_bus_t;
+
+static i2c_bus_t lcd_bus = { .port = I2C_PORT, .sda = SDA_PIN, .scl = SCL_PIN, .name = "lcd" };
+static i2c_bus_t rtc_bus = { .port = RTC_I2C_PORT, .sda = RTC_SDA_PIN, .scl = RTC_SCL_PIN, .name = "rtc" };
+
+static void i2c_bus_init(i2c_bus_t *bus) {
+    i2c_init(bus->port, I2C_BAUD);
+    gpio_set_function(bus->sda, GPIO_FUNC_I2C);
+    gpio_set_function(bus->scl, GPIO_FUNC_I2C);
+    gpio_pull_up(bus->sda);
+    gpio_pull_up(bus->scl);
+}
+
+// Libera um escravo que prende SDA em 0 (transação interrompida no meio de um byte):
+// até 9 pulsos de SCL em dreno aberto, depois uma condição de STOP e reinicia o controlador
+static void i2c_bus_clear(i2c_bus_t *bus) {
+    i2c_deinit(bus->port);
+    gpio_set_function(bus->sda, GPIO_FUNC_SIO);
+    gpio_set_function(bus->scl, GPIO_FUNC_SIO);
+    gpio_put(bus->sda, 0);
+    gpio_put(bus->scl, 0);
+    gpio_set_dir(bus->sda, GPIO_IN); // solto: pull-up leva a 1
+    gpio_set_dir(bus->scl, GPIO_IN);
+    for (int i = 0; i < 9 && !gpio_get(bus->sda); ++i) {
+        gpio_set_dir(bus->scl, GPIO_OUT); // SCL = 0
+        busy_wait_us(5);
+        gpio_set_dir(bus->scl, GPIO_IN);  // SCL = 1
+        busy_wait_us(5);
+    }
+    // STOP: SDA sobe com SCL em 1
+    gpio_set_dir(bus->sda, GPIO_OUT);
+    busy_wait_us(5);
+    gpio_set_dir(bus->sda, GPIO_IN);
+    busy_wait_us(5);
+    i2c_bus_init(bus);
+    bus->recoveries++;
 }
-static void lcd_pulse_enable(uint8_t data) {
-    uint8_t d = data | LCD_BACKLIGHT;
-    pcf_write_byte(d);
-    pcf_write_byte(d | LCD_ENABLE_BIT);
-    sleep_us(500);
-    pcf_write_byte(d & ~LCD_ENABLE_BIT);
-    sleep_us(100);
+
+// Durante a espera a transação é descartada na hora; depois dela, uma única
+// tentativa decide se o barramento voltou ou se a espera recomeça
+static bool i2c_bus_available(i2c_bus_t *bus) {
+    if (!bus->down) return true;
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    if ((int32_t)(now - bus->backoff_until_ms) < 0) {
+        bus->skipped++;
+        return false;
+    }
+    return true;
+}
+
+static void i2c_bus_result(i2c_bus_t *bus, bool ok) {
+    if (ok) {
+        if (bus->down) {
+            printf("[CORE1] I2C %s: barramento voltou\n", bus->name);
+            bus->down = false;
+            bus->came_back = true;
+        }
+        bus->consecutive_fail = 0;
+        return;
+    }
+    if (bus->down || ++bus->consecutive_fail >= I2C_FAIL_LIMIT) {
+        bus->down = true;
+        bus->backoff_until_ms = to_ms_since_boot(get_absolute_time()) + I2C_BACKOFF_MS;
+        printf("[CORE1] I2C %s: %lu erros, %lu recuperações; em espera por %d ms\n", bus->name,
+               (unsigned long)bus->errors, (unsigned long)bus->recoveries, I2C_BACKOFF_MS);
+    }
+}
+
+// Registra a falha de uma tentativa; timeout pode ter deixado o barramento preso
+static void i2c_bus_failed(i2c_bus_t *bus, int res) {
+    bus->errors++;
+    if (res == PICO_ERROR_TIMEOUT) {
+        bus->timeouts++;
+        i2c_bus_clear(bus);
+    }
+}
+
+static bool i2c_bus_write(i2c_bus_t *bus, uint8_t addr, const uint8_t *src, size_t len) {
+    if (!i2c_bus_available(bus)) return false;
+    uint32_t budget = (uint32_t)(len + 1) * I2C_BYTE_US + I2C_SLACK_US;
+    bool ok = false;
+    for (int attempt = 0; attempt <= I2C_MAX_RETRIES && !ok; ++attempt) {
+        bus->transfers++;
+        int res = i2c_write_timeout_us(bus->port, addr, src, len, false, budget);
+        ok = (res == (int)len);
+        if (!ok) i2c_bus_failed(bus, res);
+    }
+    i2c_bus_result(bus, ok);
+    return ok;
+}
+
+// Escreve o registrador e lê 'len' bytes com START repetido (ex.: RTC)
+static bool i2c_bus_read_reg(i2c_bus_t *bus, uint8_t addr, uint8_t reg, uint8_t *dst, size_t len) {
+    if (!i2c_bus_available(bus)) return false;
+    uint32_t budget = (uint32_t)(len + 3) * I2C_BYTE_US + I2C_SLACK_US;
+    bool ok = false;
+    for (int attempt = 0; attempt <= I2C_MAX_RETRIES && !ok; ++attempt) {
+        bus->transfers++;
+        int res = i2c_write_timeout_us(bus->port, addr, &reg, 1, true, budget);
+        if (res == 1) res = i2c_read_timeout_us(bus->port, addr, dst, len, false, budget);
+        ok = (res == (int)len);
+        if (!ok) i2c_bus_failed(bus, res);
+    }
+    i2c_bus_result(bus, ok);
+    return ok;
+}
+
+// ========== I2C / LCD (PCF8574 + HD44780 4-bit) ==========
+// Nibble com o pulso de enable em 3 bytes: o PCF8574 atualiza as saídas a cada byte
+// (~90 us a 100 kHz), mais que os 450 ns de E e os 37 us de execução do HD44780,
+// então não há esperas e cada caractere é uma única transação I2C
+static void lcd_nibble(uint8_t *buf, uint8_t value) {
+    buf[0] = value | LCD_BACKLIGHT;
+    buf[1] = value | LCD_BACKLIGHT | LCD_ENABLE_BIT;
+    buf[2] = value | LCD_BACKLIGHT;
 }
 static void lcd_write4bits(uint8_t value) {
-    pcf_write_byte(value | LCD_BACKLIGHT);
-    lcd_pulse_enable(value);
+    uint8_t buf[3];
+    lcd_nibble(buf, value);
+    i2c_bus_write(&lcd_bus, LCD_ADDR, buf, sizeof(buf));
 }
 static void lcd_send_byte(uint8_t val, bool rs) {
     uint8_t rsbit = rs ? 0x01 : 0x00;
-    uint8_t high = (val & 0xF0) | rsbit;
-    uint8_t low  = ((val << 4) & 0xF0) | rsbit;
-    lcd_write4bits(high);
-    lcd_write4bits(low);
+    uint8_t buf[6];
+    lcd_nibble(buf, (val & 0xF0) | rsbit);
+    lcd_nibble(buf + 3, ((val << 4) & 0xF0) | rsbit);
+    i2c_bus_write(&lcd_bus, LCD_ADDR, buf, sizeof(buf));
 }
 static void lcd_cmd(uint8_t cmd) { lcd_send_byte(cmd, false); }
 static void lcd_data(uint8_t data) { lcd_send_byte(data, true); }
@@ -188,6 +465,65 @@ static void lcd_write_string(const char *s) {
     while (*s) lcd_data((uint8_t)*s++);
 }
 
+// Reinicialização após o barramento voltar, sem bloquear a contagem: a sequência de
+// lcd_init() mais o rótulo "Contador: " vira uma lista de passos, um por passada do
+// laço do core1, com as esperas do HD44780 medidas em current_time em vez de sleep_ms.
+// Pior caso por passada: uma transação de 6 bytes, (1 + I2C_MAX_RETRIES) *
+// ((6 + 1) * I2C_BYTE_US + I2C_SLACK_US) = 2 ms com o LCD sem resposta (~0,7 ms normal).
+enum { LCD_STEP_NIBBLE, LCD_STEP_CMD, LCD_STEP_DATA };
+typedef struct {
+    uint8_t kind;
+    uint8_t value;
+    uint8_t wait_ms; // espera antes do próximo passo
+} lcd_step_t;
+
+#define LCD_POWERUP_MS 50
+static const lcd_step_t lcd_reinit_steps[] = {
+    { LCD_STEP_NIBBLE, 0x30, 5 },
+    { LCD_STEP_NIBBLE, 0x30, 1 },
+    { LCD_STEP_NIBBLE, 0x30, 5 },
+    { LCD_STEP_NIBBLE, 0x20, 0 }, // 4-bit mode
+    { LCD_STEP_CMD, 0x28, 0 },    // 2 linhas, 5x8
+    { LCD_STEP_CMD, 0x08, 0 },    // display off
+    { LCD_STEP_CMD, 0x01, 2 },    // clear
+    { LCD_STEP_CMD, 0x06, 0 },    // entry mode
+    { LCD_STEP_CMD, 0x0C, 0 },    // display on, cursor off
+    { LCD_STEP_CMD, 0x80, 0 },    // cursor em (0, 0)
+    { LCD_STEP_DATA, 'C', 0 }, { LCD_STEP_DATA, 'o', 0 }, { LCD_STEP_DATA, 'n', 0 },
+    { LCD_STEP_DATA, 't', 0 }, { LCD_STEP_DATA, 'a', 0 }, { LCD_STEP_DATA, 'd', 0 },
+    { LCD_STEP_DATA, 'o', 0 }, { LCD_STEP_DATA, 'r', 0 }, { LCD_STEP_DATA, ':', 0 },
+    { LCD_STEP_DATA, ' ', 0 },
+};
+#define LCD_REINIT_STEPS (sizeof(lcd_reinit_steps) / sizeof(lcd_reinit_steps[0]))
+
+// Só o core1 usa; enquanto active, as atualizações de contador e hora são puladas
+static struct {
+    bool active;
+    uint8_t step;
+    uint32_t next_ms;
+} lcd_reinit;
+
+static void lcd_reinit_start(uint32_t now_ms) {
+    lcd_reinit.active = true;
+    lcd_reinit.step = 0;
+    lcd_reinit.next_ms = now_ms + LCD_POWERUP_MS; // o LCD pode ter acabado de ser religado
+}
+
+// Executa no máximo um passo; true quando a sequência termina (hora de redesenhar)
+static bool lcd_reinit_poll(uint32_t now_ms) {
+    if (!lcd_reinit.active || (int32_t)(now_ms - lcd_reinit.next_ms) < 0) return false;
+    const lcd_step_t *s = &lcd_reinit_steps[lcd_reinit.step];
+    mutex_enter_blocking(&lcd_mutex);
+    if (s->kind == LCD_STEP_NIBBLE) lcd_write4bits(s->value);
+    else lcd_send_byte(s->value, s->kind == LCD_STEP_DATA);
+    mutex_exit(&lcd_mutex);
+    // +1: now_ms pode estar no fim do milissegundo corrente
+    lcd_reinit.next_ms = now_ms + (s->wait_ms ? s->wait_ms + 1u : 0u);
+    if (++lcd_reinit.step < LCD_REINIT_STEPS) return false;
+    lcd_reinit.active = false;
+    return true;
+}
+
 // ========== FUNÇÕES DE REDE (CORE0 irá gerenciar) ==========
 static bool try_cyw43_init_once() {
     printf("[CORE0] Tentando cyw43_arch_init()...\n");
@@ -211,12 +547,221 @@ static bool try_enable_sta_mode_once() {
     return true;
 }
 
+// ========== RECONEXÃO RÁPIDA DO WI-FI (CORE0) ==========
+// Depois de cada conexão, BSSID, canal e o lease do DHCP (IP, máscara, gateway e
+// validade pela hora do RTC) vão para um setor próprio da flash. Na queda e no boot,
+// a primeira tentativa é a associação direcionada a esse BSSID/canal, sem varredura;
+// se não associar em WIFI_FAST_JOIN_TIMEOUT_MS, vem a conexão completa. Associado, o
+// IP fixo ou o lease ainda válido é aplicado na hora e o DHCP confirma em segundo plano.
+#define NETCFG_TARGET_OFFSET (PICO_FLASH_SIZE_BYTES - 4 * FLASH_SECTOR_SIZE)
+#define NETCFG_MAGIC 0x4E455443u // "NETC"
+
+#ifndef CYW43_IOCTL_GET_CHANNEL
+#define CYW43_IOCTL_GET_CHANNEL 0x3a
+#endif
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t ssid_hash;    // crc32 do SSID: trocar o SSID invalida o registro
+    uint8_t  bssid[6];
+    uint8_t  channel;
+    uint8_t  reserved;
+    uint32_t ip;           // ordem de rede (ip4_addr_t)
+    uint32_t netmask;
+    uint32_t gateway;
+    uint32_t lease_expiry; // epoch do RTC; 0 = sem lease (IP fixo ou hora desconhecida)
+    uint32_t crc32;
+} netcfg_rec_t;
+
+static netcfg_rec_t netcfg;
+static bool netcfg_valid = false;
+static bool wifi_fast_join = false;     // associação em andamento é a direcionada
+static bool wifi_fast_tried = false;    // já tentou a direcionada nesta queda
+static bool wifi_ip_applied = false;    // IP fixo/lease já aplicado nesta associação
+static bool wifi_cache_pending = false; // gravar BSSID/lease quando o DHCP confirmar
+static uint32_t wifi_join_start = 0;
+static uint32_t wifi_outage_start = 0;  // queda do enlace (ou boot) em ms
+static struct {
+    uint32_t last_ms;   // queda -> enlace com IP
+    uint32_t max_ms;
+    uint32_t fast_ok;
+    uint32_t fast_fail;
+    uint32_t full;
+    int8_t last_mode;   // -1 nunca, 0 completa, 1 direcionada
+    bool lease_used;    // IP do lease gravado aplicado na última conexão
+} wifi_reconnect = { .last_mode = -1 };
+
+static uint32_t wifi_ssid_hash() {
+    return crc32_compute((const uint8_t *)WIFI_SSID, strlen(WIFI_SSID));
+}
+
+static void netcfg_load() {
+    const uint8_t *base = (const uint8_t *)(XIP_BASE + NETCFG_TARGET_OFFSET);
+    netcfg_valid = false;
+    for (uint32_t page = 0; page < NV_PAGES_PER_SECTOR; ++page) {
+        const netcfg_rec_t *rec = (const netcfg_rec_t *)(base + page * FLASH_PAGE_SIZE);
+        if (rec->magic != NETCFG_MAGIC) continue;
+        if (crc32_compute((const uint8_t *)rec, offsetof(netcfg_rec_t, crc32)) != rec->crc32) continue;
+        if (netcfg_valid && rec->seq <= netcfg.seq) continue;
+        netcfg = *rec;
+        netcfg_valid = true;
+    }
+    if (netcfg_valid && netcfg.ssid_hash != wifi_ssid_hash()) netcfg_valid = false;
+    if (netcfg_valid) {
+        printf("[CORE0] Wi-Fi gravado: BSSID %02x:%02x:%02x:%02x:%02x:%02x canal %u\n",
+               netcfg.bssid[0], netcfg.bssid[1], netcfg.bssid[2], netcfg.bssid[3], netcfg.bssid[4], netcfg.bssid[5],
+               netcfg.channel);
+    }
+}
+
+static void netcfg_save(netcfg_rec_t *rec) {
+    static uint8_t page_buf[FLASH_PAGE_SIZE];
+    const uint8_t *base = (const uint8_t *)(XIP_BASE + NETCFG_TARGET_OFFSET);
+    int free_page = -1;
+    for (uint32_t page = 0; page < NV_PAGES_PER_SECTOR && free_page < 0; ++page) {
+        if (((const netcfg_rec_t *)(base + page * FLASH_PAGE_SIZE))->magic == 0xFFFFFFFFu) free_page = (int)page;
+    }
+    rec->magic = NETCFG_MAGIC;
+    rec->seq = netcfg_valid ? netcfg.seq + 1 : 1;
+    rec->crc32 = crc32_compute((const uint8_t *)rec, offsetof(netcfg_rec_t, crc32));
+    memset(page_buf, 0xFF, sizeof(page_buf));
+    memcpy(page_buf, rec, sizeof(*rec));
+
+    multicore_lockout_start_blocking();
+    uint32_t ints = save_and_disable_interrupts();
+    if (free_page < 0) {
+        flash_range_erase(NETCFG_TARGET_OFFSET, FLASH_SECTOR_SIZE);
+        free_page = 0;
+    }
+    flash_range_program(NETCFG_TARGET_OFFSET + free_page * FLASH_PAGE_SIZE, page_buf, FLASH_PAGE_SIZE);
+    restore_interrupts(ints);
+    multicore_lockout_end_blocking();
+    netcfg = *rec;
+    netcfg_valid = true;
+    printf("[CORE0] Wi-Fi gravado na flash (page=%d, canal %u, lease até %lu)\n",
+           free_page, rec->channel, (unsigned long)rec->lease_expiry);
+}
+
+static bool wifi_lease_usable() {
+    uint32_t now = shared_rtc_epoch;
+    return netcfg_valid && netcfg.ip != 0 && netcfg.lease_expiry != 0 && now != 0 &&
+           now + WIFI_LEASE_MARGIN_S < netcfg.lease_expiry;
+}
+
+// Enlace perdido (ou reconexão forçada): a próxima tentativa é a direcionada, sem espera
+static void wifi_link_lost(uint32_t now) {
+    wifi_connected = false;
+    wifi_connecting = false;
+    wifi_fast_tried = false;
+    wifi_outage_start = now;
+}
+
+static int wifi_begin_join(bool fast, uint32_t now) {
+    wifi_fast_join = fast;
+    wifi_ip_applied = false;
+    wifi_join_start = now;
+    if (fast) {
+        wifi_fast_tried = true;
+        printf("[CORE0] Associação direcionada (canal %u)...\n", netcfg.channel);
+        return cyw43_wifi_join(&cyw43_state, strlen(WIFI_SSID), (const uint8_t *)WIFI_SSID,
+                               strlen(WIFI_PASSWORD), (const uint8_t *)WIFI_PASSWORD,
+                               CYW43_AUTH_WPA2_AES_PSK, netcfg.bssid, netcfg.channel);
+    }
+    printf("[CORE0] Iniciando tentativa de conexão Wi-Fi assíncrona...\n");
+    return cyw43_arch_wifi_connect_async(WIFI_SSID, WIFI_PASSWORD, CYW43_AUTH_WPA2_AES_PSK);
+}
+
+// Associado: aplica o IP fixo ou o lease gravado sem esperar o DHCP
+static void wifi_apply_ip() {
+    struct netif *n = &cyw43_state.netif[CYW43_ITF_STA];
+    ip4_addr_t ip, mask, gw;
+    wifi_reconnect.lease_used = false;
+    if (WIFI_STATIC_IP[0]) {
+        if (!ip4addr_aton(WIFI_STATIC_IP, &ip) || !ip4addr_aton(WIFI_STATIC_NETMASK, &mask) ||
+            !ip4addr_aton(WIFI_STATIC_GATEWAY, &gw)) {
+            printf("[CORE0] IP fixo inválido: usando DHCP\n");
+            return;
+        }
+        cyw43_arch_lwip_begin();
+        dhcp_stop(n);
+        netif_set_addr(n, &ip, &mask, &gw);
+        cyw43_arch_lwip_end();
+        return;
+    }
+    if (!wifi_lease_usable()) return;
+    cyw43_arch_lwip_begin();
+    if (ip4_addr_isany_val(*netif_ip4_addr(n))) {
+        ip4_addr_set_u32(&ip, netcfg.ip);
+        ip4_addr_set_u32(&mask, netcfg.netmask);
+        ip4_addr_set_u32(&gw, netcfg.gateway);
+        // O DHCP segue rodando e confirma (ou troca) o endereço
+        netif_set_addr(n, &ip, &mask, &gw);
+        wifi_reconnect.lease_used = true;
+    }
+    cyw43_arch_lwip_end();
+    if (wifi_reconnect.lease_used) printf("[CORE0] Lease gravado aplicado: %s\n", ip4addr_ntoa(&ip));
+}
+
+// Conectado: grava BSSID/canal/lease se mudaram ou se o lease gravado passou da metade.
+// Retorna false enquanto o DHCP ainda não confirmou o endereço.
+static bool wifi_remember() {
+    struct netif *n = &cyw43_state.netif[CYW43_ITF_STA];
+    bool is_static = WIFI_STATIC_IP[0] != 0;
+    netcfg_rec_t rec;
+    memset(&rec, 0, sizeof(rec));
+    uint32_t lease = 0;
+    cyw43_arch_lwip_begin();
+    bool bound = is_static || dhcp_supplied_address(n);
+    if (bound) {
+        rec.ip = ip4_addr_get_u32(netif_ip4_addr(n));
+        rec.netmask = ip4_addr_get_u32(netif_ip4_netmask(n));
+        rec.gateway = ip4_addr_get_u32(netif_ip4_gw(n));
+        struct dhcp *d = netif_dhcp_data(n);
+        if (!is_static && d) lease = d->offered_t0_lease;
+    }
+    cyw43_arch_lwip_end();
+    if (!bound) return false;
+
+    uint8_t chan[12] = {0}; // channel_info_t: hw_channel (u32) primeiro
+    if (cyw43_wifi_get_bssid(&cyw43_state, rec.bssid) != 0 ||
+        cyw43_ioctl(&cyw43_state, CYW43_IOCTL_GET_CHANNEL, sizeof(chan), chan, CYW43_ITF_STA) != 0) {
+        return true;
+    }
+    rec.channel = chan[0];
+    rec.ssid_hash = wifi_ssid_hash();
+    if (lease > WIFI_LEASE_MAX_S) lease = WIFI_LEASE_MAX_S;
+    uint32_t now = shared_rtc_epoch;
+    rec.lease_expiry = (lease && now) ? now + lease : 0;
+
+    bool same = netcfg_valid && memcmp(netcfg.bssid, rec.bssid, sizeof(rec.bssid)) == 0 &&
+                netcfg.channel == rec.channel && netcfg.ip == rec.ip && netcfg.netmask == rec.netmask &&
+                netcfg.gateway == rec.gateway;
+    if (same && (rec.lease_expiry == 0 || netcfg.lease_expiry >= now + lease / 2)) return true;
+    netcfg_save(&rec);
+    return true;
+}
+
+// Enlace com IP: registra o tempo desde a queda e o caminho usado
+static void wifi_note_connected(uint32_t now) {
+    uint32_t ms = now - wifi_outage_start;
+    wifi_reconnect.last_ms = ms;
+    if (ms > wifi_reconnect.max_ms) wifi_reconnect.max_ms = ms;
+    wifi_reconnect.last_mode = wifi_fast_join ? 1 : 0;
+    if (wifi_fast_join) wifi_reconnect.fast_ok++;
+    else wifi_reconnect.full++;
+    wifi_cache_pending = true;
+    printf("[CORE0] Conectado ao Wi-Fi em %lu ms (%s%s)\n", (unsigned long)ms,
+           wifi_fast_join ? "direcionada" : "varredura completa", wifi_reconnect.lease_used ? ", lease gravado" : "");
+}
+
 // =====================
 // Envio usando API antiga (síncrona) - REUTILIZA example_http_client_util
 // =====================
-static int start_sending_to_server_by_ip(uint32_t value) {
-    // monta path como no sistema antigo
-    snprintf(http_req_path, sizeof(http_req_path), "/update?counter=%lu", (unsigned long)value);
+static int start_sending_to_server_by_ip(uint32_t value, uint32_t event_ts, int retries) {
+    // monta path como no sistema antigo (+ horário do evento e falhas anteriores, para diagnóstico)
+    snprintf(http_req_path, sizeof(http_req_path), "/update?counter=%lu&device=%s&ts=%lu&retry=%d",
+             (unsigned long)value, device_id, (unsigned long)event_ts, retries);
     printf("[CORE0] (http sync) Enviando para http://%s:%d%s\n", HOST, PORT, http_req_path);
 
     // Prepara requisição usando a estrutura utilitária
@@ -239,6 +784,141 @@ static int start_sending_to_server_by_ip(uint32_t value) {
     }
 }
 
+// ========== TELEMETRIA USB (quadros COBS + CRC32, CORE0) ==========
+// Canal binário na mesma porta USB-CDC do printf, lido pela ponte tools/usb_bridge.py.
+// Quadro (antes do COBS): [versão][tipo][seq u16][payload][crc32 u32], little-endian,
+// CRC32 sobre todos os bytes anteriores. Codificado em COBS e delimitado por 0x00
+// antes e depois: o texto do printf nunca contém 0x00, então a ponte separa os dois
+// fluxos; um quadro corrompido por texto intercalado falha no CRC e é reenviado.
+#define TLM_VERSION     1
+#define TLM_MAX_RAW     48
+#define TLM_MAX_ENCODED (TLM_MAX_RAW + TLM_MAX_RAW / 254 + 2)
+
+enum {
+    TLM_COUNTER = 0x01, // board_id[8], counter u32, ts u32, retries u16
+    TLM_EVENT   = 0x02, // board_id[8], código u8, valor u32, ts u32 (0 = horário da ponte; sem reenvio)
+    TLM_ACK     = 0x81  // ponte -> dispositivo: seq u16, status u8 (0 = gravado no servidor)
+};
+enum {
+    TLM_EV_BOOT        = 1,
+    TLM_EV_WIFI_UP     = 2,
+    TLM_EV_WIFI_DOWN   = 3,
+    TLM_EV_SHIFT_RESET = 4
+};
+
+static uint16_t tlm_next_seq = 1;
+// Bytes recebidos da ponte até o próximo 0x00
+static uint8_t tlm_rx_buf[TLM_MAX_ENCODED];
+static size_t tlm_rx_len = 0;
+static bool tlm_rx_overflow = false;
+
+static size_t cobs_encode(const uint8_t *in, size_t len, uint8_t *out) {
+    size_t code_idx = 0, o = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < len; ++i) {
+        if (in[i] == 0) {
+            out[code_idx] = code;
+            code_idx = o++;
+            code = 1;
+        } else {
+            out[o++] = in[i];
+            if (++code == 0xFF) {
+                out[code_idx] = code;
+                code_idx = o++;
+                code = 1;
+            }
+        }
+    }
+    out[code_idx] = code;
+    return o;
+}
+
+// Retorna o tamanho decodificado ou 0 se o bloco for inválido
+static size_t cobs_decode(const uint8_t *in, size_t len, uint8_t *out, size_t out_max) {
+    size_t i = 0, o = 0;
+    while (i < len) {
+        uint8_t code = in[i++];
+        if (code == 0 || i + code - 1 > len) return 0;
+        for (uint8_t k = 1; k < code; ++k) {
+            if (o >= out_max) return 0;
+            out[o++] = in[i++];
+        }
+        if (code != 0xFF && i < len) {
+            if (o >= out_max) return 0;
+            out[o++] = 0;
+        }
+    }
+    return o;
+}
+
+static void put_u16(uint8_t *p, uint16_t v) { p[0] = v & 0xFF; p[1] = v >> 8; }
+static void put_u32(uint8_t *p, uint32_t v) { put_u16(p, v & 0xFFFF); put_u16(p + 2, v >> 16); }
+
+// Envia um quadro e retorna o seq usado (0 se a USB não está conectada)
+static uint16_t tlm_send(uint8_t type, const uint8_t *payload, size_t len) {
+    if (!stdio_usb_connected() || len + 8 > TLM_MAX_RAW) return 0;
+    uint8_t raw[TLM_MAX_RAW];
+    uint8_t enc[TLM_MAX_ENCODED];
+    uint16_t seq = tlm_next_seq++;
+    if (tlm_next_seq == 0) tlm_next_seq = 1;
+    raw[0] = TLM_VERSION;
+    raw[1] = type;
+    put_u16(raw + 2, seq);
+    memcpy(raw + 4, payload, len);
+    put_u32(raw + 4 + len, crc32_compute(raw, 4 + len));
+    size_t n = cobs_encode(raw, len + 8, enc);
+    // putchar_raw: sem a conversão \n -> \r\n do stdio, que corromperia o quadro
+    putchar_raw(0);
+    for (size_t i = 0; i < n; ++i) putchar_raw(enc[i]);
+    putchar_raw(0);
+    stdio_flush();
+    return seq;
+}
+
+static uint16_t tlm_send_counter(uint32_t value, uint32_t event_ts, uint16_t retries) {
+    uint8_t p[18];
+    memcpy(p, board_uid.id, 8);
+    put_u32(p + 8, value);
+    put_u32(p + 12, event_ts);
+    put_u16(p + 16, retries);
+    return tlm_send(TLM_COUNTER, p, sizeof(p));
+}
+
+static void tlm_send_event(uint8_t code, uint32_t value, uint32_t event_ts) {
+    uint8_t p[17];
+    memcpy(p, board_uid.id, 8);
+    p[8] = code;
+    put_u32(p + 9, value);
+    put_u32(p + 13, event_ts);
+    tlm_send(TLM_EVENT, p, sizeof(p));
+}
+
+// Lê (sem bloquear) o que a ponte enviou; retorna true ao completar um ACK válido
+static bool tlm_poll_ack(uint16_t *seq, uint8_t *status) {
+    int c;
+    while ((c = getchar_timeout_us(0)) != PICO_ERROR_TIMEOUT) {
+        if (c != 0) {
+            if (tlm_rx_len < sizeof(tlm_rx_buf)) tlm_rx_buf[tlm_rx_len++] = (uint8_t)c;
+            else tlm_rx_overflow = true;
+            continue;
+        }
+        size_t enc_len = tlm_rx_len;
+        bool overflow = tlm_rx_overflow;
+        tlm_rx_len = 0;
+        tlm_rx_overflow = false;
+        if (enc_len == 0 || overflow) continue;
+        uint8_t raw[TLM_MAX_RAW];
+        size_t n = cobs_decode(tlm_rx_buf, enc_len, raw, sizeof(raw));
+        if (n != 11 || raw[0] != TLM_VERSION || raw[1] != TLM_ACK) continue;
+        uint32_t crc = raw[7] | (raw[8] << 8) | (raw[9] << 16) | ((uint32_t)raw[10] << 24);
+        if (crc32_compute(raw, 7) != crc) continue;
+        *seq = raw[4] | (raw[5] << 8);
+        *status = raw[6];
+        return true;
+    }
+    return false;
+}
+
 // ========== FUNÇÕES DO RTC DS3231 ==========
 static uint8_t bcd_to_dec(uint8_t val) {
     return (val / 16 * 10) + (val % 16);
@@ -246,7 +926,7 @@ static uint8_t bcd_to_dec(uint8_t val) {
 static uint8_t dec_to_bcd(uint8_t val) {
     return (val / 10 * 16) + (val % 10);
 }
-static void ds3231_set_time(uint8_t sec, uint8_t min, uint8_t hour, uint8_t day_of_week, uint8_t day, uint8_t month, uint8_t year) {
+static bool ds3231_set_time(uint8_t sec, uint8_t min, uint8_t hour, uint8_t day_of_week, uint8_t day, uint8_t month, uint8_t year) {
     uint8_t data[8];
     data[0] = 0x00;
     data[1] = dec_to_bcd(sec);
@@ -256,8 +936,12 @@ static void ds3231_set_time(uint8_t sec, uint8_t min, uint8_t hour, uint8_t day_
     data[5] = dec_to_bcd(day);
     data[6] = dec_to_bcd(month);
     data[7] = dec_to_bcd(year);
-    i2c_write_blocking(RTC_I2C_PORT, DS3231_ADDR, data, 8, false);
+    if (!i2c_bus_write(&rtc_bus, DS3231_ADDR, data, 8)) {
+        printf("[CORE1] Falha ao configurar o RTC DS3231.\n");
+        return false;
+    }
     printf("[CORE1] RTC DS3231 configurado.\n");
+    return true;
 }
 struct ds3231_time {
     uint8_t sec;
@@ -267,22 +951,36 @@ struct ds3231_time {
     uint8_t month;
     uint8_t year;
 };
-static void ds3231_get_time(struct ds3231_time *t) {
+// Converte data/hora do RTC (hora local) em segundos desde 01/01/1970, sem fuso:
+// o servidor converte o próprio relógio local da mesma forma antes de comparar
+static uint32_t ds3231_to_epoch(const struct ds3231_time *t) {
+    int y = 2000 + t->year;
+    int m = t->month;
+    y -= (m <= 2);
+    int era = y / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + t->day - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    uint32_t days = (uint32_t)(era * 146097 + doe - 719468);
+    return days * 86400u + t->hour * 3600u + t->min * 60u + t->sec;
+}
+
+// Retorna false (e não altera 't') se o RTC não respondeu dentro do prazo
+static bool ds3231_get_time(struct ds3231_time *t) {
     uint8_t buffer[7];
-    uint8_t reg = 0x00;
-    i2c_write_blocking(RTC_I2C_PORT, DS3231_ADDR, &reg, 1, true);
-    i2c_read_blocking(RTC_I2C_PORT, DS3231_ADDR, buffer, 7, false);
+    if (!i2c_bus_read_reg(&rtc_bus, DS3231_ADDR, 0x00, buffer, sizeof(buffer))) return false;
     t->sec = bcd_to_dec(buffer[0]);
     t->min = bcd_to_dec(buffer[1]);
     t->hour = bcd_to_dec(buffer[2] & 0x3F);
     t->day = bcd_to_dec(buffer[4]);
     t->month = bcd_to_dec(buffer[5] & 0x7F);
     t->year = bcd_to_dec(buffer[6]);
+    return true;
 }
 
 // ========== FUNÇÕES DE FLASH (CORE0 APENAS) ==========
-static int nv_find_latest(uint32_t *out_counter, uint32_t *out_seq, uint8_t *out_day, uint8_t *out_month, uint8_t *out_year, uint8_t *out_hour) {
-    const uint8_t *flash_ptr = (const uint8_t *)(XIP_BASE + FLASH_TARGET_OFFSET);
+static int nv_scan_sector(uint32_t offset, uint32_t *out_counter, uint32_t *out_seq, uint8_t *out_day, uint8_t *out_month, uint8_t *out_year, uint8_t *out_hour) {
+    const uint8_t *flash_ptr = (const uint8_t *)(XIP_BASE + offset);
     uint32_t best_seq = 0;
     uint32_t best_counter = 0;
     uint8_t best_day = 0;
@@ -321,6 +1019,23 @@ static int nv_find_latest(uint32_t *out_counter, uint32_t *out_seq, uint8_t *out
     return -1;
 }
 
+// Registro mais recente entre o setor normal e o de emergência (no empate vale o de
+// emergência: o core1 pode gravá-lo enquanto o core0 grava o normal com o mesmo seq)
+static int nv_find_latest(uint32_t *out_counter, uint32_t *out_seq, uint8_t *out_day, uint8_t *out_month, uint8_t *out_year, uint8_t *out_hour) {
+    uint32_t e_counter = 0, e_seq = 0;
+    uint8_t e_day = 0, e_month = 0, e_year = 0, e_hour = 0;
+    int normal = nv_scan_sector(FLASH_TARGET_OFFSET, out_counter, out_seq, out_day, out_month, out_year, out_hour);
+    if (nv_scan_sector(EMERGENCY_TARGET_OFFSET, &e_counter, &e_seq, &e_day, &e_month, &e_year, &e_hour) != 0) return normal;
+    if (normal == 0 && *out_seq > e_seq) return 0;
+    *out_counter = e_counter;
+    *out_seq = e_seq;
+    if (out_day) *out_day = e_day;
+    if (out_month) *out_month = e_month;
+    if (out_year) *out_year = e_year;
+    if (out_hour) *out_hour = e_hour;
+    return 0;
+}
+
 static int nv_load_counter(uint32_t *out_counter, uint32_t *out_seq, uint8_t *out_day, uint8_t *out_month, uint8_t *out_year, uint8_t *out_hour) {
     // Retorna 0 se encontrou, -1 se não
     return nv_find_latest(out_counter, out_seq, out_day, out_month, out_year, out_hour);
@@ -380,10 +1095,102 @@ static int nv_save_counter(uint32_t counter, uint8_t day, uint8_t month, uint8_t
     restore_interrupts(ints);
     multicore_lockout_end_blocking();
 
+    nv_last_seq = new_seq;
     printf("[CORE0] NV salvo (page=%d, seq=%lu, counter=%lu, date=%02d/%02d/%02d %02dh) erased=%d\n", free_page, (unsigned long)new_seq, (unsigned long)counter, day, month, year, hour, erased ? 1 : 0);
     return 0;
 }
 
+// Prepara o setor de emergência (CORE0): se foi usado, preserva o registro no setor
+// normal (quando é o mais recente) e apaga, deixando todas as páginas livres
+static void emergency_rearm() {
+    const uint8_t *base = (const uint8_t *)(XIP_BASE + EMERGENCY_TARGET_OFFSET);
+    bool used = false;
+    for (uint32_t page = 0; page < NV_PAGES_PER_SECTOR && !used; ++page) {
+        used = ((const nv_page_t *)(base + page * FLASH_PAGE_SIZE))->magic != 0xFFFFFFFFu;
+    }
+    if (used) {
+        emergency_ready = false;
+        uint32_t n_counter = 0, n_seq = 0, e_counter = 0, e_seq = 0;
+        uint8_t d = 0, m = 0, y = 0, h = 0;
+        bool has_normal = nv_scan_sector(FLASH_TARGET_OFFSET, &n_counter, &n_seq, NULL, NULL, NULL, NULL) == 0;
+        if (nv_scan_sector(EMERGENCY_TARGET_OFFSET, &e_counter, &e_seq, &d, &m, &y, &h) == 0 && (!has_normal || e_seq >= n_seq)) {
+            printf("[CORE0] Registro de emergência (counter=%lu) copiado para o setor normal\n", (unsigned long)e_counter);
+            nv_save_counter(e_counter, d, m, y, h);
+        }
+        multicore_lockout_start_blocking();
+        uint32_t ints = save_and_disable_interrupts();
+        flash_range_erase(EMERGENCY_TARGET_OFFSET, FLASH_SECTOR_SIZE);
+        restore_interrupts(ints);
+        multicore_lockout_end_blocking();
+        printf("[CORE0] Setor de emergência apagado\n");
+    }
+    uint32_t counter = 0, seq = 0;
+    if (nv_find_latest(&counter, &seq, NULL, NULL, NULL, NULL) == 0 && seq > nv_last_seq) nv_last_seq = seq;
+    emergency_next_page = 0;
+    emergency_ready = true;
+}
+
+// Gravação de emergência (CORE1, na queda de energia): só programa uma página já
+// apagada. O core0 (vítima do lockout) fica parado em RAM durante a programação.
+static bool emergency_save(uint32_t counter, const struct ds3231_time *t) {
+    static nv_page_t page_buf;
+    static uint32_t last_seq = 0;
+    uint8_t page = emergency_next_page;
+    if (!emergency_ready || page >= NV_PAGES_PER_SECTOR) return false;
+
+    uint32_t seq = (nv_last_seq > last_seq ? nv_last_seq : last_seq) + 1;
+    memset(&page_buf, 0xFF, sizeof(page_buf));
+    page_buf.magic = NV_RECORD_MAGIC;
+    page_buf.seq = seq;
+    page_buf.counter = counter;
+    page_buf.day = t->day;
+    page_buf.month = t->month;
+    page_buf.year = t->year;
+    page_buf.hour = t->hour;
+    page_buf.crc32 = crc32_compute((const uint8_t *)&page_buf, 16);
+
+    // O core0 pode estar no meio de uma gravação normal (mutex do lockout): não espera além do prazo
+    if (!multicore_lockout_start_timeout_us(PF_LOCKOUT_TIMEOUT_US)) return false;
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_program(EMERGENCY_TARGET_OFFSET + page * FLASH_PAGE_SIZE, (const uint8_t *)&page_buf, FLASH_PAGE_SIZE);
+    restore_interrupts(ints);
+    multicore_lockout_end_timeout_us(PF_LOCKOUT_TIMEOUT_US);
+    last_seq = seq;
+    emergency_next_page = page + 1;
+    return true;
+}
+
+// ========== QUEDA DE ENERGIA (ADC, CORE1) ==========
+static uint32_t pf_read_mv() {
+    return (uint32_t)adc_read() * 3300u * PF_DIVIDER / 4096u;
+}
+
+// Liga o ADC e confere se há divisor no GP26: pino aterrado ou solto não dá uma
+// leitura estável dentro da faixa de VSYS. Exige VSYS >= PF_REARM_MV: abaixo disso o
+// monitor nunca rearmaria depois de um disparo
+static void pf_init() {
+#if PF_MONITOR_ENABLED
+    adc_init();
+    adc_gpio_init(PF_ADC_GPIO);
+    adc_select_input(PF_ADC_INPUT);
+    uint32_t min_mv = UINT32_MAX, max_mv = 0;
+    for (int i = 0; i < 16; ++i) {
+        uint32_t mv = pf_read_mv();
+        if (mv < min_mv) min_mv = mv;
+        if (mv > max_mv) max_mv = mv;
+        sleep_us(100);
+    }
+    pf_vsys_mv = min_mv;
+    pf_monitor_present = (min_mv >= PF_REARM_MV && max_mv <= PF_PRESENT_MAX_MV && max_mv - min_mv < 200);
+    if (pf_monitor_present) {
+        printf("[CORE1] Monitor de energia ativo: VSYS=%lu mV\n", (unsigned long)min_mv);
+    } else {
+        printf("[CORE1] Monitor de energia ausente (ADC %lu..%lu mV): gravações periódicas normais\n",
+               (unsigned long)min_mv, (unsigned long)max_mv);
+    }
+#endif
+}
+
 // Função wrapper para leitura na inicialização (usada por core1 via leitura global)
 static bool load_counter_from_flash_wrapper(uint32_t *counter, uint8_t *day, uint8_t *month, uint8_t *year, uint8_t *hour) {
     uint32_t seq = 0;
@@ -396,13 +1203,13 @@ static bool load_counter_from_flash_wrapper(uint32_t *counter, uint8_t *day, uin
 
 // ========== LÓGICA DE TURNOS ==========
 typedef enum {
-    TURNO_1,   // 06:00 - 17:59 (ajustado conforme necessidade)
+    TURNO_1,   // 06:00 - 15:59 (mesma janela do servidor: 'Turno 1 (06:00 - 16:00 h)')
     TURNO_2,   // 22:00 - 05:59
     INTERVALO
 } ShiftState;
 
 static ShiftState get_current_shift_state(uint8_t hour) {
-    if (hour >= 6 && hour < 18) {
+    if (hour >= 6 && hour < 16) {
         return TURNO_1;
     } else if (hour >= 22 || hour < 6) {
         return TURNO_2;
@@ -414,28 +1221,28 @@ static ShiftState get_current_shift_state(uint8_t hour) {
 // Update LCD helpers
 static void update_lcd_count() {
     char buf[17];
-    snprintf(buf, sizeof(buf), "%lu", (unsigned long)event_counter);
+    // Completa com espaços os 6 caracteres do campo (sem limpar antes)
+    if (lcd_reinit.active) return; // redesenhado ao fim da reinicialização
+    snprintf(buf, sizeof(buf), "%-6lu", (unsigned long)event_counter);
     mutex_enter_blocking(&lcd_mutex);
     lcd_set_cursor(10, 0); // Posição após "Contador: "
-    lcd_write_string("      "); // Limpa 6 caracteres
-    lcd_set_cursor(10, 0);
     lcd_write_string(buf);
     mutex_exit(&lcd_mutex);
 }
 
 static void update_lcd_time(struct ds3231_time *t, ShiftState state) {
     char buf[17];
+    if (lcd_reinit.active) return;
     const char *state_str;
     switch (state) {
         case TURNO_1:   state_str = "Turno 1"; break;
         case TURNO_2:   state_str = "Turno 2"; break;
         default:        state_str = "INT"; break;
     }
-    snprintf(buf, sizeof(buf), "%02d:%02d:%02d %-9s", t->hour, t->min, t->sec, state_str);
+    // Linha inteira (16 caracteres) em uma passada, sem limpar antes
+    snprintf(buf, sizeof(buf), "%02d:%02d:%02d %-7s", t->hour, t->min, t->sec, state_str);
     mutex_enter_blocking(&lcd_mutex);
     lcd_set_cursor(0, 1);
-    lcd_write_string("                ");
-    lcd_set_cursor(0, 1);
     lcd_write_string(buf);
     mutex_exit(&lcd_mutex);
 }
@@ -457,17 +1264,342 @@ static bool is_previous_day(uint8_t c_d, uint8_t c_m, uint8_t c_y, uint8_t p_d,
     return (c_d == p_d + 1);
 }
 
+// ========== TOTAIS POR TURNO NA FLASH E RECONCILIAÇÃO (CORE0) ==========
+// O total de cada turno encerrado fica na flash (LEDGER_MAX_SHIFTS mais recentes).
+// A cada SYNC_INTERVAL_MS o core0 envia ao servidor um hash FNV-1a por faixa de
+// SYNC_BUCKET_DAYS dias (GET /sync/digest). Só as faixas diferentes são enviadas por
+// completo (GET /sync/totals), e os dois lados ficam com o maior total de cada turno.
+// O contador é acumulado e só se perde contagem (envio que falhou, reboot, troca de
+// turno sem envio), então o maior valor é o correto. Texto canônico de uma faixa:
+// "AAAAMMDD.T:total;" por turno, em ordem, sem o turno em andamento (web/reconcile.py).
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME  16777619u
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t date;    // AAAAMMDD do início do turno
+    uint32_t total;
+    uint8_t turno;    // 1 ou 2
+    uint8_t reserved[7];
+    uint32_t crc32;   // dos 28 bytes anteriores
+} ledger_rec_t;
+
+typedef struct {
+    uint32_t date;
+    uint8_t turno;
+    uint32_t total;
+} ledger_entry_t;
+
+// Cópia em RAM, em ordem de (data, turno)
+static ledger_entry_t ledger[LEDGER_MAX_SHIFTS];
+static int ledger_count = 0;
+static uint32_t ledger_seq = 0;
+static int ledger_next_slot = 0;
+
+static char sync_path[384];
+static char sync_resp[384];
+static uint16_t sync_resp_len = 0;
+
+// Dias desde 1970-01-01 (calendário gregoriano) e o inverso, em AAAAMMDD
+static int32_t days_from_civil(int y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    const int era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = (unsigned)(y - era * 400);
+    const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int32_t)doe - 719468;
+}
+
+static uint32_t date_key_from_days(int32_t z) {
+    z += 719468;
+    const int era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned doe = (unsigned)(z - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    const unsigned d = doy - (153 * mp + 2) / 5 + 1;
+    const unsigned m = mp < 10 ? mp + 3 : mp - 9;
+    return (uint32_t)(((int)yoe + era * 400 + (m <= 2)) * 10000 + m * 100 + d);
+}
+
+static int32_t date_key_days(uint32_t key) {
+    return days_from_civil((int)(key / 10000), (key / 100) % 100, key % 100);
+}
+
+// Data de início do turno que contém (dia, hora): o Turno 2 da madrugada é do dia anterior
+static uint32_t shift_date_key(uint8_t day, uint8_t month, uint8_t year, uint8_t hour) {
+    int32_t days = days_from_civil(2000 + year, month, day);
+    if (get_current_shift_state(hour) == TURNO_2 && hour < 6) days--;
+    return date_key_from_days(days);
+}
+
+static uint32_t ledger_bucket(uint32_t date) {
+    return (uint32_t)(date_key_days(date) / SYNC_BUCKET_DAYS);
+}
+
+static uint32_t fnv1a(uint32_t h, const char *s) {
+    while (*s) {
+        h ^= (uint8_t)*s++;
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+// Grava ou aumenta o total na RAM; false se nada mudou (ou turno mais antigo que a janela)
+static bool ledger_ram_set(uint32_t date, uint8_t turno, uint32_t total) {
+    int i = 0;
+    while (i < ledger_count && (ledger[i].date < date || (ledger[i].date == date && ledger[i].turno < turno))) i++;
+    if (i < ledger_count && ledger[i].date == date && ledger[i].turno == turno) {
+        if (total <= ledger[i].total) return false;
+        ledger[i].total = total;
+        return true;
+    }
+    if (ledger_count == LEDGER_MAX_SHIFTS) {
+        if (i == 0) return false;
+        // Descarta o mais antigo
+        memmove(&ledger[0], &ledger[1], (size_t)(i - 1) * sizeof(ledger[0]));
+        i--;
+    } else {
+        memmove(&ledger[i + 1], &ledger[i], (size_t)(ledger_count - i) * sizeof(ledger[0]));
+        ledger_count++;
+    }
+    ledger[i].date = date;
+    ledger[i].turno = turno;
+    ledger[i].total = total;
+    return true;
+}
+
+static void ledger_fill_rec(ledger_rec_t *rec, const ledger_entry_t *e) {
+    memset(rec, 0, sizeof(*rec));
+    rec->magic = LEDGER_MAGIC;
+    rec->seq = ++ledger_seq;
+    rec->date = e->date;
+    rec->total = e->total;
+    rec->turno = e->turno;
+    rec->crc32 = crc32_compute((const uint8_t *)rec, offsetof(ledger_rec_t, crc32));
+}
+
+static void ledger_program_page(uint32_t page, const uint8_t *data) {
+    multicore_lockout_start_blocking();
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_program(LEDGER_TARGET_OFFSET + page * FLASH_PAGE_SIZE, data, FLASH_PAGE_SIZE);
+    restore_interrupts(ints);
+    multicore_lockout_end_blocking();
+}
+
+static void ledger_load() {
+    const uint8_t *base = (const uint8_t *)(XIP_BASE + LEDGER_TARGET_OFFSET);
+    ledger_count = 0;
+    ledger_next_slot = LEDGER_SLOTS;
+    for (int slot = 0; slot < LEDGER_SLOTS; ++slot) {
+        const ledger_rec_t *rec = (const ledger_rec_t *)(base + slot * LEDGER_SLOT_SIZE);
+        if (rec->magic == 0xFFFFFFFFu) {
+            // Registros são anexados em ordem: o resto do setor está livre
+            ledger_next_slot = slot;
+            break;
+        }
+        if (rec->magic != LEDGER_MAGIC) continue;
+        if (crc32_compute((const uint8_t *)rec, offsetof(ledger_rec_t, crc32)) != rec->crc32) continue;
+        if (rec->seq > ledger_seq) ledger_seq = rec->seq;
+        ledger_ram_set(rec->date, rec->turno, rec->total);
+    }
+    printf("[CORE0] Totais por turno na flash: %d turno(s), próximo slot %d\n", ledger_count, ledger_next_slot);
+}
+
+// Setor cheio: apaga e regrava só o estado atual (um registro por turno)
+static void ledger_compact() {
+    static uint8_t page_buf[FLASH_PAGE_SIZE];
+    multicore_lockout_start_blocking();
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(LEDGER_TARGET_OFFSET, FLASH_SECTOR_SIZE);
+    restore_interrupts(ints);
+    multicore_lockout_end_blocking();
+    for (int first = 0; first < ledger_count; first += LEDGER_SLOTS_PER_PAGE) {
+        memset(page_buf, 0xFF, sizeof(page_buf));
+        for (int j = 0; j < LEDGER_SLOTS_PER_PAGE && first + j < ledger_count; ++j) {
+            ledger_fill_rec((ledger_rec_t *)(page_buf + j * LEDGER_SLOT_SIZE), &ledger[first + j]);
+        }
+        ledger_program_page((uint32_t)(first / LEDGER_SLOTS_PER_PAGE), page_buf);
+    }
+    ledger_next_slot = ledger_count;
+    printf("[CORE0] Totais por turno compactados (%d turno(s))\n", ledger_count);
+}
+
+// Registra o total de um turno encerrado (só grava se aumentou)
+static bool ledger_put(uint32_t date, uint8_t turno, uint32_t total) {
+    if (date == 0 || (turno != 1 && turno != 2) || total == 0) return false;
+    if (!ledger_ram_set(date, turno, total)) return false;
+    if (ledger_next_slot >= LEDGER_SLOTS) {
+        ledger_compact();
+        return true;
+    }
+    // Reprograma a página com o conteúdo atual + o novo slot (bits só vão de 1 para 0)
+    static uint8_t page_buf[FLASH_PAGE_SIZE];
+    uint32_t page = (uint32_t)(ledger_next_slot / LEDGER_SLOTS_PER_PAGE);
+    memcpy(page_buf, (const uint8_t *)(XIP_BASE + LEDGER_TARGET_OFFSET + page * FLASH_PAGE_SIZE), FLASH_PAGE_SIZE);
+    ledger_entry_t e = { .date = date, .turno = turno, .total = total };
+    ledger_fill_rec((ledger_rec_t *)(page_buf + (ledger_next_slot % LEDGER_SLOTS_PER_PAGE) * LEDGER_SLOT_SIZE), &e);
+    ledger_program_page(page, page_buf);
+    ledger_next_slot++;
+    printf("[CORE0] Total do turno %lu.%u = %lu gravado na flash\n", (unsigned long)date, turno, (unsigned long)total);
+    return true;
+}
+
+// Corpo da resposta de /sync/* (o cabeçalho é tratado pelo cliente HTTP)
+static err_t sync_recv_fn(void *arg, struct altcp_pcb *conn, struct pbuf *p, err_t err) {
+    if (!p) return ERR_OK;
+    uint16_t room = (uint16_t)(sizeof(sync_resp) - 1 - sync_resp_len);
+    uint16_t n = p->tot_len < room ? p->tot_len : room;
+    pbuf_copy_partial(p, sync_resp + sync_resp_len, n, 0);
+    sync_resp_len += n;
+    sync_resp[sync_resp_len] = '\0';
+    altcp_recved(conn, p->tot_len);
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+static bool sync_get() {
+    sync_resp_len = 0;
+    sync_resp[0] = '\0';
+    EXAMPLE_HTTP_REQUEST_T req = {
+        .hostname   = HOST,
+        .url        = sync_path,
+        .port       = PORT,
+        .recv_fn    = sync_recv_fn
+    };
+    int res = http_client_request_sync(cyw43_arch_async_context(), &req);
+    if (res != 0 || strstr(sync_resp, "\"ok\":true") == NULL) {
+        printf("[CORE0] Reconciliação: %s falhou (res=%d)\n", sync_path, res);
+        return false;
+    }
+    return true;
+}
+
+// Anexa a sync_path; false se não coube
+static bool sync_append(size_t *len, const char *fmt, unsigned long a, unsigned long b, unsigned long c) {
+    int n = snprintf(sync_path + *len, sizeof(sync_path) - *len, fmt, a, b, c);
+    if (n < 0 || (size_t)n >= sizeof(sync_path) - *len) return false;
+    *len += (size_t)n;
+    return true;
+}
+
+static bool sync_is_open(const ledger_entry_t *e, uint32_t open_date, uint8_t open_turno) {
+    return e->date == open_date && e->turno == open_turno;
+}
+
+// Início de sync_path: rota, dispositivo, turno aberto e, com o ledger cheio, o turno mais
+// antigo ainda guardado (from=). Os anteriores da mesma faixa já saíram da flash: sem o
+// limite, essa faixa seria diferente em toda rodada e os turnos devolvidos pelo servidor
+// seriam descartados de novo. Retorna o comprimento ou 0 se não coube
+static size_t sync_path_begin(const char *route, uint32_t open_date, uint8_t open_turno) {
+    int n = snprintf(sync_path, sizeof(sync_path), "%s?device=%s&open=%lu.%u",
+                     route, device_id, (unsigned long)open_date, open_turno);
+    if (n < 0 || (size_t)n >= sizeof(sync_path)) return 0;
+    size_t len = (size_t)n;
+    if (ledger_count == LEDGER_MAX_SHIFTS &&
+        !sync_append(&len, "&from=%lu.%lu", ledger[0].date, ledger[0].turno, 0)) return 0;
+    return len;
+}
+
+// Envia os totais de uma faixa e adota os do servidor (já com o maior de cada turno)
+static int sync_fix_bucket(uint32_t bucket, uint32_t open_date, uint8_t open_turno) {
+    size_t len = sync_path_begin("/sync/totals", open_date, open_turno);
+    if (len == 0 || !sync_append(&len, "&b=%lu&t=", bucket, 0, 0)) return -1;
+    const char *sep = "";
+    for (int i = 0; i < ledger_count; ++i) {
+        if (ledger_bucket(ledger[i].date) != bucket || sync_is_open(&ledger[i], open_date, open_turno)) continue;
+        if (!sync_append(&len, *sep ? ",%lu.%lu:%lu" : "%lu.%lu:%lu",
+                         ledger[i].date, ledger[i].turno, ledger[i].total)) return -1;
+        sep = ",";
+    }
+    if (!sync_get()) return -1;
+
+    const char *t = strstr(sync_resp, "\"t\":\"");
+    if (!t) return -1;
+    t += 5;
+    int fixed = 0;
+    while (*t && *t != '"') {
+        char *end;
+        uint32_t date = strtoul(t, &end, 10);
+        if (*end != '.') break;
+        uint8_t turno = (uint8_t)strtoul(end + 1, &end, 10);
+        if (*end != ':') break;
+        uint32_t total = strtoul(end + 1, &end, 10);
+        if (ledger_put(date, turno, total)) fixed++;
+        t = (*end == ',') ? end + 1 : end;
+    }
+    const char *raised = strstr(sync_resp, "\"raised\":");
+    if (raised) fixed += (int)strtoul(raised + 9, NULL, 10);
+    return fixed;
+}
+
+// Uma rodada de reconciliação; retorna false se não concluiu
+static bool sync_run(uint32_t open_date, uint8_t open_turno) {
+    if (ledger_count == 0) return true;
+    uint32_t first = ledger_bucket(ledger[0].date);
+    uint32_t last = ledger_bucket(ledger[ledger_count - 1].date);
+    if (last - first >= SYNC_MAX_BUCKETS) first = last - SYNC_MAX_BUCKETS + 1;
+    size_t len = sync_path_begin("/sync/digest", open_date, open_turno);
+    if (len == 0 || !sync_append(&len, "&b=", 0, 0, 0)) return false;
+    int i = 0;
+    while (i < ledger_count && ledger_bucket(ledger[i].date) < first) i++;
+    for (uint32_t bucket = first; bucket <= last; ++bucket) {
+        // Faixas sem turno na flash também vão (hash vazio): revelam turnos que só o servidor tem
+        uint32_t h = FNV_OFFSET;
+        char item[32];
+        for (; i < ledger_count && ledger_bucket(ledger[i].date) == bucket; ++i) {
+            if (sync_is_open(&ledger[i], open_date, open_turno)) continue;
+            snprintf(item, sizeof(item), "%lu.%u:%lu;", (unsigned long)ledger[i].date, ledger[i].turno,
+                     (unsigned long)ledger[i].total);
+            h = fnv1a(h, item);
+        }
+        if (!sync_append(&len, bucket == first ? "%lu:%08lx" : ",%lu:%08lx", bucket, h, 0)) return false;
+    }
+    if (!sync_get()) return false;
+
+    const char *diff = strstr(sync_resp, "\"diff\":[");
+    if (!diff) return false;
+    // Copia a lista antes de reutilizar sync_resp nas correções
+    uint32_t buckets[SYNC_MAX_FIX_BUCKETS];
+    int n = 0;
+    const char *p = diff + 8;
+    while (n < SYNC_MAX_FIX_BUCKETS && *p && *p != ']') {
+        char *end;
+        buckets[n++] = strtoul(p, &end, 10);
+        if (end == p) break;
+        p = (*end == ',') ? end + 1 : end;
+    }
+    int fixed = 0;
+    for (int k = 0; k < n; ++k) {
+        int r = sync_fix_bucket(buckets[k], open_date, open_turno);
+        if (r < 0) return false;
+        fixed += r;
+    }
+    core0_stats.sync_fixed += (uint32_t)fixed;
+    printf("[CORE0] Reconciliação OK: %lu faixa(s), %d diferente(s), %d correção(ões)\n",
+           (unsigned long)(last - first + 1), n, fixed);
+    return true;
+}
+
 // ========== LÓGICA DO CORE 1 (Contagem de Pulsos) ==========
+// Pede ao core0 o registro do total de um turno encerrado (fila cheia: descarta)
+static void request_ledger_save(uint32_t date, ShiftState state, uint32_t total) {
+    if (state == INTERVALO || total == 0) return;
+    uint8_t next = (uint8_t)((ledger_queue_head + 1) % LEDGER_QUEUE_LEN);
+    if (next == ledger_queue_tail) return;
+    ledger_queue[ledger_queue_head].date = date;
+    ledger_queue[ledger_queue_head].turno = (uint8_t)state + 1;
+    ledger_queue[ledger_queue_head].total = total;
+    ledger_queue_head = next;
+}
+
 void core1_entry() {
     multicore_lockout_victim_init();
     printf("[CORE1] Core 1 iniciado. Monitorando GPIO %d...\n", GPIO_MONITOR);
 
     // Inicializa I2C do LCD (i2c1)
-    i2c_init(I2C_PORT, 100 * 1000);
-    gpio_set_function(SDA_PIN, GPIO_FUNC_I2C);
-    gpio_set_function(SCL_PIN, GPIO_FUNC_I2C);
-    gpio_pull_up(SDA_PIN);
-    gpio_pull_up(SCL_PIN);
+    i2c_bus_init(&lcd_bus);
 
     mutex_enter_blocking(&lcd_mutex);
     lcd_init();
@@ -479,11 +1611,7 @@ void core1_entry() {
     mutex_exit(&lcd_mutex);
 
     // Inicializa I2C do RTC (i2c0)
-    i2c_init(RTC_I2C_PORT, 100 * 1000);
-    gpio_set_function(RTC_SDA_PIN, GPIO_FUNC_I2C);
-    gpio_set_function(RTC_SCL_PIN, GPIO_FUNC_I2C);
-    gpio_pull_up(RTC_SDA_PIN);
-    gpio_pull_up(RTC_SCL_PIN);
+    i2c_bus_init(&rtc_bus);
 
 #if SET_RTC_TIME
     // Ajuste manual: descomente apenas na primeira gravação do firmware
@@ -491,25 +1619,32 @@ void core1_entry() {
 #endif
 
     // Lê hora para determinar o estado inicial do turno ANTES de carregar a flash
-    struct ds3231_time current_rtc_time;
-    ds3231_get_time(&current_rtc_time);
+    struct ds3231_time current_rtc_time = {0};
+    for (int i = 0; i < 3 && !ds3231_get_time(&current_rtc_time); ++i) sleep_ms(10);
     ShiftState current_shift_state = get_current_shift_state(current_rtc_time.hour);
     ShiftState previous_shift_state = current_shift_state;
+    shared_shift_state = (uint8_t)current_shift_state;
+    // Data de início do turno em andamento (chave do total por turno na flash)
+    uint32_t open_shift_date = (current_shift_state == INTERVALO) ? 0 :
+        shift_date_key(current_rtc_time.day, current_rtc_time.month, current_rtc_time.year, current_rtc_time.hour);
+    shared_shift_date = open_shift_date;
 
     // Carrega contador da flash SOMENTE se estivermos dentro de um turno.
     // Se estivermos em INTERVALO, inicia com 0.
+    uint32_t saved_counter = 0;
+    uint8_t s_day = 0, s_month = 0, s_year = 0, s_hour = 0;
+    bool has_saved = load_counter_from_flash_wrapper(&saved_counter, &s_day, &s_month, &s_year, &s_hour);
+    bool restored = false;
     if (current_shift_state == INTERVALO) {
         event_counter = 0;
         printf("[CORE1] Inicializado em INTERVALO -> contador=0\n");
     } else {
-        uint32_t saved_counter = 0;
-        uint8_t s_day = 0, s_month = 0, s_year = 0, s_hour = 0;
-        if (load_counter_from_flash_wrapper(&saved_counter, &s_day, &s_month, &s_year, &s_hour)) {
+        if (has_saved) {
             bool should_restore = false;
             bool same_day = (s_day == current_rtc_time.day && s_month == current_rtc_time.month && s_year == current_rtc_time.year);
 
             if (current_shift_state == TURNO_1) {
-                // Turno 1 (06:00 - 17:59): Deve ser o mesmo dia
+                // Turno 1 (06:00 - 15:59): Deve ser o mesmo dia
                 if (same_day && get_current_shift_state(s_hour) == TURNO_1) should_restore = true;
             } else if (current_shift_state == TURNO_2) {
                 // Turno 2 (22:00 - 05:59): Pode cruzar a meia-noite
@@ -527,6 +1662,7 @@ void core1_entry() {
             }
 
             if (should_restore) {
+                restored = true;
                 event_counter = saved_counter;
                 printf("[CORE1] Inicializado em TURNO -> Registro válido (%02d/%02d/%02d %02dh). Contador restaurado: %lu\n", s_day, s_month, s_year, s_hour, (unsigned long)event_counter);
             } else {
@@ -538,6 +1674,10 @@ void core1_entry() {
             printf("[CORE1] Inicializado em TURNO -> Flash vazia ou inválida. Contador zerado.\n");
         }
     }
+    // Registro não restaurado: é o último total conhecido de um turno já encerrado
+    if (has_saved && !restored) {
+        request_ledger_save(shift_date_key(s_day, s_month, s_year, s_hour), get_current_shift_state(s_hour), saved_counter);
+    }
     update_lcd_count();
     update_lcd_time(&current_rtc_time, current_shift_state);
 
@@ -572,9 +1712,18 @@ void core1_entry() {
     uint32_t buzzer_start_time = 0;
     bool meta_reached = (event_counter >= META_CONTAGEM);
 
+    // Queda de energia: leituras baixas seguidas, momento do disparo e início do VSYS bom
+    // após ele; pf_sagging = desarmado por VSYS baixo sem queda (ver PF_HOLDUP_MS)
+    pf_init();
+    int pf_low_samples = 0;
+    uint32_t pf_tripped_at = 0;
+    uint32_t pf_good_since = 0;
+    bool pf_sagging = false;
+
     uint32_t last_time_update = 0;
 
     while (1) {
+        uint32_t loop_start_us = time_us_32();
         int gpio_state = gpio_get(GPIO_MONITOR);
         int gpio_state_2 = gpio_get(GPIO_MONITOR_2);
         uint32_t current_time = to_ms_since_boot(get_absolute_time());
@@ -582,30 +1731,49 @@ void core1_entry() {
         // Atualiza a hora a cada segundo (para decidir turno)
         if (current_time - last_time_update >= 1000) {
             last_time_update = current_time;
+            // Sem resposta do RTC mantém a última hora lida (o turno não muda por um erro)
             ds3231_get_time(&current_rtc_time);
+            shared_rtc_epoch = ds3231_to_epoch(&current_rtc_time);
+            if (lcd_bus.came_back) {
+                // LCD religado ou que perdeu nibbles: volta ao modo 4 bits e redesenha,
+                // um passo por passada (lcd_reinit_poll abaixo)
+                lcd_bus.came_back = false;
+                lcd_reinit_start(current_time);
+            }
             current_shift_state = get_current_shift_state(current_rtc_time.hour);
+            shared_shift_state = (uint8_t)current_shift_state;
             // ATUALIZA O DISPLAY AQUI!
             update_lcd_time(&current_rtc_time, current_shift_state);
         }
+        if (lcd_reinit_poll(current_time)) {
+            update_lcd_count();
+            update_lcd_time(&current_rtc_time, current_shift_state);
+        }
 
         // Detecta mudança de estado (turno <-> intervalo ou troca de turno)
         if (current_shift_state != previous_shift_state) {
             printf("[CORE1] Mudança de estado: de %d para %d\n", previous_shift_state, current_shift_state);
 
-            // O salvamento do valor final do turno foi removido conforme solicitado.
-            // A lógica agora apenas zera o contador para o novo período.
-            printf("[CORE1] Fim do turno. O contador será zerado sem salvar na flash.\n");
-            
+            printf("[CORE1] Fim do período. Total: %lu\n", (unsigned long)event_counter);
+
+            // 1. Total do turno encerrado vai para o ledger da flash (reconciliação com o
+            //    servidor); intervalos e turnos sem peças não são registrados
+            request_ledger_save(open_shift_date, previous_shift_state, event_counter);
+
             // 2. Zera o contador e o estado para o novo turno/intervalo.
             //    Isso acontece em TODAS as transições.
             event_counter = 0;
             latest_pending = 0;
             has_pending_data = false;
+            shift_reset_event = true;
             update_lcd_count();
             printf("[CORE1] Contador zerado para o novo período.\n");
 
             // Atualiza previous_shift_state para o novo estado
             previous_shift_state = current_shift_state;
+            open_shift_date = (current_shift_state == INTERVALO) ? 0 :
+                shift_date_key(current_rtc_time.day, current_rtc_time.month, current_rtc_time.year, current_rtc_time.hour);
+            shared_shift_date = open_shift_date;
             // Atualiza LCD da hora/turno (para refletir mudança imediata)
             update_lcd_time(&current_rtc_time, current_shift_state);
             // Reseta timers de gravação
@@ -636,6 +1804,7 @@ void core1_entry() {
 
             if (delta > 0) {
                 event_counter += delta;
+                latest_pending_ts = ds3231_to_epoch(&current_rtc_time);
                 latest_pending = event_counter;
                 has_pending_data = true;
                 update_lcd_count();
@@ -644,6 +1813,53 @@ void core1_entry() {
             // Em intervalo: não contabilizar nada
         }
 
+        // --- Queda de energia ---
+        // Grava antes de qualquer printf: o que sobra do capacitor é para a página da flash
+        if (pf_monitor_present) {
+            uint32_t vsys_mv = pf_read_mv();
+            pf_vsys_mv = vsys_mv;
+            if (!pf_tripped && !pf_sagging) {
+                pf_low_samples = (vsys_mv < PF_TRIP_MV) ? pf_low_samples + 1 : 0;
+                if (pf_low_samples >= PF_TRIP_SAMPLES) {
+                    pf_tripped = true;
+                    pf_tripped_at = current_time;
+                    pf_good_since = 0;
+                    pwm_set_enabled(slice_num, false); // buzzer consome a reserva
+                    buzzer_active = false;
+                    if (current_shift_state != INTERVALO) {
+                        if (emergency_save(event_counter, &current_rtc_time)) {
+                            pf_emergency_saves++;
+                            last_saved_count = event_counter;
+                        } else {
+                            pf_emergency_fail++;
+                        }
+                    }
+                    pf_trips++;
+                    printf("[CORE1] Queda de energia (VSYS=%lu mV): contador %lu gravado\n",
+                           (unsigned long)vsys_mv, (unsigned long)event_counter);
+                }
+            } else if (vsys_mv >= PF_REARM_MV) {
+                // Foi só um afundamento: volta a vigiar depois de PF_REARM_MS estável
+                if (pf_good_since == 0) pf_good_since = current_time | 1;
+                // Com sinal: current_time | 1 pode passar current_time em 1 ms
+                if ((int32_t)(current_time - pf_good_since) >= PF_REARM_MS) {
+                    pf_tripped = false;
+                    pf_sagging = false;
+                    pf_low_samples = 0;
+                    printf("[CORE1] VSYS normalizado (%lu mV): monitor rearmado\n", (unsigned long)vsys_mv);
+                }
+            } else {
+                pf_good_since = 0;
+            }
+            if (pf_tripped && current_time - pf_tripped_at >= PF_HOLDUP_MS) {
+                // Sobreviveu à reserva: libera a flash e volta às gravações periódicas normais
+                pf_tripped = false;
+                pf_sagging = true;
+                printf("[CORE1] VSYS baixo sem queda (%lu mV): monitor desarmado até normalizar\n",
+                       (unsigned long)vsys_mv);
+            }
+        }
+
         // --- Lógica do Buzzer ---
         // Ativa se atingir a meta e ainda não tiver ativado neste ciclo
         if (!meta_reached && event_counter >= META_CONTAGEM) {
@@ -674,7 +1890,13 @@ void core1_entry() {
         // A cada segundo (no bloco de tempo), decidir pedido de gravação
         // (usamos last_time_update como referência do tick de 1s)
         // Aqui usamos uma checagem simples por tempo absoluto:
-        if ((to_ms_since_boot(get_absolute_time()) - last_save_time) >= SAVE_TIME_THRESHOLD_MS) {
+        // Com a gravação de emergência pronta, os limiares periódicos ficam bem maiores
+        bool pf_armed = pf_monitor_present && emergency_ready && !pf_sagging;
+        uint32_t save_time_ms = pf_armed ? SAVE_TIME_THRESHOLD_PF_MS : SAVE_TIME_THRESHOLD_MS;
+        uint32_t save_events = pf_armed ? SAVE_EVENT_THRESHOLD_PF : SAVE_EVENT_THRESHOLD;
+        if (pf_tripped) {
+            // Energia caindo: nada de apagar/gravar a flash pelo core0
+        } else if ((to_ms_since_boot(get_absolute_time()) - last_save_time) >= save_time_ms) {
             if (event_counter != last_saved_count) {
                 flash_save_value = event_counter;
                 flash_save_day = current_rtc_time.day;
@@ -690,7 +1912,7 @@ void core1_entry() {
             }
         } else {
             // também checa por SAVE_EVENT_THRESHOLD
-            if (event_counter > last_saved_count && (event_counter - last_saved_count) >= SAVE_EVENT_THRESHOLD) {
+            if (event_counter > last_saved_count && (event_counter - last_saved_count) >= save_events) {
                 flash_save_value = event_counter;
                 flash_save_day = current_rtc_time.day;
                 flash_save_month = current_rtc_time.month;
@@ -703,10 +1925,389 @@ void core1_entry() {
             }
         }
 
+        uint32_t loop_us = time_us_32() - loop_start_us;
+        if (loop_us > core1_loop_max_us) core1_loop_max_us = loop_us;
         sleep_ms(1);
     }
 }
 
+// ========== STATUS LOCAL (HTTP raw lwIP, CORE0) ==========
+// GET /status devolve contador, turno, última gravação/envio e os contadores de
+// desempenho do firmware, mesmo com o servidor fora. A resposta completa (cabeçalho +
+// JSON) é montada pelo laço do core0 só quando o estado muda (desempenho: no máximo
+// 1x/s) em um de dois buffers. Servir é um tcp_write sem cópia do buffer ativo, sem
+// formatação nem alocação. O buffer em envio fica preso (refs) até o último ACK;
+// a montagem seguinte usa o outro e, se ambos estiverem presos, espera a próxima volta.
+// Conexões têm prioridade mínima no lwIP, limite de STATUS_MAX_CONNS e prazo de 2 s,
+// então consultas agressivas não tiram recursos do envio ao servidor nem do core1.
+typedef struct {
+    uint32_t counter;
+    uint32_t pending_value;
+    uint8_t shift;
+    bool pending;
+    bool wifi;
+    bool usb_mode;
+    int8_t last_upload;
+    uint32_t saves;
+    uint32_t last_save_value;
+    uint32_t last_save_s;
+    uint32_t uploads_ok;
+    uint32_t uploads_fail;
+    uint32_t last_upload_value;
+    uint32_t last_upload_s;
+    int8_t last_sync;
+    uint32_t syncs;
+    uint32_t sync_fixed;
+    uint32_t last_sync_s;
+    uint32_t ledger_shifts;
+    int8_t wifi_mode;
+    bool wifi_lease;
+    uint32_t wifi_last_ms;
+    uint32_t wifi_max_ms;
+    uint32_t wifi_fast_ok;
+    uint32_t wifi_fast_fail;
+    uint32_t wifi_full;
+    bool pf_monitor;
+    bool pf_tripped;
+    bool pf_ready;
+    uint32_t pf_trips;
+    uint32_t pf_saves;
+    uint32_t pf_fail;
+} status_state_t;
+
+typedef struct {
+    uint32_t core0_loop_max_us;
+    uint32_t core1_loop_max_us;
+    uint32_t save_max_us;
+    uint32_t upload_max_ms;
+    uint32_t served;
+    uint32_t refused;
+    uint32_t i2c[2][5]; // lcd, rtc: transfers, errors, timeouts, recoveries, skipped
+    uint32_t vsys_mv;   // arredondado a 100 mV: o ruído do ADC não força remontagem
+} status_perf_t;
+
+typedef struct {
+    struct tcp_pcb *pcb;
+    int8_t buf;      // buffer do snapshot em envio (-1: nenhum/resposta constante)
+    uint16_t to_ack; // bytes enviados ainda sem ACK
+    bool answered;
+} status_conn_t;
+
+static const char status_not_found[] =
+    "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+static char status_bufs[2][STATUS_BUF_SIZE];
+static uint16_t status_len[2];
+static volatile uint8_t status_refs[2];
+static volatile int8_t status_active = -1;
+static status_conn_t status_conns[STATUS_MAX_CONNS];
+static struct tcp_pcb *status_listen_pcb = NULL;
+static status_state_t status_last_state;
+static status_perf_t status_last_perf;
+static uint32_t status_last_build_ms = 0;
+static volatile uint32_t status_served = 0;
+static volatile uint32_t status_refused = 0;
+static uint32_t status_builds = 0;
+static uint32_t status_deferred = 0;
+static bool status_usb_mode = false; // modo USB decidido pelo laço do core0
+
+static const char *status_shift_name(uint8_t shift) {
+    switch (shift) {
+        case TURNO_1: return "TURNO_1";
+        case TURNO_2: return "TURNO_2";
+        default:      return "INTERVALO";
+    }
+}
+
+static const char *status_upload_name(int8_t last) {
+    switch (last) {
+        case 0:  return "falha";
+        case 1:  return "wifi";
+        case 2:  return "usb";
+        default: return "nunca";
+    }
+}
+
+static void status_capture(status_state_t *st, status_perf_t *pf) {
+    // Zera também o padding: os dois são comparados com memcmp
+    memset(st, 0, sizeof(*st));
+    memset(pf, 0, sizeof(*pf));
+    st->counter = event_counter;
+    st->pending_value = latest_pending;
+    st->shift = shared_shift_state;
+    st->pending = has_pending_data;
+    st->wifi = wifi_connected;
+    st->usb_mode = status_usb_mode;
+    st->last_upload = core0_stats.last_upload;
+    st->saves = core0_stats.saves;
+    st->last_save_value = core0_stats.last_save_value;
+    st->last_save_s = core0_stats.last_save_s;
+    st->uploads_ok = core0_stats.uploads_ok;
+    st->uploads_fail = core0_stats.uploads_fail;
+    st->last_upload_value = core0_stats.last_upload_value;
+    st->last_upload_s = core0_stats.last_upload_s;
+    st->last_sync = core0_stats.last_sync;
+    st->syncs = core0_stats.syncs;
+    st->sync_fixed = core0_stats.sync_fixed;
+    st->last_sync_s = core0_stats.last_sync_s;
+    st->ledger_shifts = (uint32_t)ledger_count;
+    st->wifi_mode = wifi_reconnect.last_mode;
+    st->wifi_lease = wifi_reconnect.lease_used;
+    st->wifi_last_ms = wifi_reconnect.last_ms;
+    st->wifi_max_ms = wifi_reconnect.max_ms;
+    st->wifi_fast_ok = wifi_reconnect.fast_ok;
+    st->wifi_fast_fail = wifi_reconnect.fast_fail;
+    st->wifi_full = wifi_reconnect.full;
+    st->pf_monitor = pf_monitor_present;
+    st->pf_tripped = pf_tripped;
+    st->pf_ready = emergency_ready;
+    st->pf_trips = pf_trips;
+    st->pf_saves = pf_emergency_saves;
+    st->pf_fail = pf_emergency_fail;
+
+    pf->core0_loop_max_us = core0_stats.loop_max_us;
+    pf->core1_loop_max_us = core1_loop_max_us;
+    pf->save_max_us = core0_stats.save_max_us;
+    pf->upload_max_ms = core0_stats.upload_max_ms;
+    pf->served = status_served;
+    pf->refused = status_refused;
+    const i2c_bus_t *buses[2] = { &lcd_bus, &rtc_bus };
+    for (int i = 0; i < 2; ++i) {
+        pf->i2c[i][0] = buses[i]->transfers;
+        pf->i2c[i][1] = buses[i]->errors;
+        pf->i2c[i][2] = buses[i]->timeouts;
+        pf->i2c[i][3] = buses[i]->recoveries;
+        pf->i2c[i][4] = buses[i]->skipped;
+    }
+    pf->vsys_mv = (pf_vsys_mv + 50) / 100 * 100;
+}
+
+// Monta a resposta em 'dst'; retorna o tamanho ou 0 se não coube
+static uint16_t status_format(char *dst, const status_state_t *st, const status_perf_t *pf, uint32_t now) {
+    static char body[STATUS_BUF_SIZE];
+    int n = snprintf(body, sizeof(body),
+        "{\"device\":\"%s\",\"snapshot_uptime_s\":%lu,\"shift\":\"%s\",\"counter\":%lu,"
+        "\"pending\":%s,\"pending_value\":%lu,\"wifi\":%s,\"usb_mode\":%s,"
+        "\"save\":{\"count\":%lu,\"last_value\":%lu,\"last_uptime_s\":%lu},"
+        "\"upload\":{\"ok\":%lu,\"fail\":%lu,\"last\":\"%s\",\"last_value\":%lu,\"last_uptime_s\":%lu},"
+        "\"sync\":{\"ok\":%lu,\"fixed\":%lu,\"last\":\"%s\",\"last_uptime_s\":%lu,\"flash_shifts\":%lu},"
+        "\"reconnect\":{\"last_ms\":%lu,\"max_ms\":%lu,\"last\":\"%s\",\"lease\":%s,"
+        "\"fast_ok\":%lu,\"fast_fail\":%lu,\"full\":%lu},"
+        "\"perf\":{\"core0_loop_max_us\":%lu,\"core1_loop_max_us\":%lu,\"save_max_us\":%lu,"
+        "\"upload_max_ms\":%lu,\"status_served\":%lu,\"status_refused\":%lu,"
+        "\"status_builds\":%lu,\"status_deferred\":%lu},"
+        "\"i2c\":{\"lcd\":{\"transfers\":%lu,\"errors\":%lu,\"timeouts\":%lu,\"recoveries\":%lu,\"skipped\":%lu},"
+        "\"rtc\":{\"transfers\":%lu,\"errors\":%lu,\"timeouts\":%lu,\"recoveries\":%lu,\"skipped\":%lu}},"
+        "\"power\":{\"monitor\":%s,\"low\":%s,\"emergency_ready\":%s,\"vsys_mv\":%lu,"
+        "\"trips\":%lu,\"emergency_saves\":%lu,\"emergency_fail\":%lu}}\n",
+        device_id, (unsigned long)(now / 1000), status_shift_name(st->shift), (unsigned long)st->counter,
+        st->pending ? "true" : "false", (unsigned long)st->pending_value,
+        st->wifi ? "true" : "false", st->usb_mode ? "true" : "false",
+        (unsigned long)st->saves, (unsigned long)st->last_save_value, (unsigned long)st->last_save_s,
+        (unsigned long)st->uploads_ok, (unsigned long)st->uploads_fail, status_upload_name(st->last_upload),
+        (unsigned long)st->last_upload_value, (unsigned long)st->last_upload_s,
+        (unsigned long)st->syncs, (unsigned long)st->sync_fixed,
+        st->last_sync < 0 ? "nunca" : (st->last_sync ? "ok" : "falha"),
+        (unsigned long)st->last_sync_s, (unsigned long)st->ledger_shifts,
+        (unsigned long)st->wifi_last_ms, (unsigned long)st->wifi_max_ms,
+        st->wifi_mode < 0 ? "nunca" : (st->wifi_mode ? "direcionada" : "completa"),
+        st->wifi_lease ? "true" : "false",
+        (unsigned long)st->wifi_fast_ok, (unsigned long)st->wifi_fast_fail, (unsigned long)st->wifi_full,
+        (unsigned long)pf->core0_loop_max_us, (unsigned long)pf->core1_loop_max_us, (unsigned long)pf->save_max_us,
+        (unsigned long)pf->upload_max_ms, (unsigned long)pf->served, (unsigned long)pf->refused,
+        (unsigned long)(status_builds + 1), (unsigned long)status_deferred,
+        (unsigned long)pf->i2c[0][0], (unsigned long)pf->i2c[0][1], (unsigned long)pf->i2c[0][2],
+        (unsigned long)pf->i2c[0][3], (unsigned long)pf->i2c[0][4],
+        (unsigned long)pf->i2c[1][0], (unsigned long)pf->i2c[1][1], (unsigned long)pf->i2c[1][2],
+        (unsigned long)pf->i2c[1][3], (unsigned long)pf->i2c[1][4],
+        st->pf_monitor ? "true" : "false", st->pf_tripped ? "true" : "false", st->pf_ready ? "true" : "false",
+        (unsigned long)pf->vsys_mv, (unsigned long)st->pf_trips, (unsigned long)st->pf_saves,
+        (unsigned long)st->pf_fail);
+    if (n <= 0 || n >= (int)sizeof(body)) return 0;
+    int h = snprintf(dst, STATUS_BUF_SIZE,
+        "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %d\r\n"
+        "Cache-Control: no-store\r\nAccess-Control-Allow-Origin: *\r\nConnection: close\r\n\r\n", n);
+    if (h <= 0 || h + n > STATUS_BUF_SIZE) return 0;
+    memcpy(dst + h, body, n);
+    return (uint16_t)(h + n);
+}
+
+// Chamada a cada volta do laço do core0: só formata se algo mudou
+static void status_refresh(uint32_t now) {
+    status_state_t st;
+    status_perf_t pf;
+    status_capture(&st, &pf);
+    bool state_changed = memcmp(&st, &status_last_state, sizeof(st)) != 0;
+    bool perf_changed = memcmp(&pf, &status_last_perf, sizeof(pf)) != 0 &&
+                        now - status_last_build_ms >= STATUS_PERF_REFRESH_MS;
+    if (status_active >= 0 && !state_changed && !perf_changed) return;
+
+    // Buffer livre: não é o ativo e nenhuma conexão aguarda ACK dele
+    int8_t target = -1;
+    for (int8_t i = 0; i < 2; ++i) {
+        if (i != status_active && status_refs[i] == 0) {
+            target = i;
+            break;
+        }
+    }
+    if (target < 0) {
+        status_deferred++;
+        return;
+    }
+    uint16_t len = status_format(status_bufs[target], &st, &pf, now);
+    if (len == 0) {
+        printf("[CORE0] Status local: snapshot não coube em %d bytes\n", STATUS_BUF_SIZE);
+        return;
+    }
+    status_len[target] = len;
+    cyw43_arch_lwip_begin();
+    status_active = target;
+    cyw43_arch_lwip_end();
+    status_last_state = st;
+    status_last_perf = pf;
+    status_last_build_ms = now;
+    status_builds++;
+}
+
+static void status_conn_release(status_conn_t *c) {
+    if (c->buf >= 0) status_refs[c->buf]--;
+    c->buf = -1;
+    c->pcb = NULL;
+    c->to_ack = 0;
+    c->answered = false;
+}
+
+static void status_conn_detach(struct tcp_pcb *pcb) {
+    tcp_arg(pcb, NULL);
+    tcp_recv(pcb, NULL);
+    tcp_sent(pcb, NULL);
+    tcp_err(pcb, NULL);
+    tcp_poll(pcb, NULL, 0);
+}
+
+// Descarta a conexão e seus segmentos na hora (libera o buffer com segurança)
+static err_t status_conn_abort(status_conn_t *c) {
+    struct tcp_pcb *pcb = c->pcb;
+    status_conn_detach(pcb);
+    status_conn_release(c);
+    tcp_abort(pcb);
+    return ERR_ABRT;
+}
+
+// Só chamada sem dados pendentes de ACK, então o buffer já pode ser reutilizado
+static err_t status_conn_close(status_conn_t *c) {
+    struct tcp_pcb *pcb = c->pcb;
+    status_conn_detach(pcb);
+    status_conn_release(c);
+    if (tcp_close(pcb) != ERR_OK) {
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+    return ERR_OK;
+}
+
+static err_t status_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
+    status_conn_t *c = (status_conn_t *)arg;
+    if (p == NULL) {
+        // Cliente fechou: se a resposta ainda aguarda ACK, status_sent/status_poll encerram
+        return c->to_ack ? ERR_OK : status_conn_close(c);
+    }
+    tcp_recved(pcb, p->tot_len);
+    if (c->answered) {
+        pbuf_free(p);
+        return ERR_OK;
+    }
+    c->answered = true;
+    // Só a linha de requisição do primeiro segmento é considerada
+    bool is_status = pbuf_memcmp(p, 0, "GET /status", 11) == 0 || pbuf_memcmp(p, 0, "GET / ", 6) == 0;
+    pbuf_free(p);
+
+    int8_t buf = is_status ? status_active : -1;
+    const char *data = status_not_found;
+    uint16_t len = sizeof(status_not_found) - 1;
+    if (buf >= 0) {
+        data = status_bufs[buf];
+        len = status_len[buf];
+    }
+    // Sem TCP_WRITE_FLAG_COPY: o lwIP referencia o buffer até o ACK
+    if (len > tcp_sndbuf(pcb) || tcp_write(pcb, data, len, 0) != ERR_OK) return status_conn_abort(c);
+    if (buf >= 0) {
+        status_refs[buf]++;
+        c->buf = buf;
+        status_served++;
+    }
+    c->to_ack = len;
+    tcp_output(pcb);
+    return ERR_OK;
+}
+
+static err_t status_sent(void *arg, struct tcp_pcb *pcb, u16_t len) {
+    status_conn_t *c = (status_conn_t *)arg;
+    c->to_ack = (len >= c->to_ack) ? 0 : (uint16_t)(c->to_ack - len);
+    return c->to_ack ? ERR_OK : status_conn_close(c);
+}
+
+static err_t status_poll(void *arg, struct tcp_pcb *pcb) {
+    // Conexão parada (sem requisição ou sem ACK) depois do prazo
+    return status_conn_abort((status_conn_t *)arg);
+}
+
+static void status_err(void *arg, err_t err) {
+    // O lwIP já liberou o pcb
+    status_conn_t *c = (status_conn_t *)arg;
+    if (c) status_conn_release(c);
+}
+
+static err_t status_accept(void *arg, struct tcp_pcb *pcb, err_t err) {
+    if (err != ERR_OK || pcb == NULL) return ERR_VAL;
+    status_conn_t *c = NULL;
+    for (int i = 0; i < STATUS_MAX_CONNS; ++i) {
+        if (status_conns[i].pcb == NULL) {
+            c = &status_conns[i];
+            break;
+        }
+    }
+    if (c == NULL) {
+        status_refused++;
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+    c->pcb = pcb;
+    c->buf = -1;
+    c->to_ack = 0;
+    c->answered = false;
+    // Sob falta de pcbs o lwIP descarta primeiro as conexões de menor prioridade
+    tcp_setprio(pcb, TCP_PRIO_MIN);
+    tcp_nagle_disable(pcb);
+    tcp_arg(pcb, c);
+    tcp_recv(pcb, status_recv);
+    tcp_sent(pcb, status_sent);
+    tcp_err(pcb, status_err);
+    tcp_poll(pcb, status_poll, STATUS_IDLE_POLLS);
+    return ERR_OK;
+}
+
+static bool status_server_start() {
+    if (status_listen_pcb) return true;
+    for (int i = 0; i < STATUS_MAX_CONNS; ++i) status_conns[i].buf = -1;
+    cyw43_arch_lwip_begin();
+    struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    bool ok = false;
+    if (pcb && tcp_bind(pcb, IP_ANY_TYPE, STATUS_HTTP_PORT) == ERR_OK) {
+        tcp_setprio(pcb, TCP_PRIO_MIN);
+        status_listen_pcb = tcp_listen_with_backlog(pcb, 1);
+        if (status_listen_pcb) {
+            tcp_accept(status_listen_pcb, status_accept);
+            ok = true;
+        }
+    }
+    if (!ok && pcb && !status_listen_pcb) tcp_close(pcb);
+    cyw43_arch_lwip_end();
+    if (ok) printf("[CORE0] Status local em http://<ip-do-pico>:%d/status\n", STATUS_HTTP_PORT);
+    else printf("[CORE0] Falha ao abrir o status local na porta %d\n", STATUS_HTTP_PORT);
+    return ok;
+}
+
 // ========== MAIN (CORE 0 - Rede, Flash e Display com mutex) ==========
 int main() {
     stdio_init_all();
@@ -714,8 +2315,14 @@ int main() {
 
     mutex_init(&lcd_mutex);
 
-    // lança core1
+    // ID único da placa (lido antes de core1 e do Wi-Fi usarem a flash)
+    pico_get_unique_board_id_string(device_id, sizeof(device_id));
+    pico_get_unique_board_id(&board_uid);
+    printf("[CORE0] Device ID: %s\n", device_id);
+
+    // lança core1; core0 também aceita o lockout (gravação de emergência feita pelo core1)
     multicore_launch_core1(core1_entry);
+    multicore_lockout_victim_init();
 
     // tenta iniciar Wi-Fi stack
     if (try_cyw43_init_once()) {
@@ -731,13 +2338,31 @@ int main() {
     } else {
         printf("[CORE0] NV vazio/inválido no início\n");
     }
+    ledger_load();
+    emergency_rearm();
+    netcfg_load();
 
     uint32_t last_wifi_init_attempt = to_ms_since_boot(get_absolute_time());
     uint32_t last_wifi_connect_attempt = to_ms_since_boot(get_absolute_time());
     uint32_t last_send_attempt = 0;
+    uint32_t last_link_check = 0;
     int send_fail_count = 0;
 
+    // Telemetria USB: Wi-Fi fora desde (ms) e quadro de contador aguardando ACK
+    uint32_t wifi_down_since = 0;
+    bool last_wifi_connected = false;
+    bool usb_inflight = false;
+    uint16_t usb_inflight_seq = 0;
+    uint32_t usb_inflight_value = 0;
+    uint32_t usb_last_send = 0;
+    uint16_t usb_retries = 0;
+    bool boot_event_sent = false;
+    bool status_started = false;
+    // Primeira reconciliação SYNC_RETRY_MS após o boot
+    uint32_t last_sync_attempt = to_ms_since_boot(get_absolute_time());
+
     while (1) {
+        uint32_t loop_start_us = time_us_32();
         uint32_t current_time = to_ms_since_boot(get_absolute_time());
 
         // PROCESSA pedidos de gravação vindos do core1
@@ -751,7 +2376,25 @@ int main() {
             // limpa pedido
             flash_save_request = false;
             // salva na flash (apenas aqui, no core0)
+            uint32_t save_start_us = time_us_32();
             nv_save_counter(to_save, d, m, y, h);
+            uint32_t save_us = time_us_32() - save_start_us;
+            if (save_us > core0_stats.save_max_us) core0_stats.save_max_us = save_us;
+            core0_stats.saves++;
+            core0_stats.last_save_value = to_save;
+            core0_stats.last_save_s = current_time / 1000;
+        }
+
+        // Setor de emergência pela metade: copia e apaga com a energia estável
+        if (emergency_next_page >= NV_PAGES_PER_SECTOR / 2 && !pf_tripped) {
+            emergency_rearm();
+        }
+
+        // Totais de turnos encerrados pedidos pelo core1
+        while (ledger_queue_tail != ledger_queue_head) {
+            uint8_t t = ledger_queue_tail;
+            ledger_put(ledger_queue[t].date, ledger_queue[t].turno, ledger_queue[t].total);
+            ledger_queue_tail = (uint8_t)((t + 1) % LEDGER_QUEUE_LEN);
         }
 
         // =========================
@@ -763,23 +2406,40 @@ int main() {
             if (wifi_init_ok) try_enable_sta_mode_once();
         }
         if (wifi_init_ok && !wifi_mode_enabled) try_enable_sta_mode_once();
+        // O servidor de status escuta em todas as interfaces; basta o lwIP iniciado
+        if (wifi_init_ok && !status_started) status_started = status_server_start();
 
-        // Conexão assíncrona
+        // Conexão assíncrona: primeiro a associação direcionada (BSSID/canal gravados),
+        // sem esperar WIFI_CONNECT_RETRY_MS; varredura completa se ela falhar
         if (wifi_mode_enabled && !wifi_connected) {
             if (!wifi_connecting) {
-                if (current_time - last_wifi_connect_attempt >= WIFI_CONNECT_RETRY_MS) {
+                bool fast = netcfg_valid && !wifi_fast_tried;
+                if (fast || current_time - last_wifi_connect_attempt >= WIFI_CONNECT_RETRY_MS) {
                     last_wifi_connect_attempt = current_time;
-                    printf("[CORE0] Iniciando tentativa de conexão Wi-Fi assíncrona...\n");
-                    int res = cyw43_arch_wifi_connect_async(WIFI_SSID, WIFI_PASSWORD, CYW43_AUTH_WPA2_AES_PSK);
+                    int res = wifi_begin_join(fast, current_time);
                     if (res == 0) wifi_connecting = true;
                     else printf("[CORE0] Falha ao iniciar conexão async (res=%d)\n", res);
                 }
             } else {
                 int link_status = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+                if ((link_status == CYW43_LINK_NOIP || link_status == CYW43_LINK_UP) && !wifi_ip_applied) {
+                    // Associado: IP fixo ou lease gravado sem esperar o DHCP
+                    wifi_ip_applied = true;
+                    wifi_apply_ip();
+                    link_status = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+                }
                 if (link_status == CYW43_LINK_UP) {
-                    printf("[CORE0] Conectado ao Wi-Fi!\n");
                     wifi_connected = true;
                     wifi_connecting = false;
+                    wifi_note_connected(current_time);
+                } else if (wifi_fast_join && (link_status < 0 ||
+                           (link_status != CYW43_LINK_NOIP && current_time - wifi_join_start >= WIFI_FAST_JOIN_TIMEOUT_MS))) {
+                    // AP mudou de canal/BSSID ou não respondeu: varredura completa na hora
+                    printf("[CORE0] Associação direcionada falhou (status=%d): varredura completa\n", link_status);
+                    wifi_reconnect.fast_fail++;
+                    cyw43_wifi_leave(&cyw43_state, CYW43_ITF_STA);
+                    wifi_connecting = false;
+                    last_wifi_connect_attempt = current_time - WIFI_CONNECT_RETRY_MS;
                 } else if (link_status < 0) {
                     if (link_status == CYW43_LINK_FAIL) {
                         printf("[CORE0] Falha ao conectar (status=%d): Verifique a SENHA do Wi-Fi.\n", link_status);
@@ -793,25 +2453,43 @@ int main() {
                     wifi_connecting = false;
                 }
             }
+        } else if (wifi_connected && current_time - last_link_check >= WIFI_LINK_CHECK_MS) {
+            // Queda do enlace detectada na hora (não só após falhas de envio)
+            last_link_check = current_time;
+            if (cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA) != CYW43_LINK_UP) {
+                printf("[CORE0] Wi-Fi caiu: reconectando\n");
+                wifi_link_lost(current_time);
+            } else if (wifi_cache_pending && !pf_tripped && wifi_remember()) {
+                wifi_cache_pending = false;
+            }
         }
 
         // Envio síncrono (usa a função que implementa o comportamento do código antigo)
         if (!http_req_in_progress) {
             if (wifi_connected && has_pending_data && (current_time - last_send_attempt >= WIFI_SEND_RETRY_MS)) {
                 uint32_t to_send = latest_pending;
+                uint32_t to_send_ts = latest_pending_ts;
                 last_send_attempt = current_time;
-                int send_res = start_sending_to_server_by_ip(to_send);
+                int send_res = start_sending_to_server_by_ip(to_send, to_send_ts, send_fail_count);
+                uint32_t upload_ms = to_ms_since_boot(get_absolute_time()) - current_time;
+                if (upload_ms > core0_stats.upload_max_ms) core0_stats.upload_max_ms = upload_ms;
+                core0_stats.last_upload_value = to_send;
+                core0_stats.last_upload_s = current_time / 1000;
                 if (send_res == 0) {
                     // sucesso
                     has_pending_data = false;
                     send_fail_count = 0;
+                    core0_stats.uploads_ok++;
+                    core0_stats.last_upload = 1;
                 } else {
+                    core0_stats.uploads_fail++;
+                    core0_stats.last_upload = 0;
                     // falha no envio
                     printf("[CORE0] Falha ao enviar o contador ao servidor (sync).\n");
                     send_fail_count++;
                     if (send_fail_count >= SEND_FAILS_TO_RECONNECT) {
                         send_fail_count = 0;
-                        wifi_connected = false; // força reconnect
+                        wifi_link_lost(current_time); // força reconnect
                         last_wifi_connect_attempt = current_time;
                         printf("[CORE0] Muitos erros de envio -> forçando reconnect\n");
                     }
@@ -819,6 +2497,80 @@ int main() {
             }
         }
 
+        // Reconciliação dos totais por turno (só com o envio em dia, para não atrasá-lo)
+        uint32_t sync_wait = (core0_stats.last_sync == 1) ? SYNC_INTERVAL_MS : SYNC_RETRY_MS;
+        if (wifi_connected && !has_pending_data && ledger_count > 0 && current_time - last_sync_attempt >= sync_wait) {
+            last_sync_attempt = current_time;
+            uint32_t open_date = shared_shift_date;
+            bool sync_ok = sync_run(open_date, open_date ? (uint8_t)(shared_shift_state + 1) : 0);
+            core0_stats.last_sync = sync_ok ? 1 : 0;
+            core0_stats.last_sync_s = current_time / 1000;
+            if (sync_ok) core0_stats.syncs++;
+        }
+
+        // =========================
+        // Telemetria USB (fallback)
+        // =========================
+        if (wifi_connected != last_wifi_connected) {
+            last_wifi_connected = wifi_connected;
+            if (!wifi_connected) wifi_down_since = current_time;
+            tlm_send_event(wifi_connected ? TLM_EV_WIFI_UP : TLM_EV_WIFI_DOWN, 0, 0);
+        }
+        if (stdio_usb_connected()) {
+            if (!boot_event_sent) {
+                tlm_send_event(TLM_EV_BOOT, event_counter, 0);
+                boot_event_sent = true;
+            }
+            if (shift_reset_event) {
+                shift_reset_event = false;
+                tlm_send_event(TLM_EV_SHIFT_RESET, 0, 0);
+            }
+        }
+
+        bool usb_mode = !wifi_connected && stdio_usb_connected() &&
+                        (current_time - wifi_down_since >= USB_FALLBACK_AFTER_MS);
+        status_usb_mode = usb_mode;
+        if (usb_mode && has_pending_data && current_time - usb_last_send >= USB_SEND_MIN_GAP_MS) {
+            uint32_t to_send = latest_pending;
+            // Contador acumulado: um valor novo substitui o que aguarda ACK
+            bool newer = !usb_inflight || to_send != usb_inflight_value;
+            if (newer || current_time - usb_last_send >= USB_SEND_RETRY_MS) {
+                if (!newer) usb_retries++;
+                uint16_t seq = tlm_send_counter(to_send, latest_pending_ts, usb_retries);
+                if (seq != 0) {
+                    usb_inflight = true;
+                    usb_inflight_seq = seq;
+                    usb_inflight_value = to_send;
+                }
+                usb_last_send = current_time;
+            }
+        }
+        uint16_t ack_seq;
+        uint8_t ack_status;
+        while (tlm_poll_ack(&ack_seq, &ack_status)) {
+            if (!usb_inflight || ack_seq != usb_inflight_seq) continue;
+            usb_inflight = false;
+            core0_stats.last_upload_value = usb_inflight_value;
+            core0_stats.last_upload_s = current_time / 1000;
+            if (ack_status == 0) {
+                usb_retries = 0;
+                core0_stats.uploads_ok++;
+                core0_stats.last_upload = 2;
+                // Só limpa se o core1 não contou mais nada desde o envio
+                if (latest_pending == usb_inflight_value) has_pending_data = false;
+            } else {
+                usb_retries++;
+                core0_stats.uploads_fail++;
+                core0_stats.last_upload = 0;
+            }
+        }
+
+        // Snapshot do status local (só formata quando algo mudou)
+        status_refresh(current_time);
+
+        uint32_t loop_us = time_us_32() - loop_start_us;
+        if (loop_us > core0_stats.loop_max_us) core0_stats.loop_max_us = loop_us;
+
         // Ciclo de poll e pequeno delay
         cyw43_arch_poll();
         sleep_ms(1);
@@ -0,0 +1,133 @@
+# analytics.py
+"""Detecção em streaming de paradas e lentidão por dispositivo.
+
+Cada observação (contador acumulado do turno em um instante) atualiza o estado do
+dispositivo em O(1), sem consultar histórico:
+- ritmo móvel: média exponencial (EWMA) no tempo das peças/minuto, com constante
+  de tempo 'tau_s' (intervalos irregulares entre observações são tratados corretamente);
+- parada: contador sem avançar por mais que max(stop_after_s, 3 peças no ritmo esperado);
+- lentidão: ritmo móvel abaixo de 'slow_ratio' do esperado (meta do turno / duração),
+  com histerese para não alternar a cada observação.
+
+O detector só produz eventos; persistir paradas e difundir alertas fica com quem chama.
+"""
+import math
+
+
+class DeviceState:
+    __slots__ = ('last_count', 'last_obs', 'first_obs', 'last_change', 'rate',
+                 'stopped', 'stop_id', 'slow')
+
+    def __init__(self):
+        self.last_count = None
+        self.last_obs = None
+        self.first_obs = None
+        self.last_change = None
+        self.rate = None
+        self.stopped = False
+        self.stop_id = None
+        self.slow = False
+
+
+class StoppageDetector:
+    def __init__(self, stop_after_s=180, slow_ratio=0.6, tau_s=300):
+        self.stop_after_s = stop_after_s
+        self.slow_ratio = slow_ratio
+        # Volta ao normal só acima deste fator do esperado (histerese)
+        self.recover_ratio = min(slow_ratio + 0.2, 1.0)
+        self.tau_s = tau_s
+        self.shift_key = None
+        self.devices = {}
+
+    def reset(self, shift_key=None):
+        """Descarta o estado (novo turno ou nova liderança)."""
+        self.shift_key = shift_key
+        self.devices = {}
+
+    def resume_stop(self, device_id, stop_id, inicio):
+        """Retoma uma parada já registrada no banco (ex.: outro worker era o líder)."""
+        state = self.devices.setdefault(device_id, DeviceState())
+        state.stopped = True
+        state.stop_id = stop_id
+        state.last_change = inicio
+
+    def set_stop_id(self, device_id, stop_id):
+        state = self.devices.get(device_id)
+        if state is not None:
+            state.stop_id = stop_id
+
+    def open_stops(self):
+        """[(device_id, stop_id)] das paradas em andamento."""
+        return [(device_id, st.stop_id) for device_id, st in self.devices.items() if st.stopped]
+
+    def observe(self, device_id, count, expected_rate, now):
+        """Registra o contador do dispositivo em 'now' e retorna os eventos gerados.
+
+        expected_rate: peças/minuto esperadas (None se o turno não tem meta).
+        Eventos: dicts com 'tipo' em parada/retomada/lentidao/normal.
+        """
+        state = self.devices.get(device_id)
+        if state is None:
+            state = self.devices[device_id] = DeviceState()
+        if state.last_obs is None:
+            # Primeira observação: apenas a linha de base
+            state.last_count = count
+            state.last_obs = state.first_obs = now
+            if state.last_change is None:
+                state.last_change = now
+            return []
+
+        dt = (now - state.last_obs).total_seconds()
+        if dt <= 0:
+            return []
+        delta = max(count - state.last_count, 0)
+        state.last_count = count
+        state.last_obs = now
+
+        instant = delta * 60.0 / dt
+        if state.rate is None:
+            state.rate = instant
+        else:
+            state.rate += (1.0 - math.exp(-dt / self.tau_s)) * (instant - state.rate)
+
+        events = []
+        if delta > 0:
+            if state.stopped:
+                events.append(self._event('retomada', device_id, state, expected_rate,
+                                          inicio=state.last_change, fim=now, stop_id=state.stop_id))
+                state.stopped = False
+                state.stop_id = None
+                # O ritmo recomeça do atual: a parada já foi reportada, não é lentidão
+                state.rate = instant
+                state.slow = False
+            state.last_change = now
+
+        limit = self.stop_after_s
+        if expected_rate:
+            limit = max(limit, 3 * 60.0 / expected_rate)
+        if state.stopped:
+            return events
+
+        if (now - state.last_change).total_seconds() >= limit:
+            state.stopped = True
+            state.slow = False
+            events.append(self._event('parada', device_id, state, expected_rate, inicio=state.last_change))
+        elif expected_rate and (now - state.first_obs).total_seconds() >= self.tau_s:
+            if not state.slow and state.rate < self.slow_ratio * expected_rate:
+                state.slow = True
+                events.append(self._event('lentidao', device_id, state, expected_rate))
+            elif state.slow and state.rate >= self.recover_ratio * expected_rate:
+                state.slow = False
+                events.append(self._event('normal', device_id, state, expected_rate))
+        return events
+
+    @staticmethod
+    def _event(tipo, device_id, state, expected_rate, **extra):
+        event = {
+            'tipo': tipo,
+            'device_id': device_id,
+            'taxa': round(state.rate or 0.0, 2),
+            'esperada': round(expected_rate, 2) if expected_rate else None
+        }
+        event.update(extra)
+        return event
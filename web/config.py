@@ -24,4 +24,48 @@ class Config:
     # HTTPS / SSL
     SSL_ENABLED = os.getenv('SSL_ENABLED', 'false').lower() in ['1', 'true', 'yes', 'on']
     SSL_CERT_FILE = os.getenv('SSL_CERT_FILE', os.path.join(os.path.dirname(__file__), 'cert.pem'))
-    SSL_KEY_FILE = os.getenv('SSL_KEY_FILE', os.path.join(os.path.dirname(__file__), 'key.pem'))
\ No newline at end of file
+    SSL_KEY_FILE = os.getenv('SSL_KEY_FILE', os.path.join(os.path.dirname(__file__), 'key.pem'))
+    # Identificador usado quando o contador não informa o próprio ID (firmware antigo)
+    DEFAULT_DEVICE_ID = os.getenv('DEFAULT_DEVICE_ID', 'default')
+
+    # Pool de conexões com o PostgreSQL (por processo/worker)
+    DB_POOL_MIN = int(os.getenv('DB_POOL_MIN', 1))
+    DB_POOL_MAX = int(os.getenv('DB_POOL_MAX', 20))
+    # Segundos que uma requisição espera por uma conexão livre antes de falhar
+    DB_POOL_TIMEOUT = float(os.getenv('DB_POOL_TIMEOUT', 10))
+
+    # Socket.IO: modo assíncrono ('threading' no modo de desenvolvimento, 'eventlet' no wsgi.py)
+    SOCKETIO_ASYNC_MODE = os.getenv('SOCKETIO_ASYNC_MODE', 'threading')
+    # Fila compartilhada para difundir eventos entre workers (ex.: redis://localhost:6379/0).
+    # Vazia = processo único, sem fila.
+    SOCKETIO_MESSAGE_QUEUE = os.getenv('SOCKETIO_MESSAGE_QUEUE') or None
+    # Com vários workers sem sessão fixa no balanceador, o cliente deve usar apenas WebSocket
+    SOCKETIO_WEBSOCKET_ONLY = os.getenv('SOCKETIO_WEBSOCKET_ONLY', 'false').lower() in ['1', 'true', 'yes', 'on']
+
+    # Número de workers no modo de produção (gunicorn.conf.py)
+    WEB_WORKERS = int(os.getenv('WEB_WORKERS', 4))
+
+    # Fração das requisições /update que geram log no console (1 = todas, 0 = nenhuma,
+    # 0.01 = 1%). Erros são sempre registrados.
+    REQUEST_LOG_SAMPLE = float(os.getenv('REQUEST_LOG_SAMPLE', 1.0))
+
+    # Linhas lidas do cursor do servidor por bloco nas exportações (/export)
+    EXPORT_CHUNK_ROWS = int(os.getenv('EXPORT_CHUNK_ROWS', 5000))
+
+    # Detecção de paradas/lentidão (analytics.py): intervalo de avaliação, silêncio
+    # mínimo para declarar parada, fração do ritmo esperado abaixo da qual a linha
+    # está lenta e constante de tempo do ritmo móvel
+    ANALYTICS_INTERVAL_S = float(os.getenv('ANALYTICS_INTERVAL_S', 5))
+    STOP_AFTER_S = float(os.getenv('STOP_AFTER_S', 180))
+    SLOW_RATIO = float(os.getenv('SLOW_RATIO', 0.6))
+    RATE_TAU_S = float(os.getenv('RATE_TAU_S', 300))
+
+    # Retenção do histórico (retention.py): dias de detalhe mantidos por política
+    # (0 = manter para sempre), intervalo entre execuções, registros por lote de
+    # expurgo e espera máxima por lock ao trocar partições (não bloqueia a ingestão)
+    RETENTION_INTERVAL_S = float(os.getenv('RETENTION_INTERVAL_S', 3600))
+    RETENTION_MINUTE_DAYS = int(os.getenv('RETENTION_MINUTE_DAYS', 90))
+    RETENTION_SHIFT_DAYS = int(os.getenv('RETENTION_SHIFT_DAYS', 0))
+    RETENTION_STOP_DAYS = int(os.getenv('RETENTION_STOP_DAYS', 365))
+    RETENTION_BATCH_ROWS = int(os.getenv('RETENTION_BATCH_ROWS', 1000))
+    RETENTION_LOCK_TIMEOUT_MS = int(os.getenv('RETENTION_LOCK_TIMEOUT_MS', 500))
@@ -1,66 +1,206 @@
 # database.py
 import psycopg2
+import psycopg2.errors
+import psycopg2.extras
+import psycopg2.pool
 from psycopg2 import sql
+from psycopg2.extensions import TRANSACTION_STATUS_IDLE, TRANSACTION_STATUS_INERROR
 import os
-from datetime import datetime
+import math
+import threading
+from datetime import datetime, timedelta
 
 # Importa as configurações da aplicação
 from config import Config
+from metrics import timed_db
+from pagination import split_page
+
+# Chave do advisory lock que serializa a criação/migração do schema entre workers
+SCHEMA_LOCK_KEY = 0x4B414C46  # 'KALF'
+
+class _TrackedConnection(psycopg2.extensions.connection):
+    """Conexão que sinaliza rollbacks ao método instrumentado em execução (métricas de erro)."""
+    tracker = None
+
+    def rollback(self):
+        if self.tracker is not None:
+            self.tracker.failed = True
+        super().rollback()
 
 class DatabaseManager:
+    """Acesso ao PostgreSQL por meio de um pool de conexões.
+
+    `conn` e `cursor` são por thread (por greenlet com eventlet): cada requisição
+    toma uma conexão do pool no primeiro uso e a devolve em `release()`, chamado
+    no teardown do Flask e ao fim de cada iteração das tarefas de fundo.
+    """
     def __init__(self):
         self.config = Config()
-        self.conn = None
-        self.cursor = None
+        self._pool = None
+        # Limita as conexões em uso; quem excede espera em vez de receber PoolError
+        self._pool_slots = None
+        self._local = threading.local()
+        # Conexões em uso e requisições aguardando uma conexão (expostos em /metrics)
+        self._in_use = 0
+        self._waiting = 0
+        self._stats_lock = threading.Lock()
+        # Partições mensais de producao_minuto já garantidas (chave 'YYYYMM')
+        self._partitions = set()
+
+    @property
+    def conn(self):
+        """Conexão da thread/greenlet atual, tomada do pool no primeiro uso."""
+        conn = getattr(self._local, 'conn', None)
+        if conn is None:
+            conn = self._acquire()
+        return conn
+
+    @property
+    def cursor(self):
+        """Cursor da conexão da thread/greenlet atual."""
+        cur = getattr(self._local, 'cursor', None)
+        if cur is None or cur.closed:
+            cur = self.conn.cursor()
+            self._local.cursor = cur
+        return cur
+
+    def _checkout(self):
+        """Toma uma conexão do pool respeitando o limite de conexões em uso."""
+        if self._pool is None:
+            raise psycopg2.OperationalError("pool de conexões não inicializado")
+        with self._stats_lock:
+            self._waiting += 1
+        try:
+            acquired = self._pool_slots.acquire(timeout=self.config.DB_POOL_TIMEOUT)
+        finally:
+            with self._stats_lock:
+                self._waiting -= 1
+        if not acquired:
+            raise psycopg2.OperationalError("tempo esgotado aguardando conexão do pool")
+        try:
+            conn = self._pool.getconn()
+        except Exception:
+            self._pool_slots.release()
+            raise
+        with self._stats_lock:
+            self._in_use += 1
+        return conn
+
+    def _checkin(self, conn, discard=False):
+        """Devolve ao pool uma conexão obtida por _checkout()."""
+        try:
+            self._pool.putconn(conn, close=discard or bool(conn.closed))
+        finally:
+            with self._stats_lock:
+                self._in_use -= 1
+            self._pool_slots.release()
+
+    def _acquire(self):
+        conn = self._checkout()
+        conn.tracker = self._local
+        self._local.conn = conn
+        self._local.cursor = None
+        return conn
+
+    def release(self, discard=False):
+        """Devolve ao pool a conexão da thread/greenlet atual (se houver)."""
+        conn = getattr(self._local, 'conn', None)
+        if conn is None:
+            return
+        cur = getattr(self._local, 'cursor', None)
+        self._local.conn = None
+        self._local.cursor = None
+        # O rollback de limpeza abaixo não é um erro do método
+        conn.tracker = None
+        try:
+            if cur is not None and not cur.closed:
+                cur.close()
+            # Nunca devolve conexão com transação aberta
+            if not conn.closed and conn.get_transaction_status() != TRANSACTION_STATUS_IDLE:
+                conn.rollback()
+        except Exception:
+            discard = True
+        self._checkin(conn, discard)
+
+    def in_failed_transaction(self):
+        """True se a conexão da thread atual está com a transação em erro."""
+        conn = getattr(self._local, 'conn', None)
+        return conn is not None and not conn.closed and conn.get_transaction_status() == TRANSACTION_STATUS_INERROR
+
+    def pool_stats(self):
+        """Retorna (conexões em uso, requisições aguardando conexão)."""
+        with self._stats_lock:
+            return self._in_use, self._waiting
 
     def connect(self):
-        """Tenta estabelecer uma conexão com o banco de dados PostgreSQL."""
+        """Cria o pool de conexões com o banco de dados PostgreSQL."""
         if not self.config.DATABASE_URL:
             print("Erro: DATABASE_URL não definida nas variáveis de ambiente.")
             return False
+        if self._pool is not None:
+            return True
         try:
-            self.conn = psycopg2.connect(self.config.DATABASE_URL)
-            self.cursor = self.conn.cursor()
-            print("[OK] Conectado ao banco de dados PostgreSQL.")
+            self._pool = psycopg2.pool.ThreadedConnectionPool(
+                self.config.DB_POOL_MIN, self.config.DB_POOL_MAX, self.config.DATABASE_URL,
+                connection_factory=_TrackedConnection
+            )
+            self._pool_slots = threading.BoundedSemaphore(self.config.DB_POOL_MAX)
+            print(f"[OK] Conectado ao banco de dados PostgreSQL (pool {self.config.DB_POOL_MIN}-{self.config.DB_POOL_MAX}).")
             return True
         except psycopg2.OperationalError as e:
             print(f"[ERRO] Erro ao conectar ao banco de dados: {e}")
             return False
 
     def disconnect(self):
-        """Fecha a conexão com o banco de dados."""
-        if self.cursor:
-            self.cursor.close()
-        if self.conn:
-            self.conn.close()
+        """Fecha todas as conexões do pool."""
+        if self._pool is not None:
+            self.release()
+            self._pool.closeall()
+            self._pool = None
             print("[INFO] Conexão com o banco de dados fechada.")
 
     def reset_connection(self):
         """Reseta a conexão com o banco de dados em caso de erro de transação."""
         try:
-            if self.conn:
-                self.conn.rollback()
-                print("[INFO] Transação resetada com rollback.")
+            self.conn.rollback()
+            print("[INFO] Transação resetada com rollback.")
         except Exception as e:
             print(f"[INFO] Erro ao resetar transação: {e}")
-            # Se não conseguir resetar, reconecta
-            self.disconnect()
-            self.connect()
+            # Se não conseguir resetar, descarta a conexão; a próxima vem nova do pool
+            self.release(discard=True)
 
     def create_tables(self):
-        """Cria as tabelas necessárias no banco de dados se elas não existirem."""
+        """Cria as tabelas necessárias no banco de dados se elas não existirem.
+
+        Vários workers podem iniciar juntos: o advisory lock garante que apenas um
+        execute a migração por vez (os demais encontram o schema pronto).
+        """
+        try:
+            self.cursor.execute("SELECT pg_advisory_lock(%s)", (SCHEMA_LOCK_KEY,))
+            return self._create_tables()
+        finally:
+            try:
+                self.conn.rollback()
+                self.cursor.execute("SELECT pg_advisory_unlock(%s)", (SCHEMA_LOCK_KEY,))
+                self.conn.commit()
+            except Exception as e:
+                print(f"[INFO] Erro ao liberar lock de schema: {e}")
+            self.release()
+
+    def _create_tables(self):
         try:
             # Tabela para armazenar as contagens dos turnos
             self.cursor.execute("""
                 CREATE TABLE IF NOT EXISTS shifts (
                     id SERIAL PRIMARY KEY,
+                    device_id VARCHAR(64) NOT NULL DEFAULT 'default',
                     turno_nome VARCHAR(255) NOT NULL,
                     data_turno DATE NOT NULL,
                     contador INTEGER DEFAULT 0,
                     perdas INTEGER DEFAULT 0,
                     inicio_turno TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
                     fim_turno TIMESTAMP NULL,
-                    UNIQUE(turno_nome, data_turno)
+                    CONSTRAINT shifts_device_turno_data_key UNIQUE (device_id, turno_nome, data_turno)
                 );
             """)
             self.conn.commit()
@@ -74,6 +214,35 @@ class DatabaseManager:
             except Exception as e:
                 print(f"[INFO] Coluna 'perdas' já existe ou erro ao adicionar: {e}")
 
+            # Múltiplos dispositivos: um registro por (dispositivo, turno, data).
+            # Tabelas antigas recebem a coluna com o dispositivo padrão e a nova chave única.
+            self.cursor.execute("""
+                ALTER TABLE shifts ADD COLUMN IF NOT EXISTS device_id VARCHAR(64) NOT NULL DEFAULT 'default';
+                ALTER TABLE shifts DROP CONSTRAINT IF EXISTS shifts_turno_nome_data_turno_key;
+                DO $$
+                BEGIN
+                    IF NOT EXISTS (SELECT 1 FROM pg_constraint WHERE conname = 'shifts_device_turno_data_key') THEN
+                        ALTER TABLE shifts ADD CONSTRAINT shifts_device_turno_data_key
+                            UNIQUE (device_id, turno_nome, data_turno);
+                    END IF;
+                END $$;
+
+                -- Cadastro dos dispositivos (um Pico W por linha de produção)
+                CREATE TABLE IF NOT EXISTS devices (
+                    device_id VARCHAR(64) PRIMARY KEY,
+                    nome VARCHAR(255) NULL,
+                    linha VARCHAR(255) NULL,
+                    first_seen TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+                    last_seen TIMESTAMP DEFAULT CURRENT_TIMESTAMP
+                );
+
+                -- Contagem fora do horário de turnos (sem linha em shifts), por período
+                ALTER TABLE devices ADD COLUMN IF NOT EXISTS contador_fora_turno INTEGER NOT NULL DEFAULT 0;
+                ALTER TABLE devices ADD COLUMN IF NOT EXISTS fora_turno_chave VARCHAR(32) NULL;
+            """)
+            self.conn.commit()
+            print("[OK] Dimensão 'device_id' e tabela 'devices' verificadas/criadas.")
+
             # Tabela de metas por turno e por dia
             # NOVA TABELA: Armazena a meta padrão para cada TIPO de turno
             self.cursor.execute("""
@@ -115,105 +284,870 @@ class DatabaseManager:
             self.conn.commit()
             print("[OK] Tabela 'perdas' verificada/criada com sucesso.")
 
+            # Paradas de linha detectadas pela análise em streaming (fim NULL = em andamento)
+            self.cursor.execute("""
+                CREATE TABLE IF NOT EXISTS paradas (
+                    id SERIAL PRIMARY KEY,
+                    device_id VARCHAR(64) NOT NULL,
+                    turno_nome VARCHAR(255) NOT NULL,
+                    data_turno DATE NOT NULL,
+                    inicio TIMESTAMP NOT NULL,
+                    fim TIMESTAMP NULL
+                );
+            """)
+            self.conn.commit()
+            print("[OK] Tabela 'paradas' verificada/criada com sucesso.")
+
             # Índices para performance em relatórios
             self.cursor.execute("""
-                CREATE INDEX IF NOT EXISTS idx_shifts_data ON shifts(data_turno);
                 CREATE INDEX IF NOT EXISTS idx_perdas_shift ON perdas(shift_id);
-                CREATE INDEX IF NOT EXISTS idx_perdas_data ON perdas(data_evento);
+                -- Paginação por chave: (data, id) na ordem das páginas; substituem os índices só por data
+                CREATE INDEX IF NOT EXISTS idx_shifts_data_id ON shifts(data_turno, id);
+                CREATE INDEX IF NOT EXISTS idx_perdas_data_id ON perdas(data_evento, id);
+                DROP INDEX IF EXISTS idx_shifts_data;
+                DROP INDEX IF EXISTS idx_perdas_data;
+                -- Histórico de um dispositivo (a UNIQUE tem turno_nome no meio e não serve a faixas de data)
+                CREATE INDEX IF NOT EXISTS idx_shifts_device_data_id ON shifts(device_id, data_turno, id);
+                DROP INDEX IF EXISTS idx_shifts_device_data;
+                -- Turnos abertos: poucas linhas entre anos de histórico
+                CREATE INDEX IF NOT EXISTS idx_shifts_abertos ON shifts(data_turno) WHERE fim_turno IS NULL;
+                CREATE INDEX IF NOT EXISTS idx_paradas_inicio ON paradas(inicio);
+                CREATE INDEX IF NOT EXISTS idx_paradas_abertas ON paradas(device_id) WHERE fim IS NULL;
             """)
             self.conn.commit()
-            return True
+
+            return (self.create_rollups() and self.create_loss_totals() and self.create_production_series()
+                    and self.create_change_notify())
         except Exception as e:
             print(f"[ERRO] Erro ao criar tabelas: {e}")
             self.conn.rollback() # Reverte qualquer transação em caso de erro
             return False
 
-    def get_current_shift_count(self, turno_nome, data_turno):
-        """Obtém a contagem atual para um turno específico ou 0 se não existir."""
+    def create_rollups(self):
+        """Cria as tabelas de agregados (rollups) e os triggers que as mantêm.
+
+        Cada escrita em shifts/metas/perdas aplica apenas o delta da linha alterada
+        nos buckets day/week/month/year, de modo que os endpoints /metrics/* leem
+        poucas linhas pré-agregadas independentemente do tamanho do histórico.
+        """
+        try:
+            # Rollups anteriores ao suporte a múltiplos dispositivos são descartados
+            # e reconstruídos (são dados derivados)
+            self.cursor.execute("""
+                SELECT 1 FROM information_schema.tables t
+                WHERE t.table_name = 'rollup_producao'
+                  AND NOT EXISTS (SELECT 1 FROM information_schema.columns c
+                                  WHERE c.table_name = 'rollup_producao' AND c.column_name = 'device_id')
+            """)
+            if self.cursor.fetchone():
+                self.cursor.execute("""
+                    DROP TABLE rollup_producao;
+                    DROP TABLE IF EXISTS rollup_perdas_motivo;
+                    DROP FUNCTION IF EXISTS rollup_aplicar_delta(DATE, VARCHAR, BIGINT, BIGINT, BIGINT, INTEGER);
+                """)
+                print("[INFO] Rollups sem 'device_id' removidos; serão reconstruídos.")
+
+            self.cursor.execute("""
+                CREATE TABLE IF NOT EXISTS rollup_producao (
+                    granularidade VARCHAR(8) NOT NULL,   -- day|week|month|year
+                    period_start DATE NOT NULL,
+                    device_id VARCHAR(64) NOT NULL,
+                    turno_nome VARCHAR(255) NOT NULL,
+                    producao BIGINT NOT NULL DEFAULT 0,
+                    perdas BIGINT NOT NULL DEFAULT 0,
+                    meta_turno BIGINT NOT NULL DEFAULT 0,
+                    meta_dia INTEGER NULL,
+                    PRIMARY KEY (granularidade, period_start, device_id, turno_nome)
+                );
+
+                CREATE TABLE IF NOT EXISTS rollup_perdas_motivo (
+                    granularidade VARCHAR(8) NOT NULL,
+                    period_start DATE NOT NULL,
+                    device_id VARCHAR(64) NOT NULL,
+                    motivo VARCHAR(255) NOT NULL,
+                    total BIGINT NOT NULL DEFAULT 0,
+                    PRIMARY KEY (granularidade, period_start, device_id, motivo)
+                );
+
+                -- Aplica um delta em todos os buckets que contêm p_data
+                CREATE OR REPLACE FUNCTION rollup_aplicar_delta(
+                    p_data DATE, p_device VARCHAR, p_turno VARCHAR, d_prod BIGINT, d_perdas BIGINT,
+                    d_meta BIGINT, p_meta_dia INTEGER
+                ) RETURNS void AS $$
+                DECLARE g TEXT;
+                BEGIN
+                    IF d_prod = 0 AND d_perdas = 0 AND d_meta = 0 AND p_meta_dia IS NULL THEN
+                        RETURN;
+                    END IF;
+                    FOREACH g IN ARRAY ARRAY['day', 'week', 'month', 'year'] LOOP
+                        INSERT INTO rollup_producao AS r
+                            (granularidade, period_start, device_id, turno_nome, producao, perdas, meta_turno, meta_dia)
+                        VALUES (g, date_trunc(g, p_data)::date, p_device, p_turno, d_prod, d_perdas, d_meta, p_meta_dia)
+                        ON CONFLICT (granularidade, period_start, device_id, turno_nome) DO UPDATE
+                        SET producao = r.producao + EXCLUDED.producao,
+                            perdas = r.perdas + EXCLUDED.perdas,
+                            meta_turno = r.meta_turno + EXCLUDED.meta_turno,
+                            -- meta_dia não é aditiva: mantém a maior meta diária informada
+                            meta_dia = GREATEST(r.meta_dia, EXCLUDED.meta_dia);
+                    END LOOP;
+                END;
+                $$ LANGUAGE plpgsql;
+
+                -- Soma (p_sinal = 1) ou desconta (-1) as perdas de um turno nos buckets por motivo
+                CREATE OR REPLACE FUNCTION rollup_perdas_turno(p_shift_id INTEGER, p_device VARCHAR, p_sinal INTEGER)
+                RETURNS void AS $$
+                BEGIN
+                    INSERT INTO rollup_perdas_motivo AS r (granularidade, period_start, device_id, motivo, total)
+                    SELECT g.g, date_trunc(g.g, p.data_evento)::date, p_device, p.motivo, p_sinal * SUM(p.quantidade)
+                    FROM perdas p
+                    CROSS JOIN unnest(ARRAY['day', 'week', 'month', 'year']) AS g(g)
+                    WHERE p.shift_id = p_shift_id AND p.data_evento IS NOT NULL
+                    GROUP BY 1, 2, 4
+                    ON CONFLICT (granularidade, period_start, device_id, motivo) DO UPDATE
+                    SET total = r.total + EXCLUDED.total;
+                END;
+                $$ LANGUAGE plpgsql;
+
+                CREATE OR REPLACE FUNCTION rollup_shifts_trg() RETURNS trigger AS $$
+                DECLARE v_meta BIGINT;
+                BEGIN
+                    IF TG_OP = 'INSERT' THEN
+                        PERFORM rollup_aplicar_delta(NEW.data_turno, NEW.device_id, NEW.turno_nome,
+                            COALESCE(NEW.contador, 0), COALESCE(NEW.perdas, 0), 0, NULL);
+                        RETURN NULL;
+                    ELSIF TG_OP = 'UPDATE' THEN
+                        IF NEW.data_turno = OLD.data_turno AND NEW.turno_nome = OLD.turno_nome
+                           AND NEW.device_id = OLD.device_id THEN
+                            PERFORM rollup_aplicar_delta(NEW.data_turno, NEW.device_id, NEW.turno_nome,
+                                COALESCE(NEW.contador, 0) - COALESCE(OLD.contador, 0),
+                                COALESCE(NEW.perdas, 0) - COALESCE(OLD.perdas, 0), 0, NULL);
+                        ELSE
+                            SELECT COALESCE(SUM(meta_turno), 0) INTO v_meta FROM metas WHERE shift_id = OLD.id;
+                            PERFORM rollup_aplicar_delta(OLD.data_turno, OLD.device_id, OLD.turno_nome,
+                                -COALESCE(OLD.contador, 0), -COALESCE(OLD.perdas, 0), -v_meta, NULL);
+                            PERFORM rollup_aplicar_delta(NEW.data_turno, NEW.device_id, NEW.turno_nome,
+                                COALESCE(NEW.contador, 0), COALESCE(NEW.perdas, 0), v_meta, NULL);
+                            IF NEW.device_id IS DISTINCT FROM OLD.device_id THEN
+                                PERFORM rollup_perdas_turno(OLD.id, COALESCE(OLD.device_id, 'default'), -1);
+                                PERFORM rollup_perdas_turno(NEW.id, COALESCE(NEW.device_id, 'default'), 1);
+                            END IF;
+                        END IF;
+                        RETURN NULL;
+                    END IF;
+                    -- Retenção: o turno sai do histórico, mas continua nos rollups
+                    IF current_setting('kalfix.retencao', true) = 'on' THEN
+                        RETURN OLD;
+                    END IF;
+                    -- DELETE roda como BEFORE: as metas e perdas ainda existem (o CASCADE vem depois)
+                    SELECT COALESCE(SUM(meta_turno), 0) INTO v_meta FROM metas WHERE shift_id = OLD.id;
+                    PERFORM rollup_aplicar_delta(OLD.data_turno, OLD.device_id, OLD.turno_nome,
+                        -COALESCE(OLD.contador, 0), -COALESCE(OLD.perdas, 0), -v_meta, NULL);
+                    PERFORM rollup_perdas_turno(OLD.id, COALESCE(OLD.device_id, 'default'), -1);
+                    RETURN OLD;
+                END;
+                $$ LANGUAGE plpgsql;
+
+                CREATE OR REPLACE FUNCTION rollup_metas_trg() RETURNS trigger AS $$
+                DECLARE s RECORD;
+                BEGIN
+                    IF TG_OP = 'DELETE' AND current_setting('kalfix.retencao', true) = 'on' THEN
+                        RETURN NULL;
+                    END IF;
+                    IF TG_OP IN ('UPDATE', 'DELETE') THEN
+                        -- Se o turno já foi apagado, o trigger de shifts já descontou a meta
+                        SELECT data_turno, device_id, turno_nome INTO s FROM shifts WHERE id = OLD.shift_id;
+                        IF FOUND THEN
+                            PERFORM rollup_aplicar_delta(s.data_turno, s.device_id, s.turno_nome, 0, 0, -OLD.meta_turno, NULL);
+                        END IF;
+                    END IF;
+                    IF TG_OP IN ('INSERT', 'UPDATE') THEN
+                        SELECT data_turno, device_id, turno_nome INTO s FROM shifts WHERE id = NEW.shift_id;
+                        IF FOUND THEN
+                            PERFORM rollup_aplicar_delta(s.data_turno, s.device_id, s.turno_nome, 0, 0, NEW.meta_turno, NEW.meta_dia);
+                        END IF;
+                    END IF;
+                    RETURN NULL;
+                END;
+                $$ LANGUAGE plpgsql;
+
+                CREATE OR REPLACE FUNCTION rollup_perdas_trg() RETURNS trigger AS $$
+                DECLARE
+                    g TEXT;
+                    v_old_device VARCHAR;
+                    v_new_device VARCHAR;
+                BEGIN
+                    IF TG_OP = 'DELETE' AND current_setting('kalfix.retencao', true) = 'on' THEN
+                        RETURN NULL;
+                    END IF;
+                    IF TG_OP IN ('UPDATE', 'DELETE') THEN
+                        SELECT device_id INTO v_old_device FROM shifts WHERE id = OLD.shift_id;
+                        -- Perda apagada pelo CASCADE do turno: o trigger de shifts já descontou
+                        IF NOT FOUND AND TG_OP = 'DELETE' THEN
+                            RETURN NULL;
+                        END IF;
+                    END IF;
+                    IF TG_OP IN ('INSERT', 'UPDATE') THEN
+                        SELECT device_id INTO v_new_device FROM shifts WHERE id = NEW.shift_id;
+                    END IF;
+                    FOREACH g IN ARRAY ARRAY['day', 'week', 'month', 'year'] LOOP
+                        IF TG_OP IN ('UPDATE', 'DELETE') AND OLD.data_evento IS NOT NULL THEN
+                            UPDATE rollup_perdas_motivo SET total = total - OLD.quantidade
+                            WHERE granularidade = g
+                              AND period_start = date_trunc(g, OLD.data_evento)::date
+                              AND device_id = COALESCE(v_old_device, 'default')
+                              AND motivo = OLD.motivo;
+                        END IF;
+                        IF TG_OP IN ('INSERT', 'UPDATE') AND NEW.data_evento IS NOT NULL THEN
+                            INSERT INTO rollup_perdas_motivo AS r (granularidade, period_start, device_id, motivo, total)
+                            VALUES (g, date_trunc(g, NEW.data_evento)::date, COALESCE(v_new_device, 'default'),
+                                    NEW.motivo, NEW.quantidade)
+                            ON CONFLICT (granularidade, period_start, device_id, motivo) DO UPDATE
+                            SET total = r.total + EXCLUDED.total;
+                        END IF;
+                    END LOOP;
+                    RETURN NULL;
+                END;
+                $$ LANGUAGE plpgsql;
+
+                DROP TRIGGER IF EXISTS trg_rollup_shifts ON shifts;
+                CREATE TRIGGER trg_rollup_shifts
+                    AFTER INSERT OR UPDATE OF contador, perdas, data_turno, turno_nome, device_id ON shifts
+                    FOR EACH ROW EXECUTE FUNCTION rollup_shifts_trg();
+                DROP TRIGGER IF EXISTS trg_rollup_shifts_del ON shifts;
+                CREATE TRIGGER trg_rollup_shifts_del
+                    BEFORE DELETE ON shifts
+                    FOR EACH ROW EXECUTE FUNCTION rollup_shifts_trg();
+                DROP TRIGGER IF EXISTS trg_rollup_metas ON metas;
+                CREATE TRIGGER trg_rollup_metas
+                    AFTER INSERT OR UPDATE OR DELETE ON metas
+                    FOR EACH ROW EXECUTE FUNCTION rollup_metas_trg();
+                DROP TRIGGER IF EXISTS trg_rollup_perdas ON perdas;
+                CREATE TRIGGER trg_rollup_perdas
+                    AFTER INSERT OR UPDATE OR DELETE ON perdas
+                    FOR EACH ROW EXECUTE FUNCTION rollup_perdas_trg();
+            """)
+            self.conn.commit()
+            print("[OK] Tabelas de agregados (rollups) e triggers verificados/criados.")
+
+            # Primeira execução (ou tabelas recriadas): popula a partir do histórico
+            self.cursor.execute("SELECT EXISTS (SELECT 1 FROM rollup_producao)")
+            if not self.cursor.fetchone()[0]:
+                return self.rebuild_rollups()
+            return True
+        except Exception as e:
+            print(f"[ERRO] Erro ao criar rollups: {e}")
+            self.conn.rollback()
+            return False
+
+    def create_loss_totals(self):
+        """Mantém shifts.perdas = SUM(perdas.quantidade) com triggers por comando.
+
+        Os triggers usam tabelas de transição: um INSERT de N perdas gera um único
+        UPDATE em lote dos turnos afetados (que por sua vez atualiza os rollups).
+        Na primeira execução, turnos com perdas lançadas só em shifts.perdas
+        (versões anteriores) recebem um registro de perda com a diferença.
+        """
+        try:
+            self.cursor.execute("SELECT 1 FROM pg_trigger WHERE tgname = 'trg_perdas_total_ins'")
+            if self.cursor.fetchone() is None:
+                self.cursor.execute("""
+                    WITH totais AS (
+                        SELECT shift_id, SUM(quantidade) AS total FROM perdas GROUP BY shift_id
+                    )
+                    INSERT INTO perdas (shift_id, quantidade, motivo, data_evento)
+                    SELECT s.id, s.perdas - COALESCE(t.total, 0), 'Perda registrada manualmente',
+                           COALESCE(s.fim_turno, s.inicio_turno, s.data_turno::timestamp)
+                    FROM shifts s
+                    LEFT JOIN totais t ON t.shift_id = s.id
+                    WHERE COALESCE(s.perdas, 0) > COALESCE(t.total, 0)
+                """)
+                migrated = self.cursor.rowcount
+                self.cursor.execute("""
+                    UPDATE shifts s SET perdas = t.total
+                    FROM (SELECT shift_id, SUM(quantidade) AS total FROM perdas GROUP BY shift_id) t
+                    WHERE t.shift_id = s.id AND COALESCE(s.perdas, 0) <> t.total
+                """)
+                print(f"[INFO] Totais de perdas conciliados: {migrated} registro(s) de perda criados, "
+                      f"{self.cursor.rowcount} turno(s) ajustados.")
+
+            self.cursor.execute("""
+                CREATE OR REPLACE FUNCTION perdas_totais_trg() RETURNS trigger AS $$
+                BEGIN
+                    -- Retenção: as perdas saem junto com o próprio turno
+                    IF TG_OP = 'DELETE' AND current_setting('kalfix.retencao', true) = 'on' THEN
+                        RETURN NULL;
+                    END IF;
+                    IF TG_OP IN ('UPDATE', 'DELETE') THEN
+                        UPDATE shifts s SET perdas = COALESCE(s.perdas, 0) - d.total
+                        FROM (SELECT shift_id, SUM(quantidade) AS total FROM antigas GROUP BY shift_id) d
+                        WHERE s.id = d.shift_id;
+                    END IF;
+                    IF TG_OP IN ('INSERT', 'UPDATE') THEN
+                        UPDATE shifts s SET perdas = COALESCE(s.perdas, 0) + d.total
+                        FROM (SELECT shift_id, SUM(quantidade) AS total FROM novas GROUP BY shift_id) d
+                        WHERE s.id = d.shift_id;
+                    END IF;
+                    RETURN NULL;
+                END;
+                $$ LANGUAGE plpgsql;
+
+                -- Tabelas de transição exigem um trigger por evento
+                DROP TRIGGER IF EXISTS trg_perdas_total_ins ON perdas;
+                CREATE TRIGGER trg_perdas_total_ins
+                    AFTER INSERT ON perdas REFERENCING NEW TABLE AS novas
+                    FOR EACH STATEMENT EXECUTE FUNCTION perdas_totais_trg();
+                DROP TRIGGER IF EXISTS trg_perdas_total_upd ON perdas;
+                CREATE TRIGGER trg_perdas_total_upd
+                    AFTER UPDATE ON perdas REFERENCING OLD TABLE AS antigas NEW TABLE AS novas
+                    FOR EACH STATEMENT EXECUTE FUNCTION perdas_totais_trg();
+                DROP TRIGGER IF EXISTS trg_perdas_total_del ON perdas;
+                CREATE TRIGGER trg_perdas_total_del
+                    AFTER DELETE ON perdas REFERENCING OLD TABLE AS antigas
+                    FOR EACH STATEMENT EXECUTE FUNCTION perdas_totais_trg();
+            """)
+            self.conn.commit()
+            print("[OK] Triggers de total de perdas verificados/criados.")
+            return True
+        except Exception as e:
+            print(f"[ERRO] Erro ao criar triggers de total de perdas: {e}")
+            self.conn.rollback()
+            return False
+
+    def create_change_notify(self):
+        """Publica NOTIFY kalfix_dados '<tabela>:<txid>' a cada comando que altera as tabelas lidas pelo dashboard.
+
+        Os workers escutam o canal para versionar as respostas (ETag) sem consultar o banco.
+        """
+        try:
+            self.cursor.execute("""
+                CREATE OR REPLACE FUNCTION notificar_alteracao() RETURNS trigger AS $$
+                BEGIN
+                    PERFORM pg_notify('kalfix_dados', TG_TABLE_NAME || ':' || txid_current());
+                    RETURN NULL;
+                END;
+                $$ LANGUAGE plpgsql;
+            """)
+            for table in ('shifts', 'metas', 'metas_p_turno', 'perdas', 'paradas', 'devices', 'producao_minuto',
+                          'producao_hora'):
+                self.cursor.execute(
+                    sql.SQL("""
+                        DROP TRIGGER IF EXISTS trg_notificar_alteracao ON {table};
+                        CREATE TRIGGER trg_notificar_alteracao
+                            AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON {table}
+                            FOR EACH STATEMENT EXECUTE FUNCTION notificar_alteracao();
+                    """).format(table=sql.Identifier(table))
+                )
+            self.conn.commit()
+            print("[OK] Notificações de alteração de dados verificadas/criadas.")
+            return True
+        except Exception as e:
+            print(f"[ERRO] Erro ao criar notificações de alteração: {e}")
+            self.conn.rollback()
+            return False
+
+    def rebuild_rollups(self):
+        """Recalcula todos os rollups a partir das tabelas brutas (backfill/reparo)."""
+        try:
+            # Bloqueia escritas concorrentes para que nenhum delta se perca durante a reconstrução
+            self.cursor.execute("LOCK TABLE shifts, metas, perdas IN SHARE MODE")
+            self.cursor.execute("DELETE FROM rollup_producao")
+            self.cursor.execute("""
+                INSERT INTO rollup_producao
+                    (granularidade, period_start, device_id, turno_nome, producao, perdas, meta_turno, meta_dia)
+                SELECT g, date_trunc(g, s.data_turno)::date, s.device_id, s.turno_nome,
+                       SUM(COALESCE(s.contador, 0)), SUM(COALESCE(s.perdas, 0)),
+                       SUM(COALESCE(m.meta_turno, 0)), MAX(m.meta_dia)
+                FROM shifts s
+                LEFT JOIN metas m ON m.shift_id = s.id
+                CROSS JOIN unnest(ARRAY['day', 'week', 'month', 'year']) AS g
+                GROUP BY 1, 2, 3, 4
+            """)
+            self.cursor.execute("DELETE FROM rollup_perdas_motivo")
+            self.cursor.execute("""
+                INSERT INTO rollup_perdas_motivo (granularidade, period_start, device_id, motivo, total)
+                SELECT g, date_trunc(g, p.data_evento)::date, s.device_id, p.motivo, SUM(p.quantidade)
+                FROM perdas p
+                JOIN shifts s ON s.id = p.shift_id
+                CROSS JOIN unnest(ARRAY['day', 'week', 'month', 'year']) AS g
+                WHERE p.data_evento IS NOT NULL
+                GROUP BY 1, 2, 3, 4
+            """)
+            self.conn.commit()
+            print("[OK] Rollups reconstruídos a partir do histórico.")
+            return True
+        except Exception as e:
+            print(f"[ERRO] Erro ao reconstruir rollups: {e}")
+            self.conn.rollback()
+            return False
+
+    def create_production_series(self):
+        """Cria a série de produção por minuto, particionada por mês."""
+        try:
+            self.cursor.execute("""
+                CREATE TABLE IF NOT EXISTS producao_minuto (
+                    device_id VARCHAR(64) NOT NULL DEFAULT 'default',
+                    canal SMALLINT NOT NULL DEFAULT 0,
+                    minuto TIMESTAMP NOT NULL,
+                    contagem INTEGER NOT NULL DEFAULT 0,
+                    PRIMARY KEY (device_id, canal, minuto)
+                ) PARTITION BY RANGE (minuto);
+
+                -- BRIN: índice minúsculo e ideal para dados inseridos em ordem de tempo
+                CREATE INDEX IF NOT EXISTS idx_producao_minuto_brin
+                    ON producao_minuto USING BRIN (minuto);
+
+                -- Resumo por hora dos meses que saíram da retenção da série por minuto
+                CREATE TABLE IF NOT EXISTS producao_hora (
+                    device_id VARCHAR(64) NOT NULL,
+                    canal SMALLINT NOT NULL,
+                    hora TIMESTAMP NOT NULL,
+                    contagem BIGINT NOT NULL DEFAULT 0,
+                    PRIMARY KEY (device_id, canal, hora)
+                );
+                CREATE INDEX IF NOT EXISTS idx_producao_hora_brin
+                    ON producao_hora USING BRIN (hora);
+            """)
+            self.conn.commit()
+            print("[OK] Tabelas 'producao_minuto' e 'producao_hora' verificadas/criadas com sucesso.")
+
+            # Garante partições do mês corrente e do próximo
+            now = datetime.now()
+            self.ensure_production_partition(now)
+            self.ensure_production_partition(self._month_start(now) + timedelta(days=32))
+            return True
+        except Exception as e:
+            print(f"[ERRO] Erro ao criar série de produção: {e}")
+            self.conn.rollback()
+            return False
+
+    @staticmethod
+    def _month_start(when):
+        return datetime(when.year, when.month, 1)
+
+    def ensure_production_partition(self, when):
+        """Cria (se necessário) a partição mensal de producao_minuto que contém 'when'."""
+        start = self._month_start(when)
+        key = start.strftime('%Y%m')
+        if key in self._partitions:
+            return True
+        end = self._month_start(start + timedelta(days=32))
         try:
             self.cursor.execute(
-                "SELECT contador FROM shifts WHERE turno_nome = %s AND data_turno = %s",
-                (turno_nome, data_turno)
+                sql.SQL("CREATE TABLE IF NOT EXISTS {} PARTITION OF producao_minuto FOR VALUES FROM (%s) TO (%s)")
+                .format(sql.Identifier(f"producao_minuto_{key}")),
+                (start, end)
+            )
+            self.conn.commit()
+            self._partitions.add(key)
+            return True
+        except Exception as e:
+            print(f"[ERRO] Erro ao criar partição producao_minuto_{key}: {e}")
+            self.conn.rollback()
+            return False
+
+    def record_production(self, quantidade, device_id='default', canal=0, when=None):
+        """Soma 'quantidade' peças ao bucket de minuto do dispositivo/canal."""
+        if quantidade <= 0:
+            return True
+        if when is None:
+            when = datetime.now()
+        if not self.ensure_production_partition(when):
+            return False
+        try:
+            self.cursor.execute(
+                """
+                INSERT INTO producao_minuto (device_id, canal, minuto, contagem)
+                VALUES (%s, %s, date_trunc('minute', %s::timestamp), %s)
+                ON CONFLICT (device_id, canal, minuto) DO UPDATE
+                SET contagem = producao_minuto.contagem + EXCLUDED.contagem;
+                """,
+                (device_id, canal, when, quantidade)
+            )
+            self.conn.commit()
+            return True
+        except Exception as e:
+            print(f"[ERRO] record_production: {e}")
+            self.conn.rollback()
+            # A partição pode ter sido removida pela retenção: recria na próxima vez
+            self._partitions.discard(self._month_start(when).strftime('%Y%m'))
+            return False
+
+    def get_throughput(self, inicio, fim, bucket_minutes=15, device_id=None, canal=None):
+        """Produção em janelas de 'bucket_minutes' entre inicio e fim (buckets vazios = 0).
+
+        Retorna lista de {inicio, contagem, taxa_hora}; sequências de zeros indicam paradas.
+        Meses que já saíram da retenção da série por minuto vêm do resumo por hora
+        (buckets menores que 1 h recebem a hora inteira no seu primeiro bucket).
+        """
+        try:
+            inicio = inicio.replace(second=0, microsecond=0)
+            bucket_s = bucket_minutes * 60
+            n_buckets = max(int(math.ceil((fim - inicio).total_seconds() / bucket_s)), 0)
+            if n_buckets == 0:
+                return []
+
+            def filtros(coluna):
+                f = [sql.SQL("{} >= %(inicio)s").format(sql.Identifier(coluna)),
+                     sql.SQL("{} < %(fim)s").format(sql.Identifier(coluna))]
+                if device_id is not None:
+                    f.append(sql.SQL("device_id = %(device_id)s"))
+                if canal is not None:
+                    f.append(sql.SQL("canal = %(canal)s"))
+                return sql.SQL(' AND ').join(f)
+
+            # Um mês está em apenas uma das tabelas (a retenção resume e remove a partição na mesma transação)
+            query = sql.SQL("""
+                SELECT b.n, COALESCE(d.total, 0)
+                FROM generate_series(0, %(n_buckets)s - 1) AS b(n)
+                LEFT JOIN (
+                    SELECT floor(extract(epoch FROM (t - %(inicio)s)) / %(bucket_s)s)::int AS n,
+                           SUM(contagem) AS total
+                    FROM (
+                        SELECT minuto AS t, contagem FROM producao_minuto WHERE {filtros_minuto}
+                        UNION ALL
+                        SELECT hora, contagem FROM producao_hora WHERE {filtros_hora}
+                    ) serie
+                    GROUP BY 1
+                ) d ON d.n = b.n
+                ORDER BY b.n;
+            """).format(filtros_minuto=filtros('minuto'), filtros_hora=filtros('hora'))
+            self.cursor.execute(query, {
+                'inicio': inicio, 'fim': fim, 'n_buckets': n_buckets, 'bucket_s': bucket_s,
+                'device_id': device_id, 'canal': canal
+            })
+
+            serie = []
+            for n, total in self.cursor.fetchall():
+                bucket_inicio = inicio + timedelta(seconds=n * bucket_s)
+                serie.append({
+                    'inicio': bucket_inicio.isoformat(),
+                    'contagem': int(total),
+                    'taxa_hora': int(total) * 3600.0 / bucket_s
+                })
+            return serie
+        except Exception as e:
+            print(f"[ERRO] get_throughput: {e}")
+            self.conn.rollback()
+            return []
+
+    def get_production_and_window(self, inicio, janela_inicio, fim, device_id=None):
+        """Total em [inicio, fim) e a parte em [janela_inicio, fim) numa única leitura da série.
+
+        Retorna (None, 0) se não houver dados no intervalo.
+        """
+        try:
+            query = """
+                SELECT SUM(contagem), COALESCE(SUM(contagem) FILTER (WHERE minuto >= %s), 0)
+                FROM producao_minuto WHERE minuto >= %s AND minuto < %s
+            """
+            params = [janela_inicio, inicio, fim]
+            if device_id is not None:
+                query += " AND device_id = %s"
+                params.append(device_id)
+            self.cursor.execute(query, params)
+            total, janela = self.cursor.fetchone()
+            return (int(total) if total is not None else None), int(janela)
+        except Exception as e:
+            print(f"[ERRO] get_production_and_window: {e}")
+            self.conn.rollback()
+            return None, 0
+
+    def get_current_shift_count(self, turno_nome, data_turno, device_id=None):
+        """Obtém a contagem atual para um turno específico ou 0 se não existir.
+
+        Sem device_id, usa o dispositivo padrão (instalações com um único contador).
+        """
+        device_id = device_id or self.config.DEFAULT_DEVICE_ID
+        try:
+            self.cursor.execute(
+                "SELECT contador FROM shifts WHERE device_id = %s AND turno_nome = %s AND data_turno = %s",
+                (device_id, turno_nome, data_turno)
             )
             result = self.cursor.fetchone()
             if result:
                 return result[0]
             
-            # Se o turno não existe no banco, vamos criá-lo.
-            # Primeiro, verificamos se há uma meta padrão para este tipo de turno.
+            # Se o turno não existe no banco, vamos criá-lo (com a meta padrão, se houver)
             self.cursor.execute(
-                "SELECT meta FROM metas_p_turno WHERE turno_nome = %s",
-                (turno_nome,)
+                "INSERT INTO shifts (device_id, turno_nome, data_turno, contador) VALUES (%s, %s, %s, %s) RETURNING id",
+                (device_id, turno_nome, data_turno, 0)
             )
-            meta_padrao_row = self.cursor.fetchone()
-            meta_padrao = meta_padrao_row[0] if meta_padrao_row else None
+            self._apply_default_goal(self.cursor.fetchone()[0], turno_nome)
+            self.conn.commit()
+            return 0
+        except Exception as e:
+            print(f"[ERRO] Erro ao obter/inicializar contador do turno: {e}")
+            self.conn.rollback()
+            return 0 # Retorna 0 em caso de erro para evitar problemas
+
+    def _apply_default_goal(self, shift_id, turno_nome):
+        """Copia a meta padrão do tipo de turno (se houver) para um turno recém-criado."""
+        self.cursor.execute(
+            """
+            INSERT INTO metas (shift_id, meta_turno)
+            SELECT %s, meta FROM metas_p_turno WHERE turno_nome = %s
+            ON CONFLICT (shift_id) DO NOTHING
+            """,
+            (shift_id, turno_nome)
+        )
 
-            # Insere o novo turno com contador 0
+    def get_shift_counts_by_device(self, turno_nome, data_turno):
+        """Retorna {device_id: contador} de todos os dispositivos em um turno."""
+        try:
             self.cursor.execute(
-                "INSERT INTO shifts (turno_nome, data_turno, contador) VALUES (%s, %s, %s) RETURNING id",
-                (turno_nome, data_turno, 0)
+                "SELECT device_id, contador FROM shifts WHERE turno_nome = %s AND data_turno = %s",
+                (turno_nome, data_turno)
             )
-            new_shift_id = self.cursor.fetchone()[0]
+            return {row[0]: row[1] or 0 for row in self.cursor.fetchall()}
+        except Exception as e:
+            print(f"[ERRO] get_shift_counts_by_device: {e}")
+            self.conn.rollback()
+            return {}
 
-            # Se encontramos uma meta padrão, já a inserimos para o turno recém-criado
-            if meta_padrao is not None:
-                self.cursor.execute(
-                    "INSERT INTO metas (shift_id, meta_turno) VALUES (%s, %s) ON CONFLICT (shift_id) DO NOTHING",
-                    (new_shift_id, meta_padrao)
-                )
+    def update_device_count(self, device_id, turno_nome, data_turno, counter_value):
+        """Registra o contador acumulado enviado por um dispositivo.
+
+        Mantém o maior valor já recebido (o dispositivo envia o total do turno, não
+        incrementos). O delta vem da linha lida sob o lock da própria linha: duas
+        requisições com o mesmo total (reenvio após timeout, USB e Wi-Fi juntos) não
+        contam em dobro, nem na criação do turno. Retorna (novo_contador, delta) ou (None, 0).
+        """
+        key = {'device_id': device_id, 'turno_nome': turno_nome, 'data_turno': data_turno,
+               'counter': counter_value}
+        try:
+            # Só quem de fato cria a linha recebe RETURNING; a outra espera o commit e segue
+            self.cursor.execute(
+                """
+                INSERT INTO shifts (device_id, turno_nome, data_turno, contador)
+                VALUES (%(device_id)s, %(turno_nome)s, %(data_turno)s, %(counter)s)
+                ON CONFLICT (device_id, turno_nome, data_turno) DO NOTHING
+                RETURNING id, contador;
+                """,
+                key
+            )
+            created = self.cursor.fetchone()
+            if created is not None:
+                shift_id, new_count = created
+                self._apply_default_goal(shift_id, turno_nome)
+                self.conn.commit()
+                return new_count, new_count
+            self.cursor.execute(
+                """
+                SELECT id, contador FROM shifts
+                WHERE device_id = %(device_id)s AND turno_nome = %(turno_nome)s AND data_turno = %(data_turno)s
+                FOR UPDATE;
+                """,
+                key
+            )
+            shift_id, old_count = self.cursor.fetchone()
+            old_count = old_count or 0
+            new_count = max(old_count, counter_value)
+            if new_count != old_count:
+                self.cursor.execute("UPDATE shifts SET contador = %s WHERE id = %s", (new_count, shift_id))
             self.conn.commit()
-            return 0
+            return new_count, new_count - old_count
         except Exception as e:
-            print(f"[ERRO] Erro ao obter/inicializar contador do turno: {e}")
+            print(f"[ERRO] Erro ao atualizar contador do dispositivo {device_id}: {e}")
             self.conn.rollback()
-            return 0 # Retorna 0 em caso de erro para evitar problemas
+            return None, 0
 
-    def increment_shift_count(self, turno_nome, data_turno):
+    def increment_shift_count(self, turno_nome, data_turno, device_id=None):
         """Incrementa o contador para um turno específico."""
+        device_id = device_id or self.config.DEFAULT_DEVICE_ID
         try:
             self.cursor.execute(
                 """
-                INSERT INTO shifts (turno_nome, data_turno, contador)
-                VALUES (%s, %s, 1)
-                ON CONFLICT (turno_nome, data_turno) DO UPDATE
+                INSERT INTO shifts (device_id, turno_nome, data_turno, contador)
+                VALUES (%s, %s, %s, 1)
+                ON CONFLICT (device_id, turno_nome, data_turno) DO UPDATE
                 SET contador = shifts.contador + 1
                 RETURNING contador;
                 """,
-                (turno_nome, data_turno)
+                (device_id, turno_nome, data_turno)
             )
             new_count = self.cursor.fetchone()[0]
             self.conn.commit()
             return new_count
         except Exception as e:
-            print(f"[ERRO] Erro ao incrementar contador do turno: {e}")
+            print(f"[ERRO] Erro ao incrementar contador do turno: {e}")
+            self.conn.rollback()
+            return None # Retorna None em caso de erro
+
+    def finish_shift(self, turno_nome, data_turno, device_id=None):
+        """Marca um turno como finalizado no banco (em todos os dispositivos se device_id=None)."""
+        try:
+            query = "UPDATE shifts SET fim_turno = NOW() WHERE turno_nome = %s AND data_turno = %s AND fim_turno IS NULL"
+            params = [turno_nome, data_turno]
+            if device_id is not None:
+                query += " AND device_id = %s"
+                params.append(device_id)
+            self.cursor.execute(query, params)
+            self.conn.commit()
+            print(f"[OK] Turno '{turno_nome}' do dia '{data_turno}' finalizado no banco.")
+            return True
+        except Exception as e:
+            print(f"[ERRO] Erro ao finalizar turno: {e}")
+            self.conn.rollback()
+            return False
+
+    def register_device(self, device_id):
+        """Cadastra o dispositivo na primeira vez em que ele é visto."""
+        try:
+            self.cursor.execute(
+                "INSERT INTO devices (device_id) VALUES (%s) ON CONFLICT (device_id) DO NOTHING",
+                (device_id,)
+            )
+            self.conn.commit()
+            return True
+        except Exception as e:
+            print(f"[ERRO] register_device: {e}")
+            self.conn.rollback()
+            return False
+
+    def touch_devices(self, last_seen_by_device):
+        """Persiste em lote o último contato de cada dispositivo ({device_id: datetime})."""
+        if not last_seen_by_device:
+            return True
+        try:
+            psycopg2.extras.execute_values(
+                self.cursor,
+                """
+                INSERT INTO devices (device_id, last_seen) VALUES %s
+                ON CONFLICT (device_id) DO UPDATE
+                SET last_seen = GREATEST(devices.last_seen, EXCLUDED.last_seen)
+                """,
+                list(last_seen_by_device.items())
+            )
+            self.conn.commit()
+            return True
+        except Exception as e:
+            print(f"[ERRO] touch_devices: {e}")
+            self.conn.rollback()
+            return False
+
+    def update_device_info(self, device_id, nome=None, linha=None):
+        """Define nome e/ou linha de produção de um dispositivo."""
+        try:
+            self.cursor.execute(
+                """
+                INSERT INTO devices (device_id, nome, linha) VALUES (%s, %s, %s)
+                ON CONFLICT (device_id) DO UPDATE
+                SET nome = COALESCE(EXCLUDED.nome, devices.nome),
+                    linha = COALESCE(EXCLUDED.linha, devices.linha)
+                """,
+                (device_id, nome, linha)
+            )
+            self.conn.commit()
+            return True
+        except Exception as e:
+            print(f"[ERRO] update_device_info: {e}")
+            self.conn.rollback()
+            return False
+
+    def get_devices(self):
+        """Lista os dispositivos cadastrados."""
+        try:
+            self.cursor.execute(
+                "SELECT device_id, nome, linha, first_seen, last_seen FROM devices ORDER BY linha NULLS LAST, device_id"
+            )
+            return [{
+                'device_id': row[0],
+                'nome': row[1],
+                'linha': row[2],
+                'first_seen': row[3].isoformat() if row[3] else None,
+                'last_seen': row[4].isoformat() if row[4] else None
+            } for row in self.cursor.fetchall()]
+        except Exception as e:
+            print(f"[ERRO] get_devices: {e}")
+            self.conn.rollback()
+            return []
+
+    def update_offshift_count(self, device_id, chave, counter_value):
+        """Registra o contador de um dispositivo fora do horário de turnos.
+
+        `chave` identifica o período fora de turno; ao mudar de período o contador
+        recomeça. Mesma semântica de update_device_count: retorna (novo, delta).
+        """
+        key = {'device_id': device_id, 'chave': chave, 'counter': counter_value}
+        try:
+            self.cursor.execute(
+                """
+                INSERT INTO devices (device_id, contador_fora_turno, fora_turno_chave)
+                VALUES (%(device_id)s, %(counter)s, %(chave)s)
+                ON CONFLICT (device_id) DO NOTHING
+                RETURNING contador_fora_turno;
+                """,
+                key
+            )
+            created = self.cursor.fetchone()
+            if created is not None:
+                self.conn.commit()
+                return created[0], created[0]
+            self.cursor.execute(
+                """
+                SELECT CASE WHEN fora_turno_chave = %(chave)s THEN contador_fora_turno ELSE 0 END
+                FROM devices WHERE device_id = %(device_id)s
+                FOR UPDATE;
+                """,
+                key
+            )
+            old_count = self.cursor.fetchone()[0] or 0
+            new_count = max(old_count, counter_value)
+            self.cursor.execute(
+                "UPDATE devices SET contador_fora_turno = %s, fora_turno_chave = %s WHERE device_id = %s",
+                (new_count, chave, device_id)
+            )
+            self.conn.commit()
+            return new_count, new_count - old_count
+        except Exception as e:
+            print(f"[ERRO] update_offshift_count: {e}")
             self.conn.rollback()
-            return None # Retorna None em caso de erro
+            return None, 0
 
-    def finish_shift(self, turno_nome, data_turno):
-        """Marca um turno como finalizado no banco de dados."""
+    def get_devices_status(self, turno_nome=None, data_turno=None, chave_fora_turno=None):
+        """Estado de todos os dispositivos para o painel: cadastro, último contato e
+        contador do turno corrente (ou do período fora de turno, se turno_nome=None)."""
         try:
             self.cursor.execute(
-                "UPDATE shifts SET fim_turno = NOW() WHERE turno_nome = %s AND data_turno = %s",
-                (turno_nome, data_turno)
+                """
+                SELECT d.device_id, d.nome, d.linha, d.last_seen,
+                       CASE WHEN %(turno_nome)s::varchar IS NULL
+                            THEN CASE WHEN d.fora_turno_chave = %(chave)s THEN d.contador_fora_turno ELSE 0 END
+                            ELSE COALESCE(s.contador, 0)
+                       END AS contador
+                FROM devices d
+                LEFT JOIN shifts s ON s.device_id = d.device_id
+                                  AND s.turno_nome = %(turno_nome)s AND s.data_turno = %(data_turno)s
+                ORDER BY d.device_id
+                """,
+                {'turno_nome': turno_nome, 'data_turno': data_turno, 'chave': chave_fora_turno}
             )
-            self.conn.commit()
-            print(f"[OK] Turno '{turno_nome}' do dia '{data_turno}' finalizado no banco.")
-            return True
+            return [{
+                'device_id': row[0],
+                'nome': row[1],
+                'linha': row[2],
+                'last_seen': row[3].strftime('%Y-%m-%d %H:%M:%S') if row[3] else None,
+                'count': int(row[4] or 0)
+            } for row in self.cursor.fetchall()]
         except Exception as e:
-            print(f"[ERRO] Erro ao finalizar turno: {e}")
+            print(f"[ERRO] get_devices_status: {e}")
             self.conn.rollback()
-            return False
+            return []
 
-    def get_shift_history(self, days=10):
-        """Obtém o histórico completo dos turnos do banco de dados."""
+    def get_shift_history(self, days=10, device_id=None, fim=None):
+        """Obtém o histórico completo dos turnos do banco de dados.
+
+        Sem device_id, soma todos os dispositivos (visão da planta).
+        fim: último dia da grade (padrão: hoje); a grade cobre os N dias até ele.
+        """
         try:
             self.cursor.execute(
                 """
                 WITH date_series AS (
                     -- Gera uma série de datas para os últimos N dias
                     SELECT generate_series(
-                        CURRENT_DATE - (%s - 1) * INTERVAL '1 day',
-                        CURRENT_DATE,
+                        COALESCE(%(fim)s::date, CURRENT_DATE) - (%(days)s - 1) * INTERVAL '1 day',
+                        COALESCE(%(fim)s::date, CURRENT_DATE),
                         '1 day'::interval
                     )::date AS report_date
                 ),
@@ -228,6 +1162,19 @@ class DatabaseManager:
                         s.turno_nome
                     FROM date_series d
                     CROSS JOIN shift_names s
+                ),
+                shifts_agg AS (
+                    -- Consolida os dispositivos: o turno só termina quando todos terminam
+                    SELECT data_turno, turno_nome,
+                           SUM(contador) AS contador,
+                           SUM(perdas) AS perdas,
+                           MIN(inicio_turno) AS inicio_turno,
+                           CASE WHEN bool_and(fim_turno IS NOT NULL) THEN MAX(fim_turno) END AS fim_turno
+                    FROM shifts
+                    WHERE data_turno BETWEEN COALESCE(%(fim)s::date, CURRENT_DATE) - (%(days)s - 1)
+                                         AND COALESCE(%(fim)s::date, CURRENT_DATE)
+                      AND (%(device_id)s::varchar IS NULL OR device_id = %(device_id)s)
+                    GROUP BY data_turno, turno_nome
                 )
                 -- Junta a grade completa com os dados existentes na tabela de turnos
                 SELECT
@@ -238,10 +1185,10 @@ class DatabaseManager:
                     s.inicio_turno,
                     s.fim_turno
                 FROM full_grid g
-                LEFT JOIN shifts s ON g.report_date = s.data_turno AND g.turno_nome = s.turno_nome
+                LEFT JOIN shifts_agg s ON g.report_date = s.data_turno AND g.turno_nome = s.turno_nome
                 ORDER BY g.report_date DESC, g.turno_nome ASC;
                 """,
-                (days,)
+                {'days': days, 'device_id': device_id, 'fim': fim}
             )
             history = []
             for row in self.cursor.fetchall():
@@ -262,15 +1209,77 @@ class DatabaseManager:
                 self.reset_connection()
             return []
 
-    def _get_or_create_shift(self, turno_nome, data_turno):
+    def get_shift_history_page(self, antes, days=10, device_id=None):
+        """Página da grade de histórico com os N dias anteriores a `antes` (exclusivo).
+
+        Dias sem nenhum turno no começo da página são pulados: a página termina no último
+        dia com dados antes de `antes` (busca reversa no índice por data). Retorna
+        (histórico, início da página) — o início é o `antes` da próxima — ou ([], None)
+        quando não há dados mais antigos.
+        """
+        try:
+            self.cursor.execute(
+                """
+                SELECT data_turno FROM shifts
+                WHERE data_turno < %(antes)s
+                  AND (%(device_id)s::varchar IS NULL OR device_id = %(device_id)s)
+                ORDER BY data_turno DESC
+                LIMIT 1;
+                """,
+                {'antes': antes, 'device_id': device_id}
+            )
+            row = self.cursor.fetchone()
+        except Exception as e:
+            print(f"[ERRO] get_shift_history_page: {e}")
+            self.conn.rollback()
+            return [], None
+        if row is None:
+            return [], None
+        fim = row[0]
+        return self.get_shift_history(days, device_id=device_id, fim=fim), fim - timedelta(days=days - 1)
+
+    def get_shifts_page(self, after=None, limit=20, device_id=None):
+        """Turnos (uma linha por dispositivo) do mais recente para o mais antigo, por chave.
+
+        after: (data_turno, id) da última linha da página anterior, ou None na primeira.
+        Retorna (turnos, chave da próxima página ou None).
+        """
+        try:
+            self.cursor.execute(
+                """
+                SELECT id, turno_nome, data_turno, contador, device_id
+                FROM shifts
+                WHERE (%(data)s::date IS NULL OR (data_turno, id) < (%(data)s::date, %(id)s))
+                  AND (%(device_id)s::varchar IS NULL OR device_id = %(device_id)s)
+                ORDER BY data_turno DESC, id DESC
+                LIMIT %(limit)s;
+                """,
+                {'data': after[0] if after else None, 'id': after[1] if after else 0,
+                 'device_id': device_id, 'limit': limit + 1}
+            )
+            rows, next_key = split_page(self.cursor.fetchall(), limit, lambda r: (r[2], r[0]))
+            return [{
+                'id': r[0],
+                'turno_nome': r[1],
+                'data_turno': str(r[2]),
+                'contador': r[3],
+                'device_id': r[4]
+            } for r in rows], next_key
+        except Exception as e:
+            print(f"[ERRO] get_shifts_page: {e}")
+            self.conn.rollback()
+            return [], None
+
+    def _get_or_create_shift(self, turno_nome, data_turno, device_id=None):
         """Obtém id do turno ou cria se não existir, retornando (id, contador)."""
+        device_id = device_id or self.config.DEFAULT_DEVICE_ID
         try:
-            print(f"[DEBUG] _get_or_create_shift: turno_nome={turno_nome}, data_turno={data_turno}")
+            print(f"[DEBUG] _get_or_create_shift: device_id={device_id}, turno_nome={turno_nome}, data_turno={data_turno}")
             
             # Primeiro, tenta buscar o turno existente
             self.cursor.execute(
-                "SELECT id, contador FROM shifts WHERE turno_nome = %s AND data_turno = %s",
-                (turno_nome, data_turno)
+                "SELECT id, contador FROM shifts WHERE device_id = %s AND turno_nome = %s AND data_turno = %s",
+                (device_id, turno_nome, data_turno)
             )
             row = self.cursor.fetchone()
             print(f"[DEBUG] _get_or_create_shift: row encontrada={row}")
@@ -281,8 +1290,8 @@ class DatabaseManager:
             # Se não existe, cria um novo turno com timestamp atual
             print(f"[DEBUG] _get_or_create_shift: Criando novo turno para {turno_nome} - {data_turno}")
             self.cursor.execute(
-                "INSERT INTO shifts (turno_nome, data_turno, contador, inicio_turno) VALUES (%s, %s, %s, NOW()) RETURNING id, contador",
-                (turno_nome, data_turno, 0)
+                "INSERT INTO shifts (device_id, turno_nome, data_turno, contador, inicio_turno) VALUES (%s, %s, %s, %s, NOW()) RETURNING id, contador",
+                (device_id, turno_nome, data_turno, 0)
             )
             res = self.cursor.fetchone()
             print(f"[DEBUG] _get_or_create_shift: Resultado da inserção={res}")
@@ -302,8 +1311,12 @@ class DatabaseManager:
                 pass  # Ignora erro de rollback se já foi feito
             return None, 0
 
-    def set_goal_for_shift(self, turno_nome, data_turno, meta_turno, meta_dia=None):
-        """Define meta do turno (e opcional meta diária) para um turno específico."""
+    def set_goal_for_shift(self, turno_nome, data_turno, meta_turno, meta_dia=None, device_id=None):
+        """Define meta do turno (e opcional meta diária) para um turno específico.
+
+        Sem device_id, a meta vale para todos os dispositivos que já abriram o turno
+        (ou para o dispositivo padrão, se nenhum abriu).
+        """
         # 1. Atualiza ou insere a meta PADRÃO para este TIPO de turno
         # AGORA, ATUALIZA A META PARA TODOS OS TURNOS PADRÃO
         try:
@@ -325,105 +1338,144 @@ class DatabaseManager:
             self.conn.rollback()
             return False
 
-        # 2. Garante que o turno específico existe e obtém seu ID
-        shift_id, _ = self._get_or_create_shift(turno_nome, data_turno)
-        if shift_id is None:
-            print(f"[ERRO] set_goal_for_shift: Não foi possível obter/criar shift_id para {turno_nome} - {data_turno}")
-            return False
+        # 2. Obtém os turnos afetados (cria o do dispositivo, se necessário)
+        if device_id is None:
+            shift_ids = []
+            try:
+                self.cursor.execute(
+                    "SELECT id FROM shifts WHERE turno_nome = %s AND data_turno = %s",
+                    (turno_nome, data_turno)
+                )
+                shift_ids = [row[0] for row in self.cursor.fetchall()]
+            except Exception as e:
+                print(f"[ERRO] set_goal_for_shift: {e}")
+                self.conn.rollback()
+                return False
+        else:
+            shift_ids = []
+        if not shift_ids:
+            shift_id, _ = self._get_or_create_shift(turno_nome, data_turno, device_id)
+            if shift_id is None:
+                print(f"[ERRO] set_goal_for_shift: Não foi possível obter/criar shift_id para {turno_nome} - {data_turno}")
+                return False
+            shift_ids = [shift_id]
 
-        # 3. Atualiza ou insere a meta para o turno específico (histórico)
+        # 3. Atualiza ou insere a meta para os turnos específicos (histórico)
         try:
-            self.cursor.execute(
+            psycopg2.extras.execute_values(
+                self.cursor,
                 """
                 INSERT INTO metas (shift_id, meta_turno, meta_dia)
-                VALUES (%s, %s, %s)
+                VALUES %s
                 ON CONFLICT (shift_id)
                 DO UPDATE SET meta_turno = EXCLUDED.meta_turno, meta_dia = EXCLUDED.meta_dia
                 """,
-                (shift_id, meta_turno, meta_dia)
+                [(shift_id, meta_turno, meta_dia) for shift_id in shift_ids]
             )
             self.conn.commit()
-            print(f"[OK] Meta para o turno específico (ID: {shift_id}) atualizada.")
+            print(f"[OK] Meta para os turnos específicos (IDs: {shift_ids}) atualizada.")
             return True
         except Exception as e:
             print(f"[ERRO] set_goal_for_shift: {e}")
             self.conn.rollback()
             return False
 
-    def insert_loss(self, turno_nome, data_turno, quantidade, motivo, data_evento=None):
-        """Adiciona perdas diretamente na tabela shifts."""
+    def insert_loss(self, turno_nome, data_turno, quantidade, motivo, data_evento=None, device_id=None):
+        """Registra uma perda do turno (shifts.perdas é atualizado pelo trigger)."""
+        return self.insert_losses([{
+            'device_id': device_id, 'turno_nome': turno_nome, 'data_turno': data_turno,
+            'quantidade': quantidade, 'motivo': motivo, 'data_evento': data_evento
+        }]) is not None
+
+    def insert_losses(self, losses):
+        """Registra várias perdas em uma única transação e retorna quantas foram gravadas.
+
+        Cada item: device_id (opcional), turno_nome, data_turno, quantidade, motivo e
+        data_evento (opcional, padrão agora). Os turnos que ainda não existem são
+        criados; as perdas entram em um único INSERT multi-linha, e o trigger por
+        comando atualiza shifts.perdas uma vez por turno afetado. Tudo ou nada:
+        retorna None em caso de erro.
+        """
+        rows = [(loss.get('device_id') or self.config.DEFAULT_DEVICE_ID, loss['turno_nome'], loss['data_turno'],
+                 int(loss['quantidade']), loss.get('motivo') or 'Perda registrada manualmente',
+                 loss.get('data_evento')) for loss in losses]
+        if not rows:
+            return 0
         try:
-            print(f"[DEBUG] insert_loss: turno_nome={turno_nome}, data_turno={data_turno}, quantidade={quantidade}")
-            
-            # Atualiza ou cria o turno com as perdas
-            self.cursor.execute(
+            psycopg2.extras.execute_values(
+                self.cursor,
                 """
-                INSERT INTO shifts (turno_nome, data_turno, contador, perdas, inicio_turno)
-                VALUES (%s, %s, 0, %s, NOW())
-                ON CONFLICT (turno_nome, data_turno) 
-                DO UPDATE SET perdas = shifts.perdas + %s
-                RETURNING id, perdas;
+                INSERT INTO shifts (device_id, turno_nome, data_turno, contador, perdas, inicio_turno)
+                SELECT DISTINCT v.device_id, v.turno_nome, v.data_turno::date, 0, 0, LOCALTIMESTAMP
+                FROM (VALUES %s) AS v(device_id, turno_nome, data_turno)
+                ON CONFLICT (device_id, turno_nome, data_turno) DO NOTHING
                 """,
-                (turno_nome, data_turno, quantidade, quantidade)
+                list({row[:3] for row in rows}), page_size=len(rows)
             )
-            
-            result = self.cursor.fetchone()
-            if result:
-                shift_id, total_perdas = result
-                self.conn.commit()
-                print(f"[DEBUG] Perdas adicionadas com sucesso: shift_id={shift_id}, quantidade={quantidade}, total_perdas={total_perdas}")
-                return True
-            else:
-                self.conn.rollback()
-                print("[DEBUG] Falha ao adicionar perdas")
-                return False
-                
+            psycopg2.extras.execute_values(
+                self.cursor,
+                """
+                INSERT INTO perdas (shift_id, quantidade, motivo, data_evento)
+                SELECT s.id, v.quantidade, v.motivo, COALESCE(v.data_evento, LOCALTIMESTAMP)
+                FROM (VALUES %s) AS v(device_id, turno_nome, data_turno, quantidade, motivo, data_evento)
+                JOIN shifts s ON s.device_id = v.device_id AND s.turno_nome = v.turno_nome
+                             AND s.data_turno = v.data_turno
+                """,
+                rows, template="(%s, %s, %s::date, %s::int, %s, %s::timestamp)", page_size=len(rows)
+            )
+            inserted = self.cursor.rowcount
+            self.conn.commit()
+            return inserted
         except Exception as e:
-            print(f"[ERRO] insert_loss: {e}")
-            try:
-                self.conn.rollback()
-            except:
-                pass  # Ignora erro de rollback se já foi feito
-            return False
+            print(f"[ERRO] insert_losses: {e}")
+            self.conn.rollback()
+            return None
 
-    def get_shift_metrics(self, turno_nome, data_turno):
-        """Calcula métricas do turno: bruto, perdas, liquida, metas, taxas, produtividade."""
+    def get_shift_metrics(self, turno_nome, data_turno, device_id=None):
+        """Calcula métricas do turno: bruto, perdas, liquida, metas, taxas, produtividade.
+
+        Sem device_id, consolida todos os dispositivos do turno (metas somadas).
+        """
         try:
-            # Dados do turno incluindo perdas
+            # Dados do turno incluindo perdas e metas
             self.cursor.execute(
-                "SELECT id, contador, perdas, inicio_turno, fim_turno FROM shifts WHERE turno_nome = %s AND data_turno = %s",
-                (turno_nome, data_turno)
+                """
+                SELECT COUNT(*), SUM(s.contador), SUM(s.perdas), MIN(s.inicio_turno),
+                       CASE WHEN bool_and(s.fim_turno IS NOT NULL) THEN MAX(s.fim_turno) END,
+                       SUM(m.meta_turno), MAX(m.meta_dia)
+                FROM shifts s
+                LEFT JOIN metas m ON m.shift_id = s.id
+                WHERE s.turno_nome = %(turno_nome)s AND s.data_turno = %(data_turno)s
+                  AND (%(device_id)s::varchar IS NULL OR s.device_id = %(device_id)s)
+                """,
+                {'turno_nome': turno_nome, 'data_turno': data_turno, 'device_id': device_id}
             )
             row = self.cursor.fetchone()
-            if not row:
-                return None
-            
-            # Verifica se a row tem o número correto de elementos
-            if len(row) < 5:
+            if not row or not row[0]:
                 return None
                 
-            shift_id, contador, perdas, inicio_turno, fim_turno = row
-
-            # Meta do turno
-            self.cursor.execute(
-                "SELECT meta_turno, meta_dia FROM metas WHERE shift_id = %s;",
-                (int(shift_id),)
-            )
-            meta_row = self.cursor.fetchone()
-            meta_turno = meta_row[0] if meta_row and len(meta_row) > 0 else None
-            meta_dia = meta_row[1] if meta_row and len(meta_row) > 1 else None
+            _, contador, perdas, inicio_turno, fim_turno, meta_turno, meta_dia = row
+            contador = int(contador or 0)
+            perdas = int(perdas or 0)
             
             producao_bruta = contador
             producao_liquida = max(producao_bruta - perdas, 0)
             taxa_perdas = (perdas / producao_bruta * 100.0) if producao_bruta > 0 else 0.0
             eficiencia = (producao_bruta / meta_turno * 100.0) if (meta_turno and meta_turno > 0) else None
 
-            # Produtividade por hora
+            # Produtividade por hora: ritmo real da última hora do turno, medido na
+            # série por minuto. Turnos sem série (legado) usam a média do turno.
             from datetime import datetime as _dt
             inicio = inicio_turno or _dt.now()
             fim = fim_turno or _dt.now()
-            duracao_horas = max((fim - inicio).total_seconds() / 3600.0, 0.0001)
-            produtividade_hora = producao_bruta / duracao_horas
+            janela_inicio = max(inicio, fim - timedelta(hours=1))
+            janela_horas = (fim - janela_inicio).total_seconds() / 3600.0
+            producao_serie, producao_janela = self.get_production_and_window(inicio, janela_inicio, fim, device_id)
+            if producao_serie is not None:
+                produtividade_hora = producao_janela / max(janela_horas, 1 / 60.0)
+            else:
+                duracao_horas = max((fim - inicio).total_seconds() / 3600.0, 0.0001)
+                produtividade_hora = producao_bruta / duracao_horas
 
             return {
                 'producao_bruta': producao_bruta,
@@ -443,7 +1495,7 @@ class DatabaseManager:
                 self.reset_connection()
             return None
 
-    def get_period_aggregates(self, period: str, reference_date=None):
+    def get_period_aggregates(self, period: str, reference_date=None, device_id=None):
         """Retorna agregados diário, semanal, mensal ou anual: bruto, perdas, liquida por data."""
         from datetime import datetime as _dt, timedelta as _td
         try:
@@ -470,20 +1522,21 @@ class DatabaseManager:
             else:
                 return []
 
-            # Agregado por dia dentro do intervalo
+            # Agregado por dia dentro do intervalo (lido do rollup diário)
             self.cursor.execute(
                 """
                 SELECT
-                    data_turno::date as dia,
-                    SUM(contador) as producao_bruta,
+                    period_start as dia,
+                    SUM(producao) as producao_bruta,
                     SUM(perdas) as perdas,
-                    SUM(contador) - SUM(perdas) as producao_liquida
-                FROM shifts
-                WHERE data_turno BETWEEN %s AND %s
+                    SUM(producao) - SUM(perdas) as producao_liquida
+                FROM rollup_producao
+                WHERE granularidade = 'day' AND period_start BETWEEN %s AND %s
+                  AND (%s::varchar IS NULL OR device_id = %s)
                 GROUP BY dia
                 ORDER BY dia ASC;
                 """,
-                (start_date, end_date)
+                (start_date, end_date, device_id, device_id)
             )
             rows = self.cursor.fetchall()
             result = []
@@ -509,39 +1562,28 @@ class DatabaseManager:
                 self.reset_connection()
             return []
 
-    def get_losses_distribution(self, period: str, reference_date=None):
+    def get_losses_distribution(self, period: str, reference_date=None, device_id=None):
         """Distribuição das perdas por motivo no período especificado."""
-        from datetime import datetime as _dt, timedelta as _td
+        from datetime import datetime as _dt
         try:
+            if period not in ['day', 'week', 'month', 'year']:
+                return []
             if reference_date is None:
                 reference_date = _dt.now().date()
-            if period == 'day':
-                start_date = _dt.combine(reference_date, _dt.min.time())
-                end_date = _dt.combine(reference_date, _dt.max.time())
-            elif period == 'week':
-                start_date = _dt.combine(reference_date - _td(days=reference_date.weekday()), _dt.min.time())
-                end_date = start_date + _td(days=7)
-            elif period == 'month':
-                start_date = _dt.combine(reference_date.replace(day=1), _dt.min.time())
-                if start_date.month == 12:
-                    end_date = _dt.combine(start_date.replace(year=start_date.year+1, month=1, day=1) - _td(days=1), _dt.max.time())
-                else:
-                    end_date = _dt.combine(start_date.replace(month=start_date.month+1, day=1) - _td(days=1), _dt.max.time())
-            elif period == 'year':
-                start_date = _dt.combine(reference_date.replace(month=1, day=1), _dt.min.time())
-                end_date = _dt.combine(reference_date.replace(month=12, day=31), _dt.max.time())
-            else:
-                return []
 
+            # O bucket do rollup já corresponde ao dia/semana/mês/ano de referência
             self.cursor.execute(
                 """
-                SELECT motivo, COALESCE(SUM(quantidade),0) as total
-                FROM perdas
-                WHERE data_evento BETWEEN %s AND %s
+                SELECT motivo, SUM(total) AS total
+                FROM rollup_perdas_motivo
+                WHERE granularidade = %s
+                  AND period_start = date_trunc(%s, %s::date)::date
+                  AND (%s::varchar IS NULL OR device_id = %s)
                 GROUP BY motivo
+                HAVING SUM(total) > 0
                 ORDER BY total DESC
                 """,
-                (start_date, end_date)
+                (period, period, reference_date, device_id, device_id)
             )
             rows = self.cursor.fetchall()
             return [{'motivo': r[0], 'total': int(r[1])} for r in rows]
@@ -549,31 +1591,30 @@ class DatabaseManager:
             print(f"[ERRO] get_losses_distribution: {e}")
             return []
 
-    def get_shifts_efficiency_ranking(self, reference_date=None):
-        """Ranking dos turnos por eficiência do dia informado (ou do dia atual)."""
+    def get_shifts_efficiency_ranking(self, reference_date=None, device_id=None):
+        """Ranking dos turnos por eficiência do dia informado (ou do dia atual).
+
+        Cada dispositivo entra como uma linha própria, o que permite comparar linhas.
+        """
         from datetime import datetime as _dt
         try:
             if reference_date is None:
                 reference_date = _dt.now().date()
             self.cursor.execute(
                 """
-                WITH perdas_sum AS (
-                    SELECT shift_id, SUM(quantidade) as total_perdas
-                    FROM perdas
-                    GROUP BY shift_id
-                )
                 SELECT
-                    s.turno_nome, s.data_turno, s.contador, s.perdas, m.meta_turno
+                    s.turno_nome, s.data_turno, s.contador, s.perdas, m.meta_turno, s.device_id
                 FROM shifts s
                 LEFT JOIN metas m ON m.shift_id = s.id
-                WHERE s.data_turno = %s;
+                WHERE s.data_turno = %s
+                  AND (%s::varchar IS NULL OR s.device_id = %s);
                 """,
-                (reference_date,)
+                (reference_date, device_id, device_id)
             )
             rows = self.cursor.fetchall()
             ranking = []
             for row in rows:
-                turno_nome, data_turno, bruto, perdas, meta_turno = row
+                turno_nome, data_turno, bruto, perdas, meta_turno, row_device = row
                 liquida = max((bruto or 0) - (perdas or 0), 0) # Mantém a líquida para informação
                 efic = (bruto / meta_turno * 100.0) if meta_turno and meta_turno > 0 else None
                 # Trata data_turno que pode ser date ou string
@@ -584,6 +1625,7 @@ class DatabaseManager:
                 
                 ranking.append({
                     'turno_nome': turno_nome,
+                    'device_id': row_device,
                     'data_turno': data_str,
                     'eficiencia': efic,
                     'producao_bruta': int(bruto or 0),
@@ -601,7 +1643,7 @@ class DatabaseManager:
                 self.reset_connection()
             return []
 
-    def get_daily_efficiency_series(self, days: int = 7):
+    def get_daily_efficiency_series(self, days: int = 7, device_id=None):
         """Retorna série de eficiência diária dos últimos N dias: (liquida/MetaDia)*100.
         Considera meta_dia se disponível; senão soma meta_turno dos turnos do dia.
         """
@@ -609,31 +1651,19 @@ class DatabaseManager:
             # Agrega por data: soma liquida e soma meta (preferindo meta_dia quando presente)
             self.cursor.execute(
                 """
-                WITH base AS (
-                    SELECT s.id as shift_id, s.data_turno::date as dia, s.contador as bruto
-                    FROM shifts s
-                    WHERE s.data_turno >= CURRENT_DATE - %s::int
-                ), perdas_sum AS (
-                    SELECT p.shift_id, COALESCE(SUM(p.quantidade),0) as perdas
-                    FROM perdas p
-                    GROUP BY p.shift_id
-                ), metas_join AS (
-                    SELECT m.shift_id, m.meta_turno, m.meta_dia
-                    FROM metas m
-                )
-                SELECT b.dia,
-                       SUM(b.bruto - COALESCE(ps.perdas,0)) as liquida,
-                       CASE WHEN COUNT(mj.meta_dia) > 0 AND SUM(COALESCE(mj.meta_dia,0)) > 0
-                            THEN MAX(mj.meta_dia) -- se meta_dia cadastrada por turno, use a soma via MAX por dia? fallback abaixo
-                            ELSE SUM(COALESCE(mj.meta_turno,0))
+                SELECT period_start as dia,
+                       SUM(producao - perdas) as liquida,
+                       CASE WHEN COALESCE(MAX(meta_dia), 0) > 0
+                            THEN MAX(meta_dia) -- meta diária cadastrada tem prioridade
+                            ELSE SUM(meta_turno)
                        END as meta_total
-                FROM base b
-                LEFT JOIN perdas_sum ps ON ps.shift_id = b.shift_id
-                LEFT JOIN metas_join mj ON mj.shift_id = b.shift_id
-                GROUP BY b.dia
-                ORDER BY b.dia ASC
+                FROM rollup_producao
+                WHERE granularidade = 'day' AND period_start >= CURRENT_DATE - %s::int
+                  AND (%s::varchar IS NULL OR device_id = %s)
+                GROUP BY period_start
+                ORDER BY period_start ASC
                 """,
-                (days,)
+                (days, device_id, device_id)
             )
             rows = self.cursor.fetchall()
             series = []
@@ -663,7 +1693,7 @@ class DatabaseManager:
         try:
             self.cursor.execute(
                 """
-                SELECT turno_nome, data_turno, contador, inicio_turno
+                SELECT turno_nome, data_turno, contador, inicio_turno, device_id
                 FROM shifts
                 WHERE fim_turno IS NULL
                 ORDER BY data_turno DESC, inicio_turno DESC;
@@ -672,6 +1702,7 @@ class DatabaseManager:
             active_shifts = []
             for row in self.cursor.fetchall():
                 active_shifts.append({
+                    'device_id': row[4],
                     'turno_nome': row[0],
                     'data_turno': row[1].strftime('%Y-%m-%d'),
                     'contador': row[2],
@@ -682,50 +1713,82 @@ class DatabaseManager:
             print(f"[ERRO] Erro ao obter turnos ativos: {e}")
             return []
 
-    def get_losses_history(self, hours=24):
+    def get_losses_history(self, hours=24, device_id=None):
         """Obtém o histórico de perdas das últimas N horas."""
+        return self.get_losses_page(hours=hours, limit=50, device_id=device_id)[0]
+
+    def get_losses_page(self, after=None, limit=50, hours=None, device_id=None):
+        """Perdas da mais recente para a mais antiga, paginadas por (data_evento, id).
+
+        after: chave da última perda da página anterior (None = primeira página).
+        hours: limita às últimas N horas (None = todo o histórico).
+        Retorna (perdas, chave da próxima página ou None).
+        """
         try:
             self.cursor.execute(
                 """
-                SELECT p.quantidade, p.motivo, p.data_evento, s.turno_nome, s.data_turno
+                SELECT p.quantidade, p.motivo, p.data_evento, s.turno_nome, s.data_turno, s.device_id, p.id
                 FROM perdas p
                 JOIN shifts s ON p.shift_id = s.id
-                WHERE p.data_evento >= NOW() - INTERVAL '%s hours'
-                ORDER BY p.data_evento DESC
-                LIMIT 50;
+                WHERE p.data_evento IS NOT NULL
+                  AND (%(hours)s::int IS NULL OR p.data_evento >= LOCALTIMESTAMP - %(hours)s::int * INTERVAL '1 hour')
+                  AND (%(data)s::timestamp IS NULL OR (p.data_evento, p.id) < (%(data)s::timestamp, %(id)s))
+                  AND (%(device_id)s::varchar IS NULL OR s.device_id = %(device_id)s)
+                ORDER BY p.data_evento DESC, p.id DESC
+                LIMIT %(limit)s;
                 """,
-                (hours,)
+                {'hours': hours, 'data': after[0] if after else None, 'id': after[1] if after else 0,
+                 'device_id': device_id, 'limit': limit + 1}
             )
+            rows, next_key = split_page(self.cursor.fetchall(), limit, lambda r: (r[2], r[6]))
             losses = []
-            for row in self.cursor.fetchall():
+            for row in rows:
                 losses.append({
+                    'id': row[6],
                     'quantidade': row[0],
                     'motivo': row[1],
                     'data_evento': row[2].isoformat() if row[2] else None,
                     'turno_nome': row[3],
-                    'data_turno': row[4].strftime('%d/%m/%Y') if row[4] else None
+                    'data_turno': row[4].strftime('%d/%m/%Y') if row[4] else None,
+                    'device_id': row[5]
                 })
-            return losses
+            return losses, next_key
         except Exception as e:
             print(f"[ERRO] Erro ao obter histórico de perdas: {e}")
-            return []
+            self.conn.rollback()
+            return [], None
 
-    def get_performance_data(self, period='day', mode='total'):
+    def get_performance_data(self, period='day', mode='total', device_id=None, inicio=None, fim=None):
         """
         Agrega dados de produção e perdas por período, com filtro opcional por turno.
         mode: 'total', 'turno1', 'turno2', 'ambos'
+        device_id: restringe a um dispositivo (None = planta inteira)
+        inicio/fim: datas limite dos buckets (padrão: último ano até hoje)
         """
         try:
             # Valida o período para evitar SQL Injection
             if period not in ['day', 'week', 'month', 'year']:
                 period = 'day'
 
-            # Constrói a query dinamicamente
-            where_clauses = [sql.SQL("data_turno >= CURRENT_DATE - INTERVAL '1 year'")]
+            # Constrói a query dinamicamente sobre o rollup da granularidade pedida
+            where_clauses = [sql.SQL("granularidade = %s")]
+            params = [period]
+            if inicio is None:
+                where_clauses.append(sql.SQL("period_start >= date_trunc(%s, CURRENT_DATE - INTERVAL '1 year')::date"))
+                params.append(period)
+            else:
+                where_clauses.append(sql.SQL("period_start >= date_trunc(%s, %s::date)::date"))
+                params.extend([period, inicio])
+            if fim is not None:
+                where_clauses.append(sql.SQL("period_start <= %s"))
+                params.append(fim)
+            if device_id is not None:
+                where_clauses.append(sql.SQL("device_id = %s"))
+                params.append(device_id)
             grouping_fields = []
             select_fields = [
-                sql.SQL("date_trunc(%s, data_turno) AS period_start"),
-                sql.SQL("SUM(contador) AS total_producao"),
+                sql.SQL("period_start::timestamp AS period_start"),
+                sql.SQL("SUM(producao) AS total_producao"),
                 sql.SQL("SUM(perdas) AS total_perdas")
             ]
 
@@ -739,7 +1802,7 @@ class DatabaseManager:
 
             query = sql.SQL("""
                 SELECT {select_fields}
-                FROM shifts
+                FROM rollup_producao
                 WHERE {where_conditions}
                 GROUP BY period_start {grouping_fields}
                 ORDER BY period_start ASC, {order_by_group};
@@ -750,8 +1813,8 @@ class DatabaseManager:
                 order_by_group=sql.SQL(', ').join(grouping_fields) if grouping_fields else sql.SQL("period_start")
             )
 
-            # Usa date_trunc para agrupar por período
-            self.cursor.execute(query, (period,))
+            # Cada linha do rollup já é um bucket do período
+            self.cursor.execute(query, params)
             
             results = []
             for row in self.cursor.fetchall():
@@ -770,5 +1833,417 @@ class DatabaseManager:
             self.conn.rollback()
             return []
 
+    # ========== PARADAS ==========
+    def get_shift_progress_by_device(self, turno_nome, data_turno, seen_since):
+        """Retorna {device_id: (contador, meta_turno)} do turno para os dispositivos ativos.
+
+        Inclui dispositivos vistos desde 'seen_since' que ainda não contaram no turno
+        (contador 0), para que uma linha parada desde o início também seja detectada.
+        """
+        try:
+            self.cursor.execute(
+                """
+                SELECT COALESCE(t.device_id, d.device_id), COALESCE(t.contador, 0),
+                       COALESCE(t.meta_turno, mp.meta)
+                FROM (
+                    SELECT s.device_id, s.contador, m.meta_turno
+                    FROM shifts s
+                    LEFT JOIN metas m ON m.shift_id = s.id
+                    WHERE s.turno_nome = %(turno_nome)s AND s.data_turno = %(data_turno)s
+                ) t
+                FULL JOIN (SELECT device_id FROM devices WHERE last_seen >= %(seen_since)s) d
+                       ON d.device_id = t.device_id
+                LEFT JOIN metas_p_turno mp ON mp.turno_nome = %(turno_nome)s
+                """,
+                {'turno_nome': turno_nome, 'data_turno': data_turno, 'seen_since': seen_since}
+            )
+            return {row[0]: (int(row[1]), row[2]) for row in self.cursor.fetchall()}
+        except Exception as e:
+            print(f"[ERRO] get_shift_progress_by_device: {e}")
+            self.conn.rollback()
+            return {}
+
+    def open_stop(self, device_id, turno_nome, data_turno, inicio):
+        """Registra o início de uma parada e retorna o id (None em caso de erro)."""
+        try:
+            self.cursor.execute(
+                "INSERT INTO paradas (device_id, turno_nome, data_turno, inicio) VALUES (%s, %s, %s, %s) RETURNING id",
+                (device_id, turno_nome, data_turno, inicio)
+            )
+            stop_id = self.cursor.fetchone()[0]
+            self.conn.commit()
+            return stop_id
+        except Exception as e:
+            print(f"[ERRO] open_stop: {e}")
+            self.conn.rollback()
+            return None
+
+    def close_stop(self, stop_id, fim):
+        """Registra o fim de uma parada em andamento."""
+        try:
+            self.cursor.execute("UPDATE paradas SET fim = %s WHERE id = %s AND fim IS NULL", (fim, stop_id))
+            self.conn.commit()
+            return True
+        except Exception as e:
+            print(f"[ERRO] close_stop: {e}")
+            self.conn.rollback()
+            return False
+
+    def get_open_stops(self, turno_nome, data_turno):
+        """Paradas em andamento do turno: {device_id: (id, inicio)}.
+
+        Paradas abertas de turnos anteriores (servidor fora do ar na troca de turno)
+        são encerradas no fim do respectivo turno.
+        """
+        try:
+            self.cursor.execute(
+                """
+                UPDATE paradas p
+                SET fim = GREATEST(p.inicio, COALESCE(
+                    (SELECT MAX(s.fim_turno) FROM shifts s
+                     WHERE s.turno_nome = p.turno_nome AND s.data_turno = p.data_turno), NOW()))
+                WHERE p.fim IS NULL AND NOT (p.turno_nome = %s AND p.data_turno = %s)
+                """,
+                (turno_nome, data_turno)
+            )
+            self.cursor.execute(
+                "SELECT device_id, id, inicio FROM paradas WHERE fim IS NULL AND turno_nome = %s AND data_turno = %s",
+                (turno_nome, data_turno)
+            )
+            open_stops = {row[0]: (row[1], row[2]) for row in self.cursor.fetchall()}
+            self.conn.commit()
+            return open_stops
+        except Exception as e:
+            print(f"[ERRO] get_open_stops: {e}")
+            self.conn.rollback()
+            return {}
+
+    def get_stops(self, hours=24, device_id=None):
+        """Paradas iniciadas nas últimas N horas, mais recentes primeiro (duração em segundos)."""
+        try:
+            self.cursor.execute(
+                """
+                SELECT p.id, p.device_id, d.nome, d.linha, p.turno_nome, p.data_turno, p.inicio, p.fim,
+                       EXTRACT(EPOCH FROM COALESCE(p.fim, LOCALTIMESTAMP) - p.inicio)
+                FROM paradas p
+                LEFT JOIN devices d ON d.device_id = p.device_id
+                WHERE p.inicio >= LOCALTIMESTAMP - %s * INTERVAL '1 hour'
+                  AND (%s::varchar IS NULL OR p.device_id = %s)
+                ORDER BY p.inicio DESC
+                LIMIT 200
+                """,
+                (hours, device_id, device_id)
+            )
+            return [{
+                'id': row[0],
+                'device_id': row[1],
+                'nome': row[2],
+                'linha': row[3],
+                'turno_nome': row[4],
+                'data_turno': row[5].isoformat() if row[5] else None,
+                'inicio': row[6].isoformat() if row[6] else None,
+                'fim': row[7].isoformat() if row[7] else None,
+                'duracao_s': int(row[8] or 0)
+            } for row in self.cursor.fetchall()]
+        except Exception as e:
+            print(f"[ERRO] get_stops: {e}")
+            self.conn.rollback()
+            return []
+
+    def try_leader_lock(self, key):
+        """Tenta assumir a liderança de uma tarefa entre os workers (advisory lock de sessão).
+
+        Retorna a conexão dedicada que mantém o lock (a liderança dura enquanto ela
+        estiver aberta) ou None se outro worker já é o líder.
+        """
+        conn = self._checkout()
+        try:
+            with conn.cursor() as cur:
+                cur.execute("SELECT pg_try_advisory_lock(%s)", (key,))
+                acquired = cur.fetchone()[0]
+            conn.commit()
+        except Exception as e:
+            print(f"[ERRO] try_leader_lock: {e}")
+            self._checkin(conn, discard=True)
+            return None
+        if not acquired:
+            self._checkin(conn)
+            return None
+        return conn
+
+    def leader_alive(self, conn):
+        """Confirma que a conexão do líder (e portanto o lock) continua ativa; senão a descarta."""
+        try:
+            with conn.cursor() as cur:
+                cur.execute("SELECT 1")
+            conn.commit()
+            return True
+        except Exception as e:
+            print(f"[INFO] Conexão do líder perdida: {e}")
+            self._checkin(conn, discard=True)
+            return False
+
+    # ========== RECONCILIAÇÃO COM O DISPOSITIVO ==========
+    def get_device_shift_totals(self, device_id, inicio, fim):
+        """[(data_turno, turno_nome, contador)] do dispositivo entre as datas (inclusive).
+
+        Usa idx_shifts_device_data_id: o custo é proporcional ao intervalo pedido, não à tabela.
+        Retorna None em caso de erro (o chamador responde 503, sem marcar diferenças).
+        """
+        try:
+            self.cursor.execute(
+                """
+                SELECT data_turno, turno_nome, contador FROM shifts
+                WHERE device_id = %s AND data_turno BETWEEN %s AND %s
+                """,
+                (device_id, inicio, fim)
+            )
+            return self.cursor.fetchall()
+        except Exception as e:
+            print(f"[ERRO] get_device_shift_totals: {e}")
+            self.conn.rollback()
+            return None
+
+    def merge_device_shift_totals(self, device_id, totals):
+        """Aplica os totais por turno guardados na flash do dispositivo, mantendo o maior valor.
+
+        totals: [(data_turno, turno_nome, contador)] de turnos já encerrados no dispositivo.
+        Turnos que o servidor não conhecia são criados já encerrados (com a meta padrão).
+        Retorna o número de turnos corrigidos ou None em caso de erro.
+        """
+        if not totals:
+            return 0
+        try:
+            self.cursor.execute(
+                """
+                WITH dados AS (
+                    SELECT * FROM unnest(%s::date[], %s::text[], %s::int[]) AS d(data_turno, turno_nome, contador)
+                )
+                INSERT INTO shifts (device_id, turno_nome, data_turno, contador, fim_turno)
+                SELECT %s, turno_nome, data_turno, contador, NOW() FROM dados
+                ON CONFLICT (device_id, turno_nome, data_turno) DO UPDATE
+                SET contador = EXCLUDED.contador
+                WHERE shifts.contador IS NULL OR shifts.contador < EXCLUDED.contador
+                RETURNING id, turno_nome, (xmax = 0) AS inserido
+                """,
+                ([t[0] for t in totals], [t[1] for t in totals], [int(t[2]) for t in totals], device_id)
+            )
+            rows = self.cursor.fetchall()
+            for shift_id, turno_nome, inserido in rows:
+                if inserido:
+                    self._apply_default_goal(shift_id, turno_nome)
+            self.conn.commit()
+            return len(rows)
+        except Exception as e:
+            print(f"[ERRO] merge_device_shift_totals ({device_id}): {e}")
+            self.conn.rollback()
+            return None
+
+    # ========== RETENÇÃO ==========
+    # Expurgo em lotes: filtro de idade por tabela (só registros encerrados)
+    RETENTION_DELETES = {
+        'shifts': "data_turno < %s AND fim_turno IS NOT NULL",
+        'paradas': "inicio < %s AND fim IS NOT NULL",
+    }
+
+    def list_production_partitions(self):
+        """Partições de producao_minuto: [(nome, inicio, fim)] em ordem cronológica."""
+        try:
+            self.cursor.execute("""
+                SELECT c.relname FROM pg_inherits i
+                JOIN pg_class c ON c.oid = i.inhrelid
+                WHERE i.inhparent = 'producao_minuto'::regclass
+                ORDER BY c.relname
+            """)
+            partitions = []
+            for (name,) in self.cursor.fetchall():
+                suffix = name.rsplit('_', 1)[-1]
+                if len(suffix) != 6 or not suffix.isdigit():
+                    continue
+                start = datetime(int(suffix[:4]), int(suffix[4:]), 1)
+                partitions.append((name, start, self._month_start(start + timedelta(days=32))))
+            self.conn.commit()
+            return partitions
+        except Exception as e:
+            print(f"[ERRO] list_production_partitions: {e}")
+            self.conn.rollback()
+            return []
+
+    def rollup_production_partition(self, name, lock_timeout_ms=500):
+        """Resume a partição mensal 'name' em producao_hora e a desanexa, numa única transação.
+
+        Leitores veem o mês ou na série por minuto ou no resumo por hora, nunca nos
+        dois. Os locks são pedidos com lock_timeout: se a ingestão estiver usando a
+        tabela, desiste (retorna None) e tenta na próxima execução em vez de
+        enfileirar as escritas atrás de si. Retorna o número de horas gravadas.
+        """
+        try:
+            self.cursor.execute("SET LOCAL lock_timeout = %s", (f"{int(lock_timeout_ms)}ms",))
+            # Congela a partição (mês antigo: normalmente ninguém escreve nela)
+            self.cursor.execute(sql.SQL("LOCK TABLE {} IN SHARE MODE").format(sql.Identifier(name)))
+            self.cursor.execute(
+                sql.SQL("""
+                    INSERT INTO producao_hora AS h (device_id, canal, hora, contagem)
+                    SELECT device_id, canal, date_trunc('hour', minuto), SUM(contagem)
+                    FROM {}
+                    GROUP BY 1, 2, 3
+                    ON CONFLICT (device_id, canal, hora) DO UPDATE
+                    SET contagem = h.contagem + EXCLUDED.contagem
+                """).format(sql.Identifier(name))
+            )
+            horas = self.cursor.rowcount
+            self.cursor.execute(
+                sql.SQL("ALTER TABLE producao_minuto DETACH PARTITION {}").format(sql.Identifier(name))
+            )
+            self.conn.commit()
+            self._partitions.discard(name.rsplit('_', 1)[-1])
+            return horas
+        except psycopg2.errors.LockNotAvailable:
+            print(f"[INFO] Partição {name} em uso; resumo adiado para a próxima execução.")
+            self.conn.rollback()
+            return None
+        except Exception as e:
+            print(f"[ERRO] rollup_production_partition({name}): {e}")
+            self.conn.rollback()
+            return None
+
+    def drop_detached_partitions(self):
+        """Remove as tabelas producao_minuto_AAAAMM já desanexadas (e resumidas). Retorna os nomes."""
+        try:
+            self.cursor.execute("""
+                SELECT c.relname FROM pg_class c
+                WHERE c.relkind = 'r' AND c.relnamespace = 'public'::regnamespace
+                  AND c.relname ~ '^producao_minuto_[0-9]{6}$'
+                  AND NOT c.relispartition
+            """)
+            names = [row[0] for row in self.cursor.fetchall()]
+            for name in names:
+                # DROP de uma tabela avulsa: sem DELETE linha a linha e sem VACUUM depois
+                self.cursor.execute(sql.SQL("DROP TABLE IF EXISTS {}").format(sql.Identifier(name)))
+                self.conn.commit()
+            return names
+        except Exception as e:
+            print(f"[ERRO] drop_detached_partitions: {e}")
+            self.conn.rollback()
+            return []
+
+    def purge_old_rows(self, tabela, limite, batch_size=1000):
+        """Apaga até batch_size registros encerrados de 'tabela' anteriores a 'limite'.
+
+        Em shifts, metas e perdas saem junto (CASCADE) e os rollups não são
+        descontados: o histórico agregado continua completo. Retorna o número de
+        registros apagados (0 = nada mais a expurgar) ou None em erro.
+        """
+        filtro = self.RETENTION_DELETES[tabela]
+        try:
+            self.cursor.execute("SET LOCAL kalfix.retencao = 'on'")
+            self.cursor.execute(
+                sql.SQL("""
+                    DELETE FROM {tabela} WHERE id IN (
+                        SELECT id FROM {tabela} WHERE {filtro} ORDER BY id LIMIT %s
+                    )
+                """).format(tabela=sql.Identifier(tabela), filtro=sql.SQL(filtro)),
+                (limite, batch_size)
+            )
+            apagados = self.cursor.rowcount
+            self.conn.commit()
+            return apagados
+        except Exception as e:
+            print(f"[ERRO] purge_old_rows({tabela}): {e}")
+            self.conn.rollback()
+            return None
+
+    # ========== EXPORTAÇÃO ==========
+    # Colunas de cada exportação: (nome, tipo) com tipo em int/str/date/timestamp
+    EXPORT_COLUMNS = {
+        'turnos': [('id', 'int'), ('device_id', 'str'), ('turno_nome', 'str'), ('data_turno', 'date'),
+                   ('inicio_turno', 'timestamp'), ('fim_turno', 'timestamp'), ('contador', 'int'),
+                   ('perdas', 'int'), ('meta_turno', 'int'), ('meta_dia', 'int')],
+        'perdas': [('id', 'int'), ('device_id', 'str'), ('turno_nome', 'str'), ('data_turno', 'date'),
+                   ('data_evento', 'timestamp'), ('quantidade', 'int'), ('motivo', 'str')],
+        'producao': [('device_id', 'str'), ('canal', 'int'), ('minuto', 'timestamp'), ('contagem', 'int')],
+    }
+
+    def _export_query(self, tipo, inicio, fim, device_id):
+        """SQL e parâmetros da exportação 'tipo' para as datas [inicio, fim] (inclusive)."""
+        inicio_ts = datetime.combine(inicio, datetime.min.time())
+        fim_ts = datetime.combine(fim, datetime.min.time()) + timedelta(days=1)
+        if tipo == 'turnos':
+            query = """
+                SELECT s.id, s.device_id, s.turno_nome, s.data_turno, s.inicio_turno, s.fim_turno,
+                       s.contador, s.perdas, m.meta_turno, m.meta_dia
+                FROM shifts s
+                LEFT JOIN metas m ON m.shift_id = s.id
+                WHERE s.data_turno >= %s AND s.data_turno <= %s
+            """
+            params = [inicio, fim]
+            device_col, order = 's.device_id', 's.data_turno, s.id'
+        elif tipo == 'perdas':
+            query = """
+                SELECT p.id, s.device_id, s.turno_nome, s.data_turno, p.data_evento, p.quantidade, p.motivo
+                FROM perdas p
+                JOIN shifts s ON s.id = p.shift_id
+                WHERE p.data_evento >= %s AND p.data_evento < %s
+            """
+            params = [inicio_ts, fim_ts]
+            device_col, order = 's.device_id', 'p.data_evento, p.id'
+        elif tipo == 'producao':
+            # Ordem da chave primária: cada partição é lida pelo índice, sem ordenação
+            query = """
+                SELECT device_id, canal, minuto, contagem
+                FROM producao_minuto
+                WHERE minuto >= %s AND minuto < %s
+            """
+            params = [inicio_ts, fim_ts]
+            device_col, order = 'device_id', 'device_id, canal, minuto'
+        else:
+            raise ValueError(f"exportação desconhecida: {tipo}")
+        if device_id is not None:
+            query += f" AND {device_col} = %s"
+            params.append(device_id)
+        return query + f" ORDER BY {order}", params
+
+    def iter_export(self, tipo, inicio, fim, device_id=None, chunk_size=5000):
+        """Gerador da exportação 'tipo': primeiro a lista de colunas, depois blocos de até chunk_size linhas.
+
+        Usa um cursor nomeado (no servidor) em uma conexão própria do pool, e não a
+        da requisição: a resposta continua sendo enviada depois do teardown do
+        Flask, e a memória fica constante seja qual for o tamanho da exportação.
+        """
+        query, params = self._export_query(tipo, inicio, fim, device_id)
+        conn = self._checkout()
+        discard = False
+        try:
+            with conn.cursor(name=f"export_{tipo}") as cur:
+                cur.itersize = chunk_size
+                cur.execute(query, params)
+                yield self.EXPORT_COLUMNS[tipo]
+                while True:
+                    rows = cur.fetchmany(chunk_size)
+                    if not rows:
+                        break
+                    yield rows
+        except GeneratorExit:
+            # Cliente desconectou no meio do download
+            raise
+        except Exception as e:
+            print(f"[ERRO] iter_export ({tipo}): {e}")
+            discard = True
+            raise
+        finally:
+            try:
+                if not conn.closed:
+                    conn.rollback()
+            except Exception:
+                discard = True
+            self._checkin(conn, discard)
+
+# Instrumenta os métodos de consulta: duração e erros por método em /metrics
+_NOT_TIMED = {'connect', 'disconnect', 'release', 'reset_connection', 'create_tables',
+              'in_failed_transaction', 'pool_stats', 'iter_export', 'try_leader_lock', 'leader_alive'}
+for _name, _fn in list(vars(DatabaseManager).items()):
+    if callable(_fn) and not _name.startswith('_') and _name not in _NOT_TIMED:
+        setattr(DatabaseManager, _name, timed_db(_fn))
+
 # Cria uma instância global do DatabaseManager
 db_manager = DatabaseManager()
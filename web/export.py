@@ -0,0 +1,85 @@
+# export.py
+"""Codificação em streaming das exportações de dados (CSV e Arrow).
+
+Recebe as colunas e o gerador de blocos de linhas de `DatabaseManager.iter_export`
+e produz os bytes da resposta bloco a bloco, sem montar o arquivo inteiro em memória.
+O formato colunar é o Arrow IPC stream (lido por pandas, Polars, DuckDB, Power BI
+via Python etc.); requer o pacote pyarrow.
+"""
+import csv
+import io
+
+FORMATS = {
+    'csv': ('text/csv; charset=utf-8', 'csv'),
+    'arrow': ('application/vnd.apache.arrow.stream', 'arrows'),
+}
+
+
+def arrow_available():
+    try:
+        import pyarrow  # noqa: F401
+        return True
+    except ImportError:
+        return False
+
+
+def csv_stream(columns, chunks):
+    """CSV com cabeçalho; um pedaço da resposta por bloco de linhas."""
+    buffer = io.StringIO()
+    writer = csv.writer(buffer)
+    writer.writerow([name for name, _ in columns])
+    yield buffer.getvalue().encode('utf-8')
+    for rows in chunks:
+        buffer.seek(0)
+        buffer.truncate()
+        writer.writerows(
+            [value.isoformat() if hasattr(value, 'isoformat') else value for value in row]
+            for row in rows
+        )
+        yield buffer.getvalue().encode('utf-8')
+
+
+class _Drain:
+    """Destino do writer Arrow: acumula os bytes escritos até serem enviados."""
+
+    def __init__(self):
+        self.parts = []
+        self.closed = False
+
+    def write(self, data):
+        self.parts.append(bytes(data))
+        return len(data)
+
+    def flush(self):
+        pass
+
+    def close(self):
+        self.closed = True
+
+    def take(self):
+        data = b''.join(self.parts)
+        self.parts = []
+        return data
+
+
+def arrow_stream(columns, chunks):
+    """Arrow IPC stream: um record batch por bloco de linhas."""
+    import pyarrow as pa
+    types = {'int': pa.int64(), 'str': pa.string(), 'date': pa.date32(), 'timestamp': pa.timestamp('us')}
+    schema = pa.schema([(name, types[kind]) for name, kind in columns])
+    sink = _Drain()
+    writer = pa.ipc.new_stream(sink, schema)
+    yield sink.take()
+    for rows in chunks:
+        arrays = [pa.array(list(values), type=field.type) for values, field in zip(zip(*rows), schema)]
+        writer.write_batch(pa.record_batch(arrays, schema=schema))
+        yield sink.take()
+    writer.close()
+    yield sink.take()
+
+
+def encode(formato, columns, chunks):
+    """Gerador dos bytes da exportação no formato pedido ('csv' ou 'arrow')."""
+    if formato == 'arrow':
+        return arrow_stream(columns, chunks)
+    return csv_stream(columns, chunks)
@@ -0,0 +1,28 @@
+# gunicorn.conf.py
+# Modo de produção: gunicorn -c gunicorn.conf.py wsgi:app
+#
+# Com mais de um worker:
+#   - SOCKETIO_MESSAGE_QUEUE deve apontar para um Redis (ex.: redis://localhost:6379/0),
+#     senão os emits de um worker não chegam aos clientes conectados nos outros;
+#   - SOCKETIO_WEBSOCKET_ONLY=true, pois o gunicorn não mantém sessão fixa por cliente
+#     e o long-polling do Socket.IO exige que todas as requisições caiam no mesmo worker.
+from config import Config
+
+bind = f"{Config.SERVER_HOST}:{Config.SERVER_PORT}"
+workers = Config.WEB_WORKERS
+worker_class = 'eventlet'
+worker_connections = 1000
+timeout = 30
+graceful_timeout = 10
+# O app é carregado depois do fork: nada de conexões ou tarefas compartilhadas entre processos
+preload_app = False
+
+if Config.SSL_ENABLED:
+    certfile = Config.SSL_CERT_FILE
+    keyfile = Config.SSL_KEY_FILE
+
+def on_starting(server):
+    if workers > 1 and not Config.SOCKETIO_MESSAGE_QUEUE:
+        server.log.warning("⚠️  %d workers sem SOCKETIO_MESSAGE_QUEUE: clientes só recebem eventos do próprio worker", workers)
+    if workers > 1 and not Config.SOCKETIO_WEBSOCKET_ONLY:
+        server.log.warning("⚠️  %d workers sem SOCKETIO_WEBSOCKET_ONLY: o long-polling do Socket.IO vai falhar", workers)
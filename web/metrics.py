@@ -0,0 +1,234 @@
+# metrics.py
+"""Métricas internas do servidor no formato texto do Prometheus (exposto em /metrics).
+
+Registro mínimo, sem dependências: contadores, gauges e histogramas com labels,
+seguros para threads/greenlets. Cada worker mantém os próprios valores; a primeira
+linha da saída (comentário) identifica o processo que respondeu a coleta.
+"""
+import os
+import threading
+import time
+import functools
+
+# Buckets padrão (segundos): de 1 ms a 10 s
+DEFAULT_BUCKETS = (0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0)
+# Atraso de ingestão: de 100 ms a 1 h (dispositivo offline acumulando contagem)
+LAG_BUCKETS = (0.1, 0.5, 1.0, 2.0, 5.0, 10.0, 30.0, 60.0, 300.0, 900.0, 3600.0)
+
+_registry = []
+_lock = threading.Lock()
+
+
+def _escape(value):
+    return str(value).replace('\\', '\\\\').replace('\n', '\\n').replace('"', '\\"')
+
+
+def _format_labels(names, values, extra=None):
+    pairs = list(zip(names, values))
+    if extra:
+        pairs.append(extra)
+    if not pairs:
+        return ''
+    return '{' + ','.join(f'{k}="{_escape(v)}"' for k, v in pairs) + '}'
+
+
+class _Metric:
+    kind = 'untyped'
+
+    def __init__(self, name, help_text, labels=()):
+        self.name = name
+        self.help = help_text
+        self.labels = tuple(labels)
+        self._values = {}
+        with _lock:
+            _registry.append(self)
+
+    def _key(self, labels):
+        return tuple(str(labels.get(l, '')) for l in self.labels)
+
+    def remove(self, **labels):
+        with _lock:
+            self._values.pop(self._key(labels), None)
+
+    def render(self):
+        lines = [f"# HELP {self.name} {self.help}", f"# TYPE {self.name} {self.kind}"]
+        with _lock:
+            items = list(self._values.items())
+        for key, value in items:
+            lines.append(f"{self.name}{_format_labels(self.labels, key)} {value:g}")
+        return lines
+
+
+class Counter(_Metric):
+    kind = 'counter'
+
+    def inc(self, amount=1, **labels):
+        key = self._key(labels)
+        with _lock:
+            self._values[key] = self._values.get(key, 0) + amount
+
+
+class Gauge(_Metric):
+    kind = 'gauge'
+
+    def set(self, value, **labels):
+        with _lock:
+            self._values[self._key(labels)] = value
+
+    def inc(self, amount=1, **labels):
+        key = self._key(labels)
+        with _lock:
+            self._values[key] = self._values.get(key, 0) + amount
+
+    def dec(self, amount=1, **labels):
+        self.inc(-amount, **labels)
+
+
+class CallbackGauge(_Metric):
+    """Gauge lido no momento da coleta (ex.: tamanho de uma fila)."""
+    kind = 'gauge'
+
+    def __init__(self, name, help_text, fn):
+        super().__init__(name, help_text)
+        self._fn = fn
+
+    def render(self):
+        try:
+            value = float(self._fn())
+        except Exception:
+            return []
+        return [f"# HELP {self.name} {self.help}", f"# TYPE {self.name} gauge", f"{self.name} {value:g}"]
+
+
+class Histogram(_Metric):
+    kind = 'histogram'
+
+    def __init__(self, name, help_text, labels=(), buckets=DEFAULT_BUCKETS):
+        super().__init__(name, help_text, labels)
+        self.buckets = tuple(sorted(buckets))
+
+    def observe(self, value, **labels):
+        key = self._key(labels)
+        with _lock:
+            state = self._values.get(key)
+            if state is None:
+                state = self._values[key] = [[0] * len(self.buckets), 0.0, 0]
+            for i, bound in enumerate(self.buckets):
+                if value <= bound:
+                    state[0][i] += 1
+                    break
+            state[1] += value
+            state[2] += 1
+
+    def render(self):
+        lines = [f"# HELP {self.name} {self.help}", f"# TYPE {self.name} histogram"]
+        with _lock:
+            items = [(k, (list(v[0]), v[1], v[2])) for k, v in self._values.items()]
+        for key, (counts, total, n) in items:
+            cumulative = 0
+            for bound, c in zip(self.buckets, counts):
+                cumulative += c
+                lines.append(f"{self.name}_bucket{_format_labels(self.labels, key, ('le', f'{bound:g}'))} {cumulative}")
+            lines.append(f"{self.name}_bucket{_format_labels(self.labels, key, ('le', '+Inf'))} {n}")
+            lines.append(f"{self.name}_sum{_format_labels(self.labels, key)} {total:g}")
+            lines.append(f"{self.name}_count{_format_labels(self.labels, key)} {n}")
+        return lines
+
+    def time(self, **labels):
+        """Context manager que observa a duração do bloco."""
+        return _Timer(self, labels)
+
+
+class _Timer:
+    def __init__(self, histogram, labels):
+        self.histogram = histogram
+        self.labels = labels
+
+    def __enter__(self):
+        self.start = time.perf_counter()
+        return self
+
+    def __exit__(self, *exc):
+        self.histogram.observe(time.perf_counter() - self.start, **self.labels)
+        return False
+
+
+def render():
+    """Todas as métricas registradas no formato texto do Prometheus."""
+    with _lock:
+        metrics = list(_registry)
+    lines = [f"# worker {os.getpid()}"]
+    for metric in metrics:
+        lines.extend(metric.render())
+    return '\n'.join(lines) + '\n'
+
+
+# ========== MÉTRICAS DA APLICAÇÃO ==========
+http_request_duration = Histogram('kalfix_http_request_duration_seconds',
+                                  'Duração das requisições HTTP por rota.',
+                                  ('route', 'method', 'status'))
+db_query_duration = Histogram('kalfix_db_query_duration_seconds',
+                              'Duração dos métodos do DatabaseManager.', ('method',))
+db_errors = Counter('kalfix_db_errors_total',
+                    'Chamadas do DatabaseManager que terminaram em erro (rollback/exceção).', ('method',))
+socketio_clients = Gauge('kalfix_socketio_connected_clients', 'Clientes Socket.IO conectados a este worker.')
+socketio_emits = Counter('kalfix_socketio_emits_total', 'Eventos Socket.IO emitidos.', ('event',))
+socketio_emit_duration = Histogram('kalfix_socketio_emit_duration_seconds',
+                                   'Tempo para montar e emitir um evento Socket.IO.', ('event',))
+device_last_seen = Gauge('kalfix_device_last_seen_timestamp_seconds',
+                         'Último contato de cada dispositivo (epoch).', ('device',))
+device_ingest_lag = Gauge('kalfix_device_ingest_lag_seconds',
+                          'Atraso da última leitura de cada dispositivo (recebimento - horário no dispositivo).',
+                          ('device',))
+ingest_lag = Histogram('kalfix_ingest_lag_seconds',
+                       'Atraso entre o evento no dispositivo e o recebimento no servidor.',
+                       buckets=LAG_BUCKETS)
+device_retries = Counter('kalfix_device_upload_retries_total',
+                         'Tentativas de envio que falharam no dispositivo antes de uma entrega.', ('device',))
+updates_received = Counter('kalfix_updates_total', 'Requisições /update por resultado.', ('result',))
+device_events = Counter('kalfix_device_events_total', 'Eventos de dispositivos recebidos em /ingest.', ('tipo', 'via'))
+sync_buckets = Counter('kalfix_sync_buckets_total',
+                       'Faixas de 7 dias comparadas na reconciliação com a flash dos dispositivos.', ('result',))
+sync_corrections = Counter('kalfix_sync_corrections_total',
+                           'Turnos corrigidos no banco com o total guardado no dispositivo.', ('device',))
+alerts = Counter('kalfix_alerts_total', 'Alertas de parada/lentidão emitidos.', ('tipo',))
+export_rows = Counter('kalfix_export_rows_total', 'Linhas enviadas pelas exportações.', ('tipo', 'formato'))
+retention_rows = Counter('kalfix_retention_rows_total', 'Registros expurgados pela retenção.', ('tabela',))
+retention_partitions = Counter('kalfix_retention_partitions_total',
+                               'Partições da série por minuto resumidas em hora e removidas.', ('acao',))
+retention_runs = Counter('kalfix_retention_runs_total', 'Execuções da retenção por resultado.', ('result',))
+retention_pending = Gauge('kalfix_retention_pending_partitions',
+                          'Partições fora do prazo de retenção ainda não resumidas (lock não obtido).')
+retention_last_success = Gauge('kalfix_retention_last_success_timestamp_seconds',
+                               'Fim da última execução completa da retenção.')
+
+
+def timed_db(method):
+    """Decorator: mede a duração de um método do DatabaseManager e conta os erros.
+
+    Os métodos tratam as próprias exceções (rollback e valor padrão), então um erro
+    é detectado pelo rollback feito durante a chamada, por uma transação deixada
+    em estado de erro ou por uma exceção que escape.
+    """
+    name = method.__name__
+
+    @functools.wraps(method)
+    def wrapper(self, *args, **kwargs):
+        local = self._local
+        outer_failed = getattr(local, 'failed', False)
+        local.failed = False
+        start = time.perf_counter()
+        try:
+            result = method(self, *args, **kwargs)
+        except Exception:
+            local.failed = True
+            raise
+        finally:
+            db_query_duration.observe(time.perf_counter() - start, method=name)
+            failed = local.failed or self.in_failed_transaction()
+            if failed:
+                db_errors.inc(method=name)
+            # Chamadas aninhadas propagam o erro para o método externo
+            local.failed = outer_failed or failed
+        return result
+    return wrapper
@@ -0,0 +1,55 @@
+# pagination.py
+"""Paginação por chave (keyset) dos históricos de turnos e perdas.
+
+Em vez de OFFSET, cada página continua de onde a anterior parou: o cliente devolve o
+cursor recebido e a consulta pede só as linhas abaixo dele, na ordem do índice
+composto (`shifts(data_turno, id)`, `perdas(data_evento, id)`). O custo de cada
+página é o mesmo, seja a primeira ou a milésima.
+
+O cursor é opaco para o cliente: base64 (URL) de "valor|id", onde valor é a data ou
+o timestamp ISO da última linha entregue e id desempata linhas com o mesmo valor.
+"""
+import base64
+import binascii
+from datetime import date
+
+DEFAULT_LIMIT = 20
+MAX_LIMIT = 200
+
+
+def encode_cursor(value, row_id=0):
+    raw = f"{value.isoformat()}|{int(row_id)}".encode()
+    return base64.urlsafe_b64encode(raw).decode().rstrip('=')
+
+
+def decode_cursor(text, kind=date):
+    """(valor, id) do cursor, com valor convertido por `kind` (date ou datetime).
+
+    None se não há cursor (primeira página); ValueError se mal formado.
+    """
+    if not text:
+        return None
+    try:
+        raw = base64.urlsafe_b64decode(text + '=' * (-len(text) % 4)).decode()
+        value, _, row_id = raw.partition('|')
+        return kind.fromisoformat(value), int(row_id)
+    except (binascii.Error, UnicodeDecodeError, ValueError) as e:
+        raise ValueError(f'cursor inválido: {e}')
+
+
+def page_limit(value, default=DEFAULT_LIMIT):
+    """Tamanho da página pedido, limitado a 1..MAX_LIMIT."""
+    if value is None:
+        return default
+    return max(1, min(int(value), MAX_LIMIT))
+
+
+def split_page(rows, limit, key):
+    """Separa a linha extra (consulta com LIMIT limit + 1) e devolve a chave da próxima página.
+
+    `key(row)` dá (valor, id) da linha; a próxima página começa abaixo da última entregue.
+    """
+    if len(rows) <= limit:
+        return rows, None
+    rows = rows[:limit]
+    return rows, key(rows[-1])
@@ -0,0 +1,108 @@
+# reconcile.py
+"""Reconciliação (anti-entropia) dos totais por turno entre a flash do dispositivo e `shifts`.
+
+O firmware guarda na flash o total de cada turno encerrado (últimos ~30 dias). De
+tempos em tempos ele envia um resumo por faixa de 7 dias: um hash FNV-1a (32 bits) do
+texto canônico dos totais da faixa. O servidor calcula o mesmo hash a partir de
+`shifts` (só as linhas do dispositivo no intervalo) e devolve as faixas diferentes.
+Apenas essas faixas trafegam por completo. Os dois lados ficam com o maior valor de
+cada turno: o contador é acumulado e só se perde contagem, nunca sobra.
+
+Texto canônico de uma faixa: "AAAAMMDD.T:total;" por turno com total > 0, em ordem
+de (data, turno), sem o turno ainda aberto no dispositivo. T é 1 ou 2 e a data é a
+do início do turno (o Turno 2 da madrugada pertence ao dia anterior).
+
+Com a flash cheia, o dispositivo informa o turno mais antigo que ainda guarda
+(`from`): os turnos anteriores a ele ficam fora do texto, senão a faixa mais antiga
+(só em parte no dispositivo) seria diferente em toda rodada.
+"""
+from datetime import date, timedelta
+
+FNV_OFFSET = 0x811C9DC5
+FNV_PRIME = 0x01000193
+BUCKET_DAYS = 7
+EPOCH = date(1970, 1, 1)
+# Número do turno no firmware <-> turno_nome no banco
+SHIFT_NAMES = {1: 'Turno 1 (06:00 - 16:00 h)', 2: 'Turno 2 (22:00 - 06:00 h)'}
+SHIFT_NUMBERS = {name: number for number, name in SHIFT_NAMES.items()}
+# Hash de uma faixa sem nenhum turno
+EMPTY = FNV_OFFSET
+
+
+def fnv1a(data, h=FNV_OFFSET):
+    for byte in data:
+        h = ((h ^ byte) * FNV_PRIME) & 0xFFFFFFFF
+    return h
+
+
+def bucket_of(day):
+    return (day - EPOCH).days // BUCKET_DAYS
+
+
+def bucket_range(bucket):
+    """(primeiro dia, último dia) da faixa."""
+    inicio = EPOCH + timedelta(days=bucket * BUCKET_DAYS)
+    return inicio, inicio + timedelta(days=BUCKET_DAYS - 1)
+
+
+def parse_key(text):
+    """'AAAAMMDD.T' -> (date, T) ou None (ex.: '0.0' quando o dispositivo está fora de turno)."""
+    try:
+        dia, _, turno = text.partition('.')
+        turno = int(turno)
+        if turno not in SHIFT_NAMES or len(dia) != 8:
+            return None
+        return date(int(dia[:4]), int(dia[4:6]), int(dia[6:])), turno
+    except (TypeError, ValueError):
+        return None
+
+
+def parse_digests(text):
+    """'faixa:hash_hex,...' -> {faixa: hash}. ValueError se mal formado."""
+    digests = {}
+    for item in filter(None, (text or '').split(',')):
+        bucket, _, value = item.partition(':')
+        digests[int(bucket)] = int(value, 16)
+    return digests
+
+
+def parse_totals(text):
+    """'AAAAMMDD.T:total,...' -> {(date, T): total}. ValueError se mal formado."""
+    totals = {}
+    for item in filter(None, (text or '').split(',')):
+        key, _, total = item.partition(':')
+        parsed = parse_key(key)
+        if parsed is None:
+            raise ValueError(f'turno inválido: {key}')
+        totals[parsed] = int(total)
+    return totals
+
+
+def _entries(rows, exclude=None, start=None):
+    """Linhas (data_turno, turno_nome, contador) do banco -> [(date, T, total)] ordenadas.
+
+    exclude: turno aberto no dispositivo; start: (date, T) mais antigo que ele guarda.
+    """
+    entries = []
+    for data_turno, turno_nome, contador in rows:
+        turno = SHIFT_NUMBERS.get(turno_nome)
+        if turno is None or not contador or (data_turno, turno) == exclude:
+            continue
+        if start is not None and (data_turno, turno) < start:
+            continue
+        entries.append((data_turno, turno, int(contador)))
+    entries.sort()
+    return entries
+
+
+def digests(rows, exclude=None, start=None):
+    """{faixa: hash} das linhas do banco (mesmo texto canônico do firmware)."""
+    result = {}
+    for day, turno, total in _entries(rows, exclude, start):
+        bucket = bucket_of(day)
+        result[bucket] = fnv1a(f"{day:%Y%m%d}.{turno}:{total};".encode(), result.get(bucket, FNV_OFFSET))
+    return result
+
+
+def format_totals(rows, exclude=None, start=None):
+    return ','.join(f"{day:%Y%m%d}.{turno}:{total}" for day, turno, total in _entries(rows, exclude, start))
@@ -0,0 +1,97 @@
+# retention.py
+"""Retenção do histórico: detalhe por N dias, resumos depois disso.
+
+Políticas (Config, 0 = manter para sempre):
+- série por minuto (producao_minuto): após RETENTION_MINUTE_DAYS, cada partição
+  mensal inteira é resumida em producao_hora e desanexada na mesma transação;
+  depois a tabela é removida com DROP (sem DELETE linha a linha nem VACUUM);
+- turnos (shifts, com metas e perdas): após RETENTION_SHIFT_DAYS, expurgados em
+  lotes pequenos. Os rollups por dia/semana/mês/ano e por motivo de perda não são
+  descontados, então os gráficos e agregados continuam cobrindo todo o período;
+- paradas: após RETENTION_STOP_DAYS, expurgadas em lotes.
+
+A ingestão nunca espera pela retenção: cada lote é uma transação curta, há uma
+pausa cooperativa entre lotes, e a troca de partição usa lock_timeout (se a tabela
+estiver ocupada, tenta de novo na próxima execução).
+"""
+import time
+from datetime import datetime, timedelta
+
+import metrics
+
+
+class RetentionJob:
+    def __init__(self, db, config, sleep):
+        self.db = db
+        self.minute_days = config.RETENTION_MINUTE_DAYS
+        self.row_days = {'shifts': config.RETENTION_SHIFT_DAYS, 'paradas': config.RETENTION_STOP_DAYS}
+        self.batch_rows = config.RETENTION_BATCH_ROWS
+        self.lock_timeout_ms = config.RETENTION_LOCK_TIMEOUT_MS
+        # Espera cooperativa entre lotes (socketio.sleep)
+        self.sleep = sleep
+        self.pause_s = 0.05
+
+    def run_once(self, now=None):
+        """Aplica todas as políticas uma vez; retorna um resumo do que foi feito."""
+        now = now or datetime.now()
+        summary = {'horas_resumidas': 0, 'particoes_removidas': [], 'adiadas': 0, 'registros': {}}
+        if self.minute_days > 0:
+            self._production(now - timedelta(days=self.minute_days), summary)
+        for tabela, days in self.row_days.items():
+            if days > 0:
+                summary['registros'][tabela] = self._purge(tabela, now - timedelta(days=days))
+        return summary
+
+    def _production(self, limite, summary):
+        # Só meses inteiramente anteriores ao limite
+        antigas = [name for name, _, fim in self.db.list_production_partitions() if fim <= limite]
+        adiadas = 0
+        for name in antigas:
+            horas = self.db.rollup_production_partition(name, self.lock_timeout_ms)
+            self.db.release()
+            if horas is None:
+                adiadas += 1
+                continue
+            summary['horas_resumidas'] += horas
+            metrics.retention_partitions.inc(acao='resumida')
+            print(f"[OK] Retenção: {name} resumida em {horas} hora(s) e desanexada.")
+            self.sleep(self.pause_s)
+        # Inclui tabelas desanexadas por execuções interrompidas antes do DROP
+        removidas = self.db.drop_detached_partitions()
+        self.db.release()
+        for name in removidas:
+            metrics.retention_partitions.inc(acao='removida')
+            print(f"[OK] Retenção: tabela {name} removida.")
+        summary['particoes_removidas'] = removidas
+        summary['adiadas'] = adiadas
+        metrics.retention_pending.set(adiadas)
+
+    def _purge(self, tabela, limite):
+        total = 0
+        while True:
+            apagados = self.db.purge_old_rows(tabela, limite, self.batch_rows)
+            self.db.release()
+            if not apagados:
+                break
+            total += apagados
+            metrics.retention_rows.inc(apagados, tabela=tabela)
+            self.sleep(self.pause_s)
+        if total:
+            print(f"[OK] Retenção: {total} registro(s) de '{tabela}' anteriores a {limite:%Y-%m-%d} expurgados.")
+        return total
+
+    def run(self):
+        """Execução agendada: registra resultado e horário nas métricas."""
+        start = time.time()
+        try:
+            summary = self.run_once()
+        except Exception as e:
+            metrics.retention_runs.inc(result='erro')
+            print(f"[ERRO] Retenção: {e}")
+            return None
+        finally:
+            self.db.release()
+        metrics.retention_runs.inc(result='ok')
+        metrics.retention_last_success.set(time.time())
+        print(f"[INFO] Retenção concluída em {time.time() - start:.1f} s: {summary}")
+        return summary
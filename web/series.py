@@ -0,0 +1,86 @@
+# series.py
+"""Séries para os gráficos do dashboard (/metrics/series).
+
+Converte as linhas de `get_performance_data` em pontos (um por bucket), reduz séries
+longas ao orçamento de pontos do gráfico com LTTB (Largest-Triangle-Three-Buckets) e
+gera a versão usada pelo cliente para saber se algo mudou.
+
+O LTTB escolhe buckets reais (não altera valores): picos e vales da produção são
+preservados, e o primeiro e o último bucket (o período em andamento) sempre ficam.
+"""
+import hashlib
+import json
+from datetime import datetime
+
+TURNO_1_PREFIX = 'Turno 1'
+TURNO_2_PREFIX = 'Turno 2'
+
+
+def to_points(rows, mode):
+    """Um ponto por period_start. No modo 'ambos', T1 e T2 viram campos do mesmo ponto."""
+    if mode != 'ambos':
+        return [{'x': r['period_start'], 'producao': r['total_producao'], 'perdas': r['total_perdas']}
+                for r in rows]
+    points = {}
+    for r in rows:
+        p = points.setdefault(r['period_start'], {'x': r['period_start'], 't1_producao': 0, 't1_perdas': 0,
+                                                  't2_producao': 0, 't2_perdas': 0})
+        turno = (r.get('turno_nome') or '')
+        prefix = 't1' if turno.startswith(TURNO_1_PREFIX) else 't2' if turno.startswith(TURNO_2_PREFIX) else None
+        if prefix:
+            p[f'{prefix}_producao'] += r['total_producao']
+            p[f'{prefix}_perdas'] += r['total_perdas']
+    return [points[x] for x in sorted(points)]
+
+
+def weight(point):
+    """Valor usado para escolher os pontos: produção (soma dos turnos no modo 'ambos')."""
+    if 'producao' in point:
+        return point['producao']
+    return point['t1_producao'] + point['t2_producao']
+
+
+def lttb_indices(xs, ys, threshold):
+    """Índices escolhidos pelo LTTB para reduzir (xs, ys) a 'threshold' pontos."""
+    n = len(ys)
+    if threshold >= n or threshold < 3:
+        return list(range(n))
+    every = (n - 2) / (threshold - 2)
+    selected = [0]
+    a = 0
+    for i in range(threshold - 2):
+        # Média do próximo bucket (terceiro vértice do triângulo)
+        avg_start = int((i + 1) * every) + 1
+        avg_end = min(int((i + 2) * every) + 1, n)
+        avg_len = avg_end - avg_start
+        avg_x = sum(xs[avg_start:avg_end]) / avg_len
+        avg_y = sum(ys[avg_start:avg_end]) / avg_len
+        # Ponto do bucket atual que forma o maior triângulo com 'a' e a média
+        range_start = int(i * every) + 1
+        range_end = int((i + 1) * every) + 1
+        best_area = -1.0
+        best = range_start
+        for j in range(range_start, range_end):
+            area = abs((xs[a] - avg_x) * (ys[j] - ys[a]) - (xs[a] - xs[j]) * (avg_y - ys[a]))
+            if area > best_area:
+                best_area = area
+                best = j
+        selected.append(best)
+        a = best
+    selected.append(n - 1)
+    return selected
+
+
+def downsample(points, budget):
+    """Reduz a série a no máximo 'budget' pontos (inalterada se já couber)."""
+    if budget >= len(points):
+        return points
+    xs = [datetime.fromisoformat(p['x']).timestamp() for p in points]
+    ys = [weight(p) for p in points]
+    return [points[i] for i in lttb_indices(xs, ys, budget)]
+
+
+def version(points):
+    """Hash curto do conteúdo dos pontos (muda quando qualquer valor muda)."""
+    payload = json.dumps(points, sort_keys=True, separators=(',', ':')).encode('utf-8')
+    return hashlib.sha1(payload).hexdigest()[:12]
@@ -1,7 +1,15 @@
 # server.py
-from flask import Flask, render_template, request, jsonify
+from flask import Flask, render_template, request, jsonify, g, Response, make_response
 from flask_socketio import SocketIO
-from datetime import datetime, time, timedelta
+from datetime import date, datetime, time, timedelta
+from collections import namedtuple
+from time import perf_counter
+import threading
+import calendar
+import gzip
+import hashlib
+import random
+import re
 import sys
 import os
 
@@ -11,19 +19,108 @@ sys.path.append(os.path.dirname(os.path.abspath(__file__)))
 # Importa o db_manager que é uma instância da classe DatabaseManager
 from database import db_manager 
 from config import Config
+import metrics
+import export
+import series
+from analytics import StoppageDetector
+from retention import RetentionJob
+import versioning
+import reconcile
+import pagination
 
 app = Flask(__name__)
 app.config.from_object(Config)
-socketio = SocketIO(app, cors_allowed_origins="*")
+# Com SOCKETIO_MESSAGE_QUEUE definido, os emits de qualquer worker chegam a todos os clientes
+socketio = SocketIO(app, cors_allowed_origins="*",
+                    async_mode=Config.SOCKETIO_ASYNC_MODE,
+                    message_queue=Config.SOCKETIO_MESSAGE_QUEUE)
 
-# Variáveis globais para controle
-current_count = 0
-current_shift = None
-current_shift_key = None
+# Snapshot imutável do turno corrente. É derivado apenas do relógio, então cada
+# worker calcula o seu; é publicado pelo motor de turnos (troca atômica da referência)
+# e lido sem custo pelos handlers de requisição.
+ShiftSnapshot = namedtuple('ShiftSnapshot', ['name', 'date', 'key'])
+NO_SHIFT = ShiftSnapshot(None, None, None)
 
-def get_current_shift():
+shift_snapshot = NO_SHIFT
+# Os contadores (por dispositivo e da planta) vivem apenas no banco, para que vários
+# workers atendam os dispositivos e um reinício não perca a contagem. Em memória
+# ficam só caches locais do worker:
+# - último contato dos dispositivos ainda não persistido em `devices` (gravado em lote)
+pending_device_touch = {}
+# - dispositivos já cadastrados por este worker (evita um INSERT por requisição)
+known_devices = set()
+# Serializa as transições de turno e o acesso aos caches acima
+state_lock = threading.Lock()
+# Sinaliza que o status mudou e precisa ser difundido aos clientes
+status_dirty = threading.Event()
+
+# Horários em que o estado do turno pode mudar (início T1, fim T1, início T2)
+SHIFT_BOUNDARIES = (time(6, 0), time(16, 0), time(22, 0))
+# Teto do sono do motor: protege contra ajustes no relógio do sistema
+SHIFT_ENGINE_MAX_SLEEP_S = 60
+# Limite de buckets por consulta em /metrics/throughput
+MAX_THROUGHPUT_BUCKETS = 5000
+# Duração de cada turno (minutos), para o ritmo esperado a partir da meta
+SHIFT_MINUTES = {'Turno 1 (06:00 - 16:00 h)': 600, 'Turno 2 (22:00 - 06:00 h)': 480}
+# Advisory lock que elege o único worker que executa a detecção de paradas
+ANALYTICS_LOCK_KEY = 0x4B414C50  # 'KALP'
+# Advisory lock que elege o único worker que executa a retenção do histórico
+RETENTION_LOCK_KEY = 0x4B414C52  # 'KALR'
+# Dispositivos sem contato há mais que isso não entram na detecção de paradas
+ANALYTICS_DEVICE_WINDOW = timedelta(hours=24)
+# Itens por requisição em /admin/perdas
+MAX_LOSS_BATCH = 1000
+# Itens (contadores + eventos) por requisição em /ingest
+MAX_INGEST_BATCH = 500
+# Faixas de 7 dias por requisição em /sync/digest (o firmware guarda ~30 dias)
+MAX_SYNC_BUCKETS = 16
+# Orçamento de pontos em /metrics/series (padrão e teto)
+SERIES_DEFAULT_POINTS = 200
+SERIES_MAX_POINTS = 2000
+# Painéis por requisição em /api/batch e endpoints que podem compô-la (somente leitura)
+MAX_BATCH_PANELS = 16
+BATCH_ENDPOINTS = {'api_status', 'list_devices', 'get_losses_history', 'shift_history', 'metrics_shift',
+                   'metrics_aggregate', 'perdas_distribuicao', 'ranking_turnos', 'efficiency_series', 'metrics_throughput',
+                   'get_performance_data', 'metrics_series', 'metrics_paradas', 'debug_status'}
+# Dias por página da grade de histórico de turnos (dashboard e /historico/turnos)
+HISTORY_PAGE_DAYS = 10
+# Intervalo mínimo entre difusões de status: com centenas de contadores, as
+# atualizações de um mesmo intervalo são agrupadas em um único 'status'
+STATUS_BROADCAST_INTERVAL_S = 1.0
+# Intervalo de gravação em lote do último contato dos dispositivos
+DEVICE_TOUCH_INTERVAL_S = 5
+# IDs aceitos: o firmware envia o ID único da placa em hexadecimal
+DEVICE_ID_PATTERN = re.compile(r'^[A-Za-z0-9_.:-]{1,64}$')
+
+# Estado da detecção de paradas (apenas no worker líder)
+detector = StoppageDetector(Config.STOP_AFTER_S, Config.SLOW_RATIO, Config.RATE_TAU_S)
+
+# A ETag das respostas muda também com o turno corrente
+versioning.context = lambda: shift_snapshot.key
+# Página do dashboard renderizada uma única vez: (html, etag)
+dashboard_shell = None
+# Compressão: tipos de conteúdo e tamanho mínimo (bytes)
+COMPRESS_MIMETYPES = {'application/json', 'text/html', 'text/plain', 'text/csv', 'application/javascript'}
+COMPRESS_MIN_BYTES = 1024
+
+# Filas internas observadas em /metrics
+metrics.CallbackGauge('kalfix_pending_device_touch', 'Dispositivos com último contato aguardando gravação em lote.',
+                      lambda: len(pending_device_touch))
+metrics.CallbackGauge('kalfix_status_broadcast_pending', '1 se há uma difusão de status agendada.',
+                      lambda: 1 if status_dirty.is_set() else 0)
+metrics.CallbackGauge('kalfix_db_pool_in_use', 'Conexões do pool em uso neste worker.',
+                      lambda: db_manager.pool_stats()[0])
+metrics.CallbackGauge('kalfix_db_pool_waiting', 'Requisições aguardando conexão do pool.',
+                      lambda: db_manager.pool_stats()[1])
+metrics.CallbackGauge('kalfix_data_listen_up', '1 se o worker recebe as notificações de alteração de dados.',
+                      lambda: 1 if versioning.stats()[0] else 0)
+metrics.CallbackGauge('kalfix_response_cache_entries', 'Respostas versionadas em cache neste worker.',
+                      lambda: versioning.stats()[1])
+
+def get_current_shift(now=None):
     """Determina o turno atual baseado no horário"""
-    now = datetime.now()
+    if now is None:
+        now = datetime.now()
     current_time = now.time()
     
     # Turno 1: 6h às 16h
@@ -45,6 +142,14 @@ def get_current_shift():
     else:
         return None, None
 
+def next_shift_boundary(now):
+    """Retorna o próximo instante (datetime) em que o turno pode mudar."""
+    for boundary in SHIFT_BOUNDARIES:
+        candidate = datetime.combine(now.date(), boundary)
+        if candidate > now:
+            return candidate
+    return datetime.combine(now.date() + timedelta(days=1), SHIFT_BOUNDARIES[0])
+
 def initialize_database():
     """Inicializa conexão com banco de dados"""
     if db_manager.connect():
@@ -55,167 +160,636 @@ def initialize_database():
         print("[ERRO] Erro ao conectar com banco de dados")
         return False
 
-def check_shift_change():
-    """Verifica se houve mudança de turno e salva o anterior no banco"""
-    global current_count, current_shift, current_shift_key
-    
-    new_shift_name, shift_date = get_current_shift()
-
-    # Extrai o nome e a data do turno anterior a partir da chave atual
-    old_shift_name = None
-    old_shift_date = None
-    if current_shift_key is not None and " - " in current_shift_key:
-        # Usa rsplit para separar apenas a última ocorrência (antes da data)
-        old_shift_parts = current_shift_key.rsplit(" - ", 1)
-        if len(old_shift_parts) == 2:
-            old_shift_name = old_shift_parts[0]
-            old_shift_date = old_shift_parts[1]
-
-    # Caso estejamos fora do horário de turnos, finalize qualquer turno ativo pendente
-    if new_shift_name is None:
-        if old_shift_name and old_shift_date:
-            db_manager.finish_shift(old_shift_name, old_shift_date)
-            print(f"🕘 Fora do horário de turnos. Turno '{current_shift_key}' finalizado.")
-        current_shift = None
-        current_shift_key = None
-        current_count = 0
+def offshift_key(now=None):
+    """Identifica o período fora de turno corrente (16:00 - 22:00 do dia)."""
+    return (now or datetime.now()).strftime('%Y-%m-%d')
+
+def log_sampled():
+    """Decide se a requisição atual gera log detalhado (REQUEST_LOG_SAMPLE)."""
+    rate = app.config.get('REQUEST_LOG_SAMPLE', 1.0)
+    return rate >= 1.0 or (rate > 0 and random.random() < rate)
+
+def local_epoch(dt):
+    """Segundos desde 1970 tratando a hora local como UTC (mesma conversão do firmware)."""
+    return calendar.timegm(dt.timetuple())
+
+def broadcast(event, data):
+    """Emite um evento Socket.IO para todos os clientes, medindo tempo e contagem."""
+    with metrics.socketio_emit_duration.time(event=event):
+        socketio.emit(event, data)
+    metrics.socketio_emits.inc(event=event)
+
+@app.before_request
+def start_request_timer():
+    g.request_start = perf_counter()
+
+@app.after_request
+def observe_request(response):
+    start = g.get('request_start')
+    if start is not None:
+        # Rota (padrão da URL) como label para manter a cardinalidade limitada
+        route = request.url_rule.rule if request.url_rule else 'unmatched'
+        metrics.http_request_duration.observe(perf_counter() - start,
+                                              route=route, method=request.method,
+                                              status=response.status_code)
+    return response
+
+@app.after_request
+def compress_response(response):
+    """Compacta com gzip as respostas de texto/JSON quando o cliente aceita."""
+    if (response.status_code != 200 or response.direct_passthrough or response.is_streamed
+            or 'Content-Encoding' in response.headers
+            or response.mimetype not in COMPRESS_MIMETYPES
+            or 'gzip' not in request.accept_encodings):
+        return response
+    body = response.get_data()
+    if len(body) < COMPRESS_MIN_BYTES:
+        return response
+    response.set_data(gzip.compress(body, compresslevel=6))
+    response.headers['Content-Encoding'] = 'gzip'
+    response.vary.add('Accept-Encoding')
+    return response
+
+@app.teardown_appcontext
+def release_db_connection(exc):
+    """Devolve ao pool a conexão usada pela requisição (ou evento Socket.IO)."""
+    db_manager.release()
+
+def apply_shift_state(now=None):
+    """Finaliza o turno anterior e abre o novo quando a chave do turno muda.
+
+    Chamada apenas pelo motor de turnos (e uma vez na inicialização). Cada worker
+    executa a sua; a finalização no banco é idempotente (só afeta turnos ainda
+    abertos). Retorna True se houve transição.
+    """
+    global shift_snapshot
+
+    new_shift_name, shift_date = get_current_shift(now)
+    new_key = f"{new_shift_name} - {shift_date}" if new_shift_name else None
+
+    with state_lock:
+        old = shift_snapshot
+        if old.key == new_key:
+            return False
+
+        # Finaliza o turno anterior em todos os dispositivos (mesmo que o contador seja 0)
+        if old.key is not None:
+            db_manager.finish_shift(old.name, old.date)
+            if new_key is None:
+                print(f"🕘 Fora do horário de turnos. Turno '{old.key}' finalizado.")
+            else:
+                print(f"🔄 Mudança de turno detectada. Turno anterior '{old.key}' finalizado.")
+
+        if new_key is None:
+            new_snapshot = NO_SHIFT
+        else:
+            # Entramos em um novo turno (ou início da aplicação): a contagem já está no banco
+            new_counts = db_manager.get_shift_counts_by_device(new_shift_name, shift_date)
+            new_snapshot = ShiftSnapshot(new_shift_name, shift_date, new_key)
+            print(f"📊 Contadores no banco para '{new_key}': "
+                  f"{sum(new_counts.values())} em {len(new_counts)} dispositivo(s)")
+
+        shift_snapshot = new_snapshot
+        return True
+
+def shift_engine_loop():
+    """Motor de turnos: dorme até a próxima fronteira de turno e aplica a transição."""
+    while True:
+        try:
+            if apply_shift_state():
+                emit_status()
+        except Exception as e:
+            print(f"[ERRO] Motor de turnos: {e}")
+        finally:
+            db_manager.release()
+        now = datetime.now()
+        wait_s = (next_shift_boundary(now) - now).total_seconds()
+        socketio.sleep(max(min(wait_s, SHIFT_ENGINE_MAX_SLEEP_S), 0.05))
+
+def status_broadcast_loop():
+    """Difunde o status no máximo uma vez por intervalo e grava o último contato dos dispositivos."""
+    last_touch = datetime.now()
+    while True:
+        socketio.sleep(STATUS_BROADCAST_INTERVAL_S)
+        try:
+            if status_dirty.is_set():
+                status_dirty.clear()
+                emit_status()
+            if (datetime.now() - last_touch).total_seconds() >= DEVICE_TOUCH_INTERVAL_S:
+                last_touch = datetime.now()
+                flush_device_touch()
+        except Exception as e:
+            print(f"[ERRO] Difusão de status: {e}")
+        finally:
+            db_manager.release()
+
+def publish_alert(event):
+    """Persiste o início/fim da parada e difunde o alerta para os clientes."""
+    snapshot = shift_snapshot
+    device_id = event['device_id']
+    if event['tipo'] == 'parada':
+        detector.set_stop_id(device_id, db_manager.open_stop(device_id, snapshot.name, snapshot.date, event['inicio']))
+    elif event['tipo'] == 'retomada' and event.get('stop_id'):
+        db_manager.close_stop(event['stop_id'], event['fim'])
+    payload = dict(event)
+    payload.pop('stop_id', None)
+    for key in ('inicio', 'fim'):
+        if payload.get(key) is not None:
+            payload[key] = payload[key].isoformat()
+    if event.get('inicio') is not None:
+        payload['duracao_s'] = int(((event.get('fim') or datetime.now()) - event['inicio']).total_seconds())
+    payload['timestamp'] = datetime.now().strftime('%Y-%m-%d %H:%M:%S')
+    print(f"🚨 Alerta '{event['tipo']}' em {device_id} (ritmo {payload['taxa']} peças/min, esperado {payload['esperada']})")
+    metrics.alerts.inc(tipo=event['tipo'])
+    broadcast('alert', payload)
+
+def run_analytics(now):
+    """Uma rodada da detecção: um contador por dispositivo, O(1) por dispositivo."""
+    snapshot = shift_snapshot
+    if snapshot.key != detector.shift_key:
+        # Troca de turno: paradas em andamento terminam com o turno
+        for device_id, stop_id in detector.open_stops():
+            if stop_id:
+                db_manager.close_stop(stop_id, now)
+        detector.reset(snapshot.key)
+        if snapshot.key is not None:
+            for device_id, (stop_id, inicio) in db_manager.get_open_stops(snapshot.name, snapshot.date).items():
+                detector.resume_stop(device_id, stop_id, inicio)
+    if snapshot.key is None:
         return
+    minutes = SHIFT_MINUTES.get(snapshot.name)
+    progress = db_manager.get_shift_progress_by_device(snapshot.name, snapshot.date, now - ANALYTICS_DEVICE_WINDOW)
+    for device_id, (count, meta) in progress.items():
+        expected = meta / minutes if meta and minutes else None
+        for event in detector.observe(device_id, count, expected, now):
+            publish_alert(event)
+
+def analytics_loop():
+    """Detecção de paradas: um único worker (eleito por advisory lock) avalia os contadores.
+
+    Com vários workers cada um recebe só parte das requisições de um dispositivo; o
+    líder observa o contador acumulado no banco a cada ANALYTICS_INTERVAL_S.
+    """
+    leader_conn = None
+    while True:
+        socketio.sleep(Config.ANALYTICS_INTERVAL_S)
+        try:
+            if leader_conn is not None and not db_manager.leader_alive(leader_conn):
+                leader_conn = None
+            if leader_conn is None:
+                leader_conn = db_manager.try_leader_lock(ANALYTICS_LOCK_KEY)
+                if leader_conn is None:
+                    continue
+                # Recomeça do estado persistido (paradas abertas) na primeira rodada
+                detector.reset()
+                print(f"[INFO] Worker {os.getpid()} assumiu a detecção de paradas")
+            run_analytics(datetime.now())
+        except Exception as e:
+            print(f"[ERRO] Detecção de paradas: {e}")
+        finally:
+            db_manager.release()
+
+def retention_loop():
+    """Retenção do histórico a cada RETENTION_INTERVAL_S, em um único worker (advisory lock)."""
+    job = RetentionJob(db_manager, Config, socketio.sleep)
+    leader_conn = None
+    # Primeira execução alguns minutos após a partida, fora do pico de inicialização
+    socketio.sleep(min(300, Config.RETENTION_INTERVAL_S))
+    while True:
+        try:
+            if leader_conn is not None and not db_manager.leader_alive(leader_conn):
+                leader_conn = None
+            if leader_conn is None:
+                leader_conn = db_manager.try_leader_lock(RETENTION_LOCK_KEY)
+            if leader_conn is not None:
+                job.run()
+        except Exception as e:
+            print(f"[ERRO] Retenção: {e}")
+        finally:
+            db_manager.release()
+        socketio.sleep(Config.RETENTION_INTERVAL_S)
+
+def start_shift_engine():
+    """Aplica o estado inicial do turno e agenda o motor, a difusão e a detecção em segundo plano."""
+    apply_shift_state()
+    db_manager.release()
+    socketio.start_background_task(shift_engine_loop)
+    socketio.start_background_task(status_broadcast_loop)
+    socketio.start_background_task(analytics_loop)
+    socketio.start_background_task(versioning.listen_loop, Config.DATABASE_URL, socketio.sleep)
+    socketio.start_background_task(retention_loop)
+
+def start_worker():
+    """Inicialização de um worker de produção (chamada pelo wsgi.py em cada processo)."""
+    if not initialize_database():
+        raise RuntimeError("Não foi possível inicializar o banco de dados")
+    start_shift_engine()
+    print(f"[OK] Worker {os.getpid()} pronto (fila: {Config.SOCKETIO_MESSAGE_QUEUE or 'nenhuma'})")
 
-    # Chave para identificar o turno atual no DB
-    shift_key_for_db = f"{new_shift_name} - {shift_date}"
+def flush_device_touch():
+    """Persiste em lote o último contato dos dispositivos vistos desde a última gravação."""
+    global pending_device_touch
+    with state_lock:
+        pending, pending_device_touch = pending_device_touch, {}
+    if pending and not db_manager.touch_devices(pending):
+        # Mantém os pendentes para a próxima tentativa
+        with state_lock:
+            for device_id, seen in pending.items():
+                pending_device_touch.setdefault(device_id, seen)
 
-    # Se mudou de turno, finalize o anterior (mesmo que contador seja 0) e resete contador local
-    if current_shift_key is not None and current_shift_key != shift_key_for_db:
-        if old_shift_name and old_shift_date:
-            db_manager.finish_shift(old_shift_name, old_shift_date)
-            print(f"🔄 Mudança de turno detectada. Turno anterior '{current_shift_key}' finalizado.")
-        current_count = 0
+def devices_snapshot():
+    """Lista os dispositivos com contador do turno (ou do período fora de turno), último contato e linha."""
+    snapshot = shift_snapshot
+    return db_manager.get_devices_status(snapshot.name, snapshot.date, offshift_key())
 
-    # Se entramos em um novo turno (ou no início da aplicação), carregue o contador do banco
-    if current_shift_key != shift_key_for_db:
-        current_count = db_manager.get_current_shift_count(new_shift_name, shift_date)
-        print(f"📊 Contador carregado do banco para '{new_shift_name} - {shift_date}': {current_count}")
+def plant_status():
+    """Retorna (total da planta, dispositivos) lidos do banco."""
+    devices = devices_snapshot()
+    return sum(dev['count'] for dev in devices), devices
 
-    # Atualiza variáveis globais para refletir estado atual
-    current_shift = new_shift_name
-    current_shift_key = shift_key_for_db
+def build_status(history=None, timestamp=None):
+    """Status atual: contador, turno, dispositivos e histórico dos últimos 10 dias."""
+    if history is None:
+        history = db_manager.get_shift_history(HISTORY_PAGE_DAYS) # Busca os últimos 10 dias
+    count, devices = plant_status()
+    return {
+        'count': count,
+        'current_shift': shift_snapshot.name,
+        'shift_key': shift_snapshot.key,
+        'devices': devices,
+        'history': history,
+        # Cursor das páginas seguintes (GET /historico/turnos): dias antes da grade atual
+        'history_next': pagination.encode_cursor(datetime.now().date() - timedelta(days=HISTORY_PAGE_DAYS - 1)),
+        'timestamp': timestamp or datetime.now().strftime('%Y-%m-%d %H:%M:%S')
+    }
+
+def emit_status(history=None, timestamp=None):
+    """Envia o status atual para todos os clientes."""
+    broadcast('status', build_status(history, timestamp))
+
+def request_device_id():
+    """Lê o parâmetro device_id opcional de filtro (None = planta inteira)."""
+    return request.args.get('device_id') or None
 
 @app.route('/')
 def index():
-    # Garante que o turno atual e a contagem estão corretos ao carregar a página
-    check_shift_change()
-    history = db_manager.get_shift_history(10) # Busca os últimos 10 dias
-    return render_template('index.html',
-                           current_count=current_count,
-                           current_shift=current_shift,
-                           history=history)
+    """Casca estática do dashboard: os dados vêm de /api/status e do Socket.IO.
+
+    Renderizada uma vez por worker (só depende da configuração) e servida com ETag,
+    sem acesso ao banco.
+    """
+    global dashboard_shell
+    if dashboard_shell is None:
+        html = render_template('index.html',
+                               websocket_only=app.config.get('SOCKETIO_WEBSOCKET_ONLY', False))
+        dashboard_shell = (html, hashlib.sha1(html.encode('utf-8')).hexdigest()[:20])
+    html, tag = dashboard_shell
+    if request.if_none_match.contains_weak(tag):
+        response = make_response('', 304)
+    else:
+        response = make_response(html)
+    response.set_etag(tag, weak=True)
+    response.headers['Cache-Control'] = 'no-cache'
+    return response
+
+@app.route('/api/status', methods=['GET'])
+@versioning.conditional('shifts', 'metas', 'perdas', 'devices')
+def api_status():
+    """Mesmo conteúdo do evento 'status' (carga inicial do dashboard e clientes sem Socket.IO).
+
+    Sem 'timestamp': a resposta fica em cache enquanto as tabelas não mudam, e a hora
+    do servidor ficaria congelada. Quem precisar da hora usa a do próprio cliente.
+    """
+    status = build_status()
+    status.pop('timestamp', None)
+    return jsonify(status)
+
+def run_panel(path, params, results, key):
+    """Executa um painel como uma requisição GET interna.
+
+    Roda em thread própria (greenlet com eventlet): toma a sua conexão do pool e a
+    devolve no teardown do contexto, como uma requisição comum.
+    """
+    try:
+        with app.test_request_context(path, method='GET', query_string=params):
+            response = app.full_dispatch_request()
+            results[key] = {'status': response.status_code, 'data': response.get_json(silent=True)}
+    except Exception as e:
+        print(f"[ERRO] Painel {path} falhou em /api/batch: {e}")
+        results[key] = {'status': 500, 'data': {'ok': False, 'error': 'erro interno'}}
+
+@app.route('/api/batch', methods=['POST'])
+def api_batch():
+    """Vários painéis do dashboard em uma requisição, consultados em paralelo.
+
+    Corpo: {"panels": [{"id": "kpis", "path": "/metrics/shift", "params": {...}}, ...]}
+    Cada painel é um endpoint GET de leitura (BATCH_ENDPOINTS) e responde como se
+    fosse chamado diretamente (inclusive o cache por ETag); o tempo total é o do
+    painel mais lento, não a soma.
+    """
+    data = request.get_json(silent=True) or {}
+    panels = data.get('panels')
+    if not isinstance(panels, list) or not panels:
+        return jsonify({'ok': False, 'error': 'panels deve ser uma lista não vazia'}), 400
+    if len(panels) > MAX_BATCH_PANELS:
+        return jsonify({'ok': False, 'error': f'máximo de {MAX_BATCH_PANELS} painéis por requisição'}), 400
+
+    adapter = app.url_map.bind('')
+    jobs = {}
+    for i, panel in enumerate(panels):
+        if not isinstance(panel, dict) or not isinstance(panel.get('path'), str):
+            return jsonify({'ok': False, 'error': f'painel {i}: path é obrigatório'}), 400
+        key = str(panel.get('id', i))
+        params = panel.get('params') or {}
+        if key in jobs or not isinstance(params, dict):
+            return jsonify({'ok': False, 'error': f'painel {key}: id repetido ou params inválido'}), 400
+        try:
+            endpoint, _ = adapter.match(panel['path'], method='GET')
+        except Exception:
+            endpoint = None
+        if endpoint not in BATCH_ENDPOINTS:
+            return jsonify({'ok': False, 'error': f"painel {key}: {panel['path']} não pode ser usado em lote"}), 400
+        jobs[key] = (panel['path'], {k: str(v) for k, v in params.items() if v is not None})
+
+    start = perf_counter()
+    results = {}
+    threads = [threading.Thread(target=run_panel, args=(path, params, results, key), daemon=True)
+               for key, (path, params) in jobs.items()]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    return jsonify({'ok': True, 'panels': results,
+                    'elapsed_ms': round((perf_counter() - start) * 1000.0, 1)})
+
+@socketio.on('connect')
+def handle_connect():
+    metrics.socketio_clients.inc()
+
+@socketio.on('disconnect')
+def handle_disconnect():
+    metrics.socketio_clients.dec()
 
 @socketio.on('request_initial_data')
 def handle_initial_data():
-    """Envia dados iniciais quando cliente se conecta"""
-    check_shift_change()
-    history = db_manager.get_shift_history(10) # Busca os últimos 10 dias
-    
-    socketio.emit('status', {
-        'count': current_count,
-        'current_shift': current_shift,
-        'history': history,
-        'timestamp': datetime.now().strftime('%Y-%m-%d %H:%M:%S')
-    })
+    """Envia dados iniciais apenas ao cliente que pediu (páginas antigas; as novas usam /api/status)"""
+    socketio.emit('status', build_status(), to=request.sid)
 
 @app.route('/update', methods=['GET'])
 def update():
-    global current_count
+    # Espera receber counter=<valor> via GET; device=<id da placa> e canal=<n> são opcionais
+    # (firmware antigo não envia o ID e é tratado como o dispositivo padrão).
+    # ts=<horário do evento no dispositivo> e retry=<falhas anteriores> alimentam /metrics.
+    return ingest_counter(request.args.get('device') or Config.DEFAULT_DEVICE_ID,
+                          request.args.get('counter', type=int),
+                          canal=request.args.get('canal', default=0, type=int),
+                          device_ts=request.args.get('ts', type=int),
+                          retries=request.args.get('retry', default=0, type=int))
+
+def ingest_counter(device_id, counter_value, canal=0, device_ts=None, retries=0, via='wifi'):
+    """Aplica um contador recebido de um dispositivo (/update ou lote de /ingest).
+
+    Retorna (corpo, status HTTP), como a resposta de /update.
+    """
+    if not DEVICE_ID_PATTERN.match(device_id):
+        metrics.updates_received.inc(result='invalid')
+        return {'ok': False, 'error': 'device inválido'}, 400
     
-    # Espera receber counter=<valor> via GET
-    counter_value = request.args.get('counter', type=int)
+    # Log detalhado da requisição (amostrado: no caminho quente o print custa I/O)
+    verbose = log_sampled()
+    now = datetime.now()
+    timestamp = now.strftime('%Y-%m-%d %H:%M:%S')
+    if verbose:
+        print(f"[{timestamp}] Recebido ({via}): device={device_id} counter={counter_value}")
     
-    # Log detalhado da requisição
-    timestamp = datetime.now().strftime('%Y-%m-%d %H:%M:%S')
-    print(f"[{timestamp}] Recebido: counter={counter_value}")
+    # Último contato e atraso de ingestão (relógio do dispositivo vs. recebimento)
+    metrics.device_last_seen.set(now.timestamp(), device=device_id)
+    if device_ts:
+        lag = max(local_epoch(now) - device_ts, 0)
+        metrics.device_ingest_lag.set(lag, device=device_id)
+        metrics.ingest_lag.observe(lag)
+    if retries > 0:
+        metrics.device_retries.inc(retries, device=device_id)
     
-    # Verifica mudança de turno (a não ser que ignore seja habilitado)
-    if not app.config.get('IGNORE_SHIFT_CHECK', False):
-        check_shift_change()
+    # O turno vigente é publicado pelo motor de turnos; não há verificação por requisição
+    snapshot = shift_snapshot
     
     # Log do estado atual
-    if current_shift is None:
-        print(f"[{timestamp}] FORA DO TURNO")
-    else:
-        print(f"[{timestamp}] Turno ativo: {current_shift_key}")
+    if verbose:
+        if snapshot.name is None:
+            print(f"[{timestamp}] FORA DO TURNO")
+        else:
+            print(f"[{timestamp}] Turno ativo: {snapshot.key}")
     
+    with state_lock:
+        is_new_device = device_id not in known_devices
+        known_devices.add(device_id)
+        pending_device_touch[device_id] = now
+    if is_new_device:
+        db_manager.register_device(device_id)
+    
+    device_count = None
     # Atualiza contador quando recebe valor válido
     if counter_value is not None and counter_value > 0:
-        # Extrai nome e data do turno para o banco
-        if current_shift_key and " - " in current_shift_key and current_shift is not None:
-            # Separa somente a última ocorrência do separador para obter a data corretamente
-            shift_parts = current_shift_key.rsplit(" - ", 1)
-            shift_name = shift_parts[0]
-            shift_date = shift_parts[1]
-            
-            # Atualiza contador no banco de dados
-            # Se o contador recebido for maior que o atual, atualiza
-            if counter_value > current_count:
-                # Calcula quantos incrementos foram feitos
-                increments = counter_value - current_count
-                new_count = current_count
-                
-                # Incrementa no banco a quantidade necessária
-                for _ in range(increments):
-                    new_count = db_manager.increment_shift_count(shift_name, shift_date)
-                    if new_count is None:
-                        print(f"[{timestamp}] ❌ Erro ao incrementar no banco")
-                        break
-                
-                if new_count is not None:
-                    current_count = new_count
-                    print(f"[{timestamp}] ✅ CONTADOR ATUALIZADO NO BANCO: {current_count}")
-                else:
-                    # Fallback: atualiza memória para refletir imediatamente no frontend
-                    current_count = counter_value
-                    print(f"[{timestamp}] ⚠️  Falha no DB, contador atualizado em memória: {current_count}")
-            else:
-                print(f"[{timestamp}] ℹ️  Contador recebido ({counter_value}) não é maior que atual ({current_count})")
+        # O banco mantém o maior valor recebido em uma única instrução, então reenvios
+        # e requisições concorrentes (em qualquer worker) não contam em dobro
+        if snapshot.name is not None:
+            device_count, delta = db_manager.update_device_count(device_id, snapshot.name, snapshot.date, counter_value)
         else:
-            # Fora de turno ou sem chave válida: ainda assim atualiza o valor em memória para refletir no frontend
-            if counter_value > current_count:
-                current_count = counter_value
-                print(f"[{timestamp}] ⚠️  Atualizado apenas em memória (fora do turno/sem chave). count={current_count}")
-            else:
-                print(f"[{timestamp}] ℹ️  (memória) Contador recebido ({counter_value}) não é maior que atual ({current_count})")
+            # Fora de turno: contagem do período fica em `devices`, sem linha em shifts
+            device_count, delta = db_manager.update_offshift_count(device_id, offshift_key(now), counter_value)
+        
+        if device_count is None:
+            print(f"[{timestamp}] ❌ Erro ao atualizar contador no banco ({device_id})")
+            metrics.updates_received.inc(result='db_error')
+            return {'ok': False, 'error': 'falha ao gravar contador'}, 503
+        if delta > 0:
+            db_manager.record_production(delta, device_id=device_id, canal=canal, when=now)
+            metrics.updates_received.inc(result='counted')
+            if verbose:
+                print(f"[{timestamp}] ✅ CONTADOR ATUALIZADO NO BANCO: {device_id}={device_count}")
+            # A difusão para os clientes é agrupada pelo laço de status
+            status_dirty.set()
+        else:
+            metrics.updates_received.inc(result='unchanged')
+            if verbose:
+                print(f"[{timestamp}] ℹ️  Contador recebido ({counter_value}) não é maior que atual ({device_count})")
         
     elif counter_value is not None and counter_value <= 0:
-        print(f"[{timestamp}] ❌ Valor inválido de contador: {counter_value}")
+        metrics.updates_received.inc(result='invalid')
+        print(f"[{timestamp}] ❌ Valor inválido de contador: {counter_value} ({device_id})")
     elif counter_value is None:
-        print(f"[{timestamp}] ❌ Dados inválidos recebidos")
-    
-    # Obtém histórico atualizado do banco
-    history = db_manager.get_shift_history(10) # Busca os últimos 10 dias
-    
-    # Emite para todos os clientes conectados
-    socketio.emit('status', {
-        'count': current_count,
-        'current_shift': current_shift,
-        'history': history,
-        'timestamp': timestamp
-    })
+        metrics.updates_received.inc(result='invalid')
+        print(f"[{timestamp}] ❌ Dados inválidos recebidos ({device_id})")
     
-    print(f"[{timestamp}] Status enviado para clientes: count={current_count}\n")
     # Retorna informações úteis na resposta para diagnóstico rápido
     return {
         'ok': True,
-        'count': current_count,
+        'device': device_id,
+        'count': device_count,
         'received': counter_value,
-        'shift': current_shift,
+        'shift': snapshot.name,
         'ignore_shift_check': app.config.get('IGNORE_SHIFT_CHECK', False)
     }, 200
 
+@app.route('/ingest', methods=['POST'])
+def ingest_batch():
+    """Lote de contadores e eventos de dispositivos sem Wi-Fi (tools/usb_bridge.py).
+
+    Corpo: {"via": "usb", "updates": [{"device", "counter", "ts", "retry", "canal"}, ...],
+            "events": [{"device", "tipo", "valor", "ts"}, ...]}
+    Cada update é aplicado como um /update; a resposta traz o resultado de cada um,
+    na mesma ordem, para a ponte confirmar ao dispositivo só o que foi gravado.
+    """
+    data = request.get_json(silent=True) or {}
+    updates = data.get('updates') or []
+    events = data.get('events') or []
+    via = str(data.get('via') or 'lote')[:16]
+    if not isinstance(updates, list) or not isinstance(events, list):
+        return jsonify({'ok': False, 'error': 'updates e events devem ser listas'}), 400
+    if len(updates) + len(events) > MAX_INGEST_BATCH:
+        return jsonify({'ok': False, 'error': f'máximo de {MAX_INGEST_BATCH} itens por lote'}), 400
+
+    results = []
+    for item in updates:
+        if not isinstance(item, dict) or not isinstance(item.get('device'), str):
+            results.append({'ok': False, 'error': 'device obrigatório'})
+            continue
+        try:
+            counter_value = int(item['counter'])
+            canal = int(item.get('canal') or 0)
+            device_ts = int(item['ts']) if item.get('ts') else None
+            retries = int(item.get('retry') or 0)
+        except (KeyError, TypeError, ValueError):
+            metrics.updates_received.inc(result='invalid')
+            results.append({'ok': False, 'device': item['device'], 'error': 'counter/ts/retry inválidos'})
+            continue
+        body, _ = ingest_counter(item['device'], counter_value, canal=canal, device_ts=device_ts,
+                                 retries=retries, via=via)
+        results.append({key: body[key] for key in ('ok', 'device', 'count', 'received', 'error') if key in body})
+
+    for event in events:
+        if isinstance(event, dict):
+            print(f"📟 Evento ({via}) de {event.get('device')}: {event.get('tipo')} = {event.get('valor')}")
+            metrics.device_events.inc(tipo=str(event.get('tipo'))[:32], via=via)
+    return jsonify({'ok': all(r.get('ok') for r in results), 'results': results})
+
+def sync_request_args():
+    """(device_id, turno aberto, turno mais antigo na flash) dos parâmetros de /sync/*.
+
+    ValueError se o dispositivo for inválido; 'from' ausente ou inválido = sem limite.
+    """
+    device_id = request.args.get('device', '')
+    if not DEVICE_ID_PATTERN.match(device_id):
+        raise ValueError('device inválido')
+    return (device_id, reconcile.parse_key(request.args.get('open', '')),
+            reconcile.parse_key(request.args.get('from', '')))
+
+@app.route('/sync/digest', methods=['GET'])
+def sync_digest():
+    """Compara os resumos por faixa enviados pelo dispositivo com os do banco.
+
+    Parâmetros: device, open=AAAAMMDD.T (turno em andamento, fora da comparação),
+    from=AAAAMMDD.T (opcional: turno mais antigo na flash cheia; os anteriores ficam de
+    fora) e b=faixa:hash_hex,... (FNV-1a dos totais de cada faixa de 7 dias, ver reconcile.py).
+    Resposta: {"ok": true, "diff": [faixas diferentes]}; o dispositivo envia só essas.
+    """
+    try:
+        device_id, open_key, start = sync_request_args()
+        buckets = reconcile.parse_digests(request.args.get('b', ''))
+    except ValueError as e:
+        return jsonify({'ok': False, 'error': str(e)}), 400
+    if not buckets or len(buckets) > MAX_SYNC_BUCKETS:
+        return jsonify({'ok': False, 'error': f'informe de 1 a {MAX_SYNC_BUCKETS} faixas'}), 400
+
+    inicio = reconcile.bucket_range(min(buckets))[0]
+    fim = reconcile.bucket_range(max(buckets))[1]
+    if start is not None:
+        inicio = max(inicio, start[0])
+    rows = db_manager.get_device_shift_totals(device_id, inicio, fim)
+    if rows is None:
+        return jsonify({'ok': False, 'error': 'banco indisponível'}), 503
+    server = reconcile.digests(rows, exclude=open_key, start=start)
+    diff = sorted(b for b, h in buckets.items() if server.get(b, reconcile.EMPTY) != h)
+    metrics.sync_buckets.inc(len(buckets) - len(diff), result='igual')
+    if diff:
+        metrics.sync_buckets.inc(len(diff), result='diferente')
+    return jsonify({'ok': True, 'diff': diff})
+
+@app.route('/sync/totals', methods=['GET'])
+def sync_totals():
+    """Corrige uma faixa com os totais por turno do dispositivo e devolve os do banco.
+
+    Parâmetros: device, open, from, b=faixa e t=AAAAMMDD.T:total,... (turnos da faixa na flash).
+    O banco fica com o maior valor de cada turno; a resposta {"ok", "raised", "t"} traz
+    os totais resultantes da faixa no mesmo formato, e o dispositivo adota os maiores.
+    """
+    try:
+        device_id, open_key, start = sync_request_args()
+        bucket = int(request.args.get('b', ''))
+        totals = reconcile.parse_totals(request.args.get('t', ''))
+    except ValueError as e:
+        return jsonify({'ok': False, 'error': str(e)}), 400
+    if any(reconcile.bucket_of(day) != bucket for day, _ in totals):
+        return jsonify({'ok': False, 'error': 'turno fora da faixa informada'}), 400
+
+    merge = [(day, reconcile.SHIFT_NAMES[turno], total)
+             for (day, turno), total in totals.items() if (day, turno) != open_key and total > 0]
+    raised = db_manager.merge_device_shift_totals(device_id, merge)
+    if raised is None:
+        return jsonify({'ok': False, 'error': 'falha ao gravar totais'}), 503
+    if raised:
+        metrics.sync_corrections.inc(raised, device=device_id)
+        print(f"🔁 Reconciliação: {raised} turno(s) de {device_id} corrigido(s) pela flash do dispositivo")
+        status_dirty.set()
+
+    inicio, fim = reconcile.bucket_range(bucket)
+    if start is not None:
+        inicio = max(inicio, start[0])
+    rows = db_manager.get_device_shift_totals(device_id, inicio, fim)
+    if rows is None:
+        return jsonify({'ok': False, 'error': 'banco indisponível'}), 503
+    return jsonify({'ok': True, 'raised': raised,
+                    't': reconcile.format_totals(rows, exclude=open_key, start=start)})
+
+@app.route('/devices', methods=['GET'])
+@versioning.conditional('shifts', 'devices')
+def list_devices():
+    """Lista os dispositivos com o contador do turno corrente e subtotais por linha."""
+    total, devices = plant_status()
+    linhas = {}
+    for dev in devices:
+        linha = dev['linha'] or 'Sem linha'
+        linhas[linha] = linhas.get(linha, 0) + dev['count']
+    return jsonify({
+        'ok': True,
+        'shift': shift_snapshot.name,
+        'total': total,
+        'linhas': [{'linha': k, 'count': v} for k, v in sorted(linhas.items())],
+        'data': devices
+    })
+
+@app.route('/admin/device', methods=['POST'])
+def set_device():
+    """Define nome e/ou linha de produção de um dispositivo."""
+    data = request.get_json(silent=True) or {}
+    device_id = data.get('device_id')
+    nome = data.get('nome') or None
+    linha = data.get('linha') or None
+    if not device_id or not DEVICE_ID_PATTERN.match(device_id):
+        return jsonify({'ok': False, 'error': 'device_id inválido'}), 400
+    ok = db_manager.update_device_info(device_id, nome, linha)
+    if ok:
+        status_dirty.set()
+    return jsonify({'ok': ok}), 200 if ok else 500
+
 @app.route('/admin/meta', methods=['POST'])
 def set_meta():
     data = request.get_json(silent=True) or {}
     turno_nome = data.get('turno_nome')
     meta_turno = data.get('meta_turno')
     meta_dia = data.get('meta_dia')
+    device_id = data.get('device_id') or None  # None = todos os dispositivos do turno
 
     # A data do turno agora é sempre a data atual, simplificando o frontend
     _, shift_date_str = get_current_shift()
@@ -223,7 +797,8 @@ def set_meta():
 
     if not turno_nome or meta_turno is None:
         return jsonify({'ok': False, 'error': 'turno_nome e meta_turno são obrigatórios'}), 400
-    ok = db_manager.set_goal_for_shift(turno_nome, data_turno, int(meta_turno), int(meta_dia) if meta_dia is not None else None)
+    ok = db_manager.set_goal_for_shift(turno_nome, data_turno, int(meta_turno), int(meta_dia) if meta_dia is not None else None,
+                                       device_id=device_id)
     return jsonify({'ok': ok}), 200 if ok else 500
 
 @app.route('/admin/perda', methods=['POST'])
@@ -234,6 +809,7 @@ def add_perda():
     quantidade = data.get('quantidade')
     motivo = data.get('motivo', 'Perda registrada manualmente')  # motivo padrão se não fornecido
     data_evento = data.get('data_evento')  # opcional, timestamp ISO
+    device_id = data.get('device_id') or None  # opcional, padrão: dispositivo padrão
     
     # Log para debug
     print(f"[DEBUG] Recebendo perda: turno_nome={turno_nome}, data_turno={data_turno}, quantidade={quantidade}, motivo={motivo}")
@@ -244,119 +820,237 @@ def add_perda():
         return jsonify({'ok': False, 'error': error_msg}), 400
     
     
-    ok = db_manager.insert_loss(turno_nome, data_turno, int(quantidade), motivo, data_evento)
+    ok = db_manager.insert_loss(turno_nome, data_turno, int(quantidade), motivo, data_evento, device_id=device_id)
     print(f"[DEBUG] Resultado da inserção: {ok}")
     
     if ok:
-        # Força sincronização do histórico após inserir perda
-        try:
-            history = db_manager.get_shift_history(10) # Busca os últimos 10 dias
-            socketio.emit('status', {
-                'count': current_count,
-                'current_shift': current_shift,
-                'history': history,
-                'timestamp': datetime.now().strftime('%Y-%m-%d %H:%M:%S')
-            })
-            print("[DEBUG] Histórico sincronizado após inserção de perda")
-        except Exception as e:
-            print(f"[DEBUG] Erro ao sincronizar histórico: {e}")
+        # Histórico e status são difundidos pela próxima rodada da difusão agrupada
+        status_dirty.set()
     
     return jsonify({'ok': ok}), 200 if ok else 500
 
+def validate_loss(item, defaults):
+    """Valida um item do lote de perdas; retorna (perda normalizada, erro)."""
+    if not isinstance(item, dict):
+        return None, 'item deve ser um objeto'
+    loss = {**defaults, **{k: v for k, v in item.items() if v is not None}}
+    if not loss.get('turno_nome') or loss['turno_nome'] not in SHIFT_MINUTES:
+        return None, 'turno_nome inválido'
+    try:
+        loss['data_turno'] = datetime.strptime(str(loss.get('data_turno')), '%Y-%m-%d').date()
+    except ValueError:
+        return None, 'data_turno deve estar no formato YYYY-MM-DD'
+    quantidade = loss.get('quantidade')
+    if isinstance(quantidade, bool) or not isinstance(quantidade, int) or quantidade <= 0:
+        return None, 'quantidade deve ser um inteiro positivo'
+    motivo = loss.get('motivo') or 'Perda registrada manualmente'
+    if not isinstance(motivo, str) or len(motivo) > 255:
+        return None, 'motivo deve ter até 255 caracteres'
+    loss['motivo'] = motivo
+    if loss.get('data_evento'):
+        try:
+            loss['data_evento'] = datetime.fromisoformat(str(loss['data_evento']))
+        except ValueError:
+            return None, 'data_evento deve estar no formato ISO 8601'
+    device_id = loss.get('device_id')
+    if device_id and not DEVICE_ID_PATTERN.match(str(device_id)):
+        return None, 'device_id inválido'
+    return loss, None
+
+@app.route('/admin/perdas', methods=['POST'])
+def add_perdas_lote():
+    """Registra um lote de perdas (ex.: lançamentos do fim do turno) em uma única transação.
+
+    Corpo: {"perdas": [{turno_nome, data_turno, quantidade, motivo?, data_evento?, device_id?}, ...]}
+    turno_nome, data_turno e device_id no nível de cima valem para os itens que não os
+    informam. Tudo ou nada: qualquer item inválido rejeita o lote inteiro.
+    """
+    data = request.get_json(silent=True)
+    if isinstance(data, list):
+        data = {'perdas': data}
+    if not isinstance(data, dict) or not isinstance(data.get('perdas'), list) or not data['perdas']:
+        return jsonify({'ok': False, 'error': 'envie {"perdas": [...]} com ao menos um item'}), 400
+    if len(data['perdas']) > MAX_LOSS_BATCH:
+        return jsonify({'ok': False, 'error': f'máximo de {MAX_LOSS_BATCH} perdas por lote'}), 400
+
+    defaults = {k: data[k] for k in ('turno_nome', 'data_turno', 'device_id') if data.get(k)}
+    losses, errors = [], []
+    for index, item in enumerate(data['perdas']):
+        loss, error = validate_loss(item, defaults)
+        if error:
+            errors.append({'index': index, 'error': error})
+        else:
+            losses.append(loss)
+    if errors:
+        return jsonify({'ok': False, 'error': 'itens inválidos', 'itens': errors}), 400
+
+    inserted = db_manager.insert_losses(losses)
+    if inserted is None:
+        return jsonify({'ok': False, 'error': 'falha ao gravar as perdas'}), 500
+    # Uma única difusão para o lote inteiro
+    status_dirty.set()
+    print(f"[INFO] Lote de perdas: {inserted} registro(s), {sum(l['quantidade'] for l in losses)} peça(s)")
+    return jsonify({'ok': True, 'inseridas': inserted})
+
+def request_page_args(kind, default_limit=pagination.DEFAULT_LIMIT, cursor_arg='cursor'):
+    """(chave após a qual a página começa, tamanho) dos parâmetros; ValueError se inválidos."""
+    after = pagination.decode_cursor(request.args.get(cursor_arg), kind)
+    return after, pagination.page_limit(request.args.get('limit', type=int), default_limit)
+
 @app.route('/admin/perdas_historico', methods=['GET'])
+@versioning.conditional('perdas', 'shifts', ttl=300)
 def get_losses_history():
-    """Retorna o histórico de perdas das últimas 24 horas."""
+    """Retorna o histórico de perdas (padrão: últimas 24 horas), paginado por chave.
+
+    Parâmetros: hours (0 = todo o histórico), limit (padrão 50) e cursor (campo 'next'
+    da página anterior). Cada página custa o mesmo, qualquer que seja a profundidade.
+    """
+    try:
+        after, limit = request_page_args(datetime, default_limit=50)
+        hours = request.args.get('hours', default=24, type=int)
+    except ValueError as e:
+        return jsonify({'ok': False, 'error': str(e)}), 400
     try:
-        losses = db_manager.get_losses_history(24)  # últimas 24 horas
-        return jsonify({'ok': True, 'data': losses})
+        losses, next_key = db_manager.get_losses_page(after, limit, hours=hours or None,
+                                                      device_id=request_device_id())
+        return jsonify({'ok': True, 'data': losses,
+                        'next': pagination.encode_cursor(*next_key) if next_key else None})
     except Exception as e:
         print(f"[ERRO] Erro ao obter histórico de perdas: {e}")
         return jsonify({'ok': False, 'error': str(e)}), 500
 
+@app.route('/historico/turnos', methods=['GET'])
+@versioning.conditional('shifts')
+def shift_history():
+    """Páginas anteriores da grade de histórico de turnos (botão "carregar mais").
+
+    Parâmetros: cursor ('history_next' do status ou 'next' da página anterior), days
+    (padrão 10) e device_id. Sem cursor, devolve a grade que termina hoje. Dias sem
+    nenhum turno antes da página são pulados; 'next' é null quando não há mais dados.
+    """
+    try:
+        after = pagination.decode_cursor(request.args.get('cursor'), date)
+        days = pagination.page_limit(request.args.get('days', type=int), HISTORY_PAGE_DAYS)
+    except ValueError as e:
+        return jsonify({'ok': False, 'error': str(e)}), 400
+    antes = after[0] if after else datetime.now().date() + timedelta(days=1)
+    history, inicio = db_manager.get_shift_history_page(antes, days, device_id=request_device_id())
+    return jsonify({'ok': True, 'data': history,
+                    'next': pagination.encode_cursor(inicio) if inicio else None})
+
 @app.route('/metrics/shift', methods=['GET'])
+@versioning.conditional('shifts', 'metas', 'metas_p_turno', 'perdas', 'producao_minuto', ttl=60)
 def metrics_shift():
     turno_nome = request.args.get('turno_nome')
     data_turno = request.args.get('data_turno')  # YYYY-MM-DD
+    if not turno_nome and not data_turno:
+        # Sem parâmetros: turno corrente (painel do dashboard em /api/batch)
+        snapshot = shift_snapshot
+        if snapshot.name is None:
+            return jsonify({'ok': False, 'error': 'Fora do horário de turnos'}), 404
+        turno_nome, data_turno = snapshot.name, snapshot.date
     
     if not turno_nome or not data_turno:
         return jsonify({'ok': False, 'error': 'turno_nome e data_turno são obrigatórios'}), 400
     
-    metrics = db_manager.get_shift_metrics(turno_nome, data_turno)
+    shift_metrics = db_manager.get_shift_metrics(turno_nome, data_turno, device_id=request_device_id())
     
-    if metrics is None:
+    if shift_metrics is None:
         return jsonify({'ok': False, 'error': 'Turno não encontrado'}), 404
-    return jsonify({'ok': True, 'metrics': metrics})
+    return jsonify({'ok': True, 'metrics': shift_metrics})
 
 @app.route('/metrics/aggregate', methods=['GET'])
+@versioning.conditional('shifts', 'metas', 'perdas')
 def metrics_aggregate():
     period = request.args.get('period', 'day')  # day|week|month|year
-    aggregates = db_manager.get_period_aggregates(period)
+    aggregates = db_manager.get_period_aggregates(period, device_id=request_device_id())
     return jsonify({'ok': True, 'period': period, 'data': aggregates})
 
 @app.route('/metrics/perdas_distribuicao', methods=['GET'])
+@versioning.conditional('perdas', 'shifts')
 def perdas_distribuicao():
     period = request.args.get('period', 'day')
-    data = db_manager.get_losses_distribution(period)
+    data = db_manager.get_losses_distribution(period, device_id=request_device_id())
     return jsonify({'ok': True, 'period': period, 'data': data})
 
 @app.route('/metrics/ranking_turnos', methods=['GET'])
+@versioning.conditional('shifts', 'metas')
 def ranking_turnos():
-    data = db_manager.get_shifts_efficiency_ranking()
+    data = db_manager.get_shifts_efficiency_ranking(device_id=request_device_id())
     return jsonify({'ok': True, 'data': data})
 
 @app.route('/metrics/efficiency_series', methods=['GET'])
+@versioning.conditional('shifts', 'metas', 'perdas')
 def efficiency_series():
     days = request.args.get('days', default=7, type=int)
-    data = db_manager.get_daily_efficiency_series(days)
+    data = db_manager.get_daily_efficiency_series(days, device_id=request_device_id())
     return jsonify({'ok': True, 'days': days, 'data': data})
 
+@app.route('/metrics/throughput', methods=['GET'])
+@versioning.conditional('producao_minuto', 'producao_hora', ttl=60)
+def metrics_throughput():
+    """Produção por janela de tempo arbitrária, a partir da série por minuto.
+
+    Parâmetros: inicio/fim (ISO 8601, padrão: últimas 8 h), bucket (minutos, padrão 15),
+    device_id e canal opcionais.
+    """
+    try:
+        fim = datetime.fromisoformat(request.args['fim']) if request.args.get('fim') else datetime.now()
+        inicio = datetime.fromisoformat(request.args['inicio']) if request.args.get('inicio') else fim - timedelta(hours=8)
+    except ValueError:
+        return jsonify({'ok': False, 'error': 'inicio/fim devem estar no formato ISO 8601'}), 400
+    bucket = request.args.get('bucket', default=15, type=int)
+    if bucket is None or bucket <= 0 or inicio >= fim:
+        return jsonify({'ok': False, 'error': 'intervalo ou bucket inválido'}), 400
+    if (fim - inicio).total_seconds() / (bucket * 60) > MAX_THROUGHPUT_BUCKETS:
+        return jsonify({'ok': False, 'error': f'máximo de {MAX_THROUGHPUT_BUCKETS} buckets por consulta'}), 400
+
+    data = db_manager.get_throughput(inicio, fim, bucket,
+                                     device_id=request_device_id(),
+                                     canal=request.args.get('canal', type=int))
+    return jsonify({'ok': True, 'bucket': bucket, 'data': data})
+
+@app.route('/metrics', methods=['GET'])
+def metrics_endpoint():
+    """Métricas do worker no formato texto do Prometheus."""
+    return Response(metrics.render(), mimetype='text/plain; version=0.0.4; charset=utf-8')
+
 @app.route('/debug_status', methods=['GET'])
+@versioning.conditional('shifts', 'devices')
 def debug_status():
     """Rota de diagnóstico para verificar estado atual do servidor."""
-    check_shift_change()
+    snapshot = shift_snapshot
+    count, devices = plant_status()
     return {
-        'count': current_count,
-        'shift': current_shift,
-        'shift_key': current_shift_key,
+        'count': count,
+        'devices': {dev['device_id']: dev['count'] for dev in devices},
+        'worker_pid': os.getpid(),
+        'shift': snapshot.name,
+        'shift_key': snapshot.key,
         'ignore_shift_check': app.config.get('IGNORE_SHIFT_CHECK', False)
     }, 200
 
 @app.route('/debug_shifts', methods=['GET'])
 def debug_shifts():
-    """Rota de debug para listar todos os turnos e perdas."""
+    """Rota de debug para listar os turnos e as perdas, paginados por chave.
+
+    Parâmetros: limit (padrão 20), cursor (turnos) e perdas_cursor (perdas): os campos
+    'next' e 'perdas_next' da resposta anterior.
+    """
     try:
-        # Lista todos os turnos
-        db_manager.cursor.execute("SELECT id, turno_nome, data_turno, contador FROM shifts ORDER BY data_turno DESC, id DESC LIMIT 20")
-        shifts = []
-        for row in db_manager.cursor.fetchall():
-            shifts.append({
-                'id': row[0],
-                'turno_nome': row[1],
-                'data_turno': str(row[2]),
-                'contador': row[3]
-            })
-        
-        # Lista todas as perdas
-        db_manager.cursor.execute("""
-            SELECT p.id, p.quantidade, p.motivo, p.data_evento, s.turno_nome, s.data_turno 
-            FROM perdas p 
-            JOIN shifts s ON p.shift_id = s.id 
-            ORDER BY p.data_evento DESC LIMIT 20
-        """)
-        losses = []
-        for row in db_manager.cursor.fetchall():
-            losses.append({
-                'id': row[0],
-                'quantidade': row[1],
-                'motivo': row[2],
-                'data_evento': str(row[3]) if row[3] else None,
-                'turno_nome': row[4],
-                'data_turno': str(row[5])
-            })
-        
+        after, limit = request_page_args(date)
+        losses_after = pagination.decode_cursor(request.args.get('perdas_cursor'), datetime)
+    except ValueError as e:
+        return jsonify({'error': str(e)}), 400
+    try:
+        shifts, next_key = db_manager.get_shifts_page(after, limit, device_id=request_device_id())
+        losses, losses_next = db_manager.get_losses_page(losses_after, limit, device_id=request_device_id())
+
         return jsonify({
             'shifts': shifts,
-            'losses': losses
+            'losses': losses,
+            'next': pagination.encode_cursor(*next_key) if next_key else None,
+            'perdas_next': pagination.encode_cursor(*losses_next) if losses_next else None
         })
     except Exception as e:
         return jsonify({'error': str(e)}), 500
@@ -365,38 +1059,129 @@ def debug_shifts():
 def sync_history():
     """Força sincronização do histórico com o banco de dados."""
     try:
-        # Obtém histórico atualizado do banco
-        history = db_manager.get_shift_history(10) # Busca os últimos 10 dias
-        
-        # Emite atualização para todos os clientes conectados
-        socketio.emit('status', {
-            'count': current_count,
-            'current_shift': current_shift,
-            'history': history,
-            'timestamp': datetime.now().strftime('%Y-%m-%d %H:%M:%S')
-        })
+        # Emite atualização (histórico lido do banco) para todos os clientes conectados
+        emit_status()
         
         return jsonify({'ok': True, 'message': 'Histórico sincronizado'})
     except Exception as e:
         return jsonify({'ok': False, 'error': str(e)}), 500
 
 @app.route('/metrics/performance', methods=['GET'])
+@versioning.conditional('shifts', 'metas', 'perdas')
 def get_performance_data():
     """Retorna dados de performance agregados por período."""
     period = request.args.get('period', 'day')
     mode = request.args.get('mode', 'total')
-    data = db_manager.get_performance_data(period, mode)
+    data = db_manager.get_performance_data(period, mode, device_id=request_device_id())
     return jsonify({'ok': True, 'period': period, 'data': data})
 
+@app.route('/metrics/series', methods=['GET'])
+@versioning.conditional('shifts', 'metas', 'perdas')
+def metrics_series():
+    """Série do gráfico de performance, reduzida no servidor ao orçamento de pontos.
+
+    Parâmetros: period, mode e device_id (como /metrics/performance), points
+    (orçamento, padrão 200), inicio/fim opcionais (datas ISO; padrão: último ano).
+    Atualização incremental: com after=<cursor> devolve só os buckets a partir do
+    cursor, sem redução; se version for igual à do conteúdo, responde unchanged.
+    """
+    period = request.args.get('period', 'day')
+    mode = request.args.get('mode', 'total')
+    budget = request.args.get('points', default=SERIES_DEFAULT_POINTS, type=int)
+    if budget is None or budget < 3:
+        return jsonify({'ok': False, 'error': 'points deve ser um inteiro >= 3'}), 400
+    budget = min(budget, SERIES_MAX_POINTS)
+    after = request.args.get('after')
+    try:
+        inicio = datetime.fromisoformat(after or request.args['inicio']).date() \
+            if (after or request.args.get('inicio')) else None
+        fim = datetime.fromisoformat(request.args['fim']).date() if request.args.get('fim') else None
+    except ValueError:
+        return jsonify({'ok': False, 'error': 'after/inicio/fim devem estar no formato ISO 8601'}), 400
+
+    rows = db_manager.get_performance_data(period, mode, device_id=request_device_id(), inicio=inicio, fim=fim)
+    points = series.to_points(rows, mode)
+    total = len(points)
+    if after is None:
+        points = series.downsample(points, budget)
+        # A versão cobre a cauda (último bucket), que é o que as consultas com after comparam
+        tail = points[-1:]
+    else:
+        tail = points
+    version = series.version(tail)
+    cursor = points[-1]['x'] if points else after
+    if after is not None and request.args.get('version') == version:
+        return jsonify({'ok': True, 'unchanged': True, 'cursor': cursor, 'version': version})
+    return jsonify({'ok': True, 'period': period, 'mode': mode, 'points': points, 'total_points': total,
+                    'downsampled': len(points) < total, 'cursor': cursor, 'version': version})
+
+@app.route('/metrics/paradas', methods=['GET'])
+@versioning.conditional('paradas', 'devices', ttl=60)
+def metrics_paradas():
+    """Paradas detectadas nas últimas N horas (hours, padrão 24) e device_id opcional."""
+    hours = request.args.get('hours', default=24, type=int)
+    if hours is None or hours <= 0:
+        return jsonify({'ok': False, 'error': 'hours deve ser um inteiro positivo'}), 400
+    return jsonify({'ok': True, 'data': db_manager.get_stops(hours, device_id=request_device_id())})
+
+@app.route('/export/<tipo>', methods=['GET'])
+def export_data(tipo):
+    """Exportação em streaming de turnos, perdas ou produção por minuto (ERP/BI).
+
+    Parâmetros: formato (csv | arrow, padrão csv), inicio/fim (datas ISO, inclusive;
+    padrão: últimos 30 dias) e device_id opcional. As linhas são lidas de um cursor
+    no servidor em blocos e enviadas com transferência chunked.
+    """
+    if tipo not in db_manager.EXPORT_COLUMNS:
+        return jsonify({'ok': False, 'error': f"tipo deve ser um de: {', '.join(db_manager.EXPORT_COLUMNS)}"}), 404
+    formato = request.args.get('formato', 'csv')
+    if formato not in export.FORMATS:
+        return jsonify({'ok': False, 'error': 'formato deve ser csv ou arrow'}), 400
+    if formato == 'arrow' and not export.arrow_available():
+        return jsonify({'ok': False, 'error': 'exportação Arrow requer o pacote pyarrow no servidor'}), 501
+    try:
+        fim = datetime.fromisoformat(request.args['fim']).date() if request.args.get('fim') else datetime.now().date()
+        inicio = datetime.fromisoformat(request.args['inicio']).date() if request.args.get('inicio') else fim - timedelta(days=30)
+    except ValueError:
+        return jsonify({'ok': False, 'error': 'inicio/fim devem estar no formato ISO 8601'}), 400
+    if inicio > fim:
+        return jsonify({'ok': False, 'error': 'intervalo inválido'}), 400
+
+    device_id = request_device_id()
+    if device_id and not DEVICE_ID_PATTERN.match(device_id):
+        return jsonify({'ok': False, 'error': 'device_id inválido'}), 400
+    chunks = db_manager.iter_export(tipo, inicio, fim, device_id, chunk_size=Config.EXPORT_CHUNK_ROWS)
+    try:
+        # Abre o cursor antes de responder: falha de banco ainda vira 503, não um arquivo truncado
+        columns = next(chunks)
+    except Exception as e:
+        print(f"[ERRO] Exportação {tipo}: {e}")
+        return jsonify({'ok': False, 'error': 'banco de dados indisponível'}), 503
+
+    def counted():
+        for rows in chunks:
+            metrics.export_rows.inc(len(rows), tipo=tipo, formato=formato)
+            yield rows
+
+    mimetype, extensao = export.FORMATS[formato]
+    nome = f"kalfix_{tipo}_{inicio.isoformat()}_{fim.isoformat()}{'_' + device_id if device_id else ''}.{extensao}"
+    print(f"[INFO] Exportação {tipo} ({formato}) de {inicio} a {fim} iniciada")
+    response = Response(export.encode(formato, columns, counted()), mimetype=mimetype, direct_passthrough=True,
+                        headers={'Content-Disposition': f'attachment; filename="{nome}"',
+                                 'Cache-Control': 'no-store'})
+    # Download interrompido: fecha o cursor e devolve a conexão ao pool imediatamente
+    response.call_on_close(chunks.close)
+    return response
+
 # (Opcional) mantém suas rotas existentes de CLICK/SOLTO
 @app.route('/CLICK', methods=['GET','POST'])
 def click():
-    socketio.emit('command', {'action': 'click'})
+    broadcast('command', {'action': 'click'})
     return 'Click command sent', 200
 
 @app.route('/SOLTO', methods=['GET','POST'])
 def solto():
-    socketio.emit('command', {'action': 'solto'})
+    broadcast('command', {'action': 'solto'})
     return 'solto command sent', 200
 
 if __name__ == '__main__':
@@ -420,11 +1205,12 @@ if __name__ == '__main__':
     print(f"🗄️  Banco de dados: {db_manager.config.DB_NAME}")
     print("=" * 60)
     
-    # Verifica turno atual ao iniciar
-    check_shift_change()
-    if current_shift:
-        print(f"✅ Turno atual: {current_shift}")
-        print(f"📊 Contador atual: {current_count}")
+    # Verifica turno atual ao iniciar e agenda o motor de turnos
+    start_shift_engine()
+    if shift_snapshot.name:
+        print(f"✅ Turno atual: {shift_snapshot.name}")
+        count, devices = plant_status()
+        print(f"📊 Contador atual: {count} ({len(devices)} dispositivo(s))")
     else:
         print("⏰ Atualmente FORA do horário de turnos")
     
@@ -433,7 +1219,7 @@ if __name__ == '__main__':
     if active_shifts:
         print("📋 Turnos ativos no banco (ainda não finalizados):")
         for shift in active_shifts:
-            print(f"    • {shift['turno_nome']} ({shift['data_turno']}): {shift['contador']} acionamentos (início: {shift['inicio_turno']})")
+            print(f"    • [{shift['device_id']}] {shift['turno_nome']} ({shift['data_turno']}): {shift['contador']} acionamentos (início: {shift['inicio_turno']})")
     else:
         print("📋 Não há turnos ativos registrados no banco.")
     
@@ -458,5 +1244,6 @@ if __name__ == '__main__':
     except KeyboardInterrupt:
         print("\n🛑 Servidor interrompido pelo usuário")
     finally:
+        flush_device_touch()
         db_manager.disconnect()
         print("👋 Desconectando do banco de dados...")
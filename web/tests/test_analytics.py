@@ -0,0 +1,138 @@
+# test_analytics.py
+"""Transições do StoppageDetector: parada, retomada, lentidão e volta ao normal.
+
+Uso (na pasta web): python -m unittest discover -s tests
+"""
+import os
+import sys
+import unittest
+from datetime import datetime, timedelta
+
+sys.path.append(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+from analytics import StoppageDetector  # noqa: E402
+
+T0 = datetime(2024, 5, 6, 6, 0)
+DEV = 'linha01'
+
+
+def at(seconds):
+    return T0 + timedelta(seconds=seconds)
+
+
+class DetectorCase(unittest.TestCase):
+    def setUp(self):
+        self.det = StoppageDetector(stop_after_s=180, slow_ratio=0.6, tau_s=300)
+        self.count = 0
+        self.t = 0
+
+    def step(self, pieces, seconds=60, expected=None):
+        """Avança o relógio, soma 'pieces' ao contador e retorna os tipos de evento."""
+        self.t += seconds
+        self.count += pieces
+        return [e['tipo'] for e in self.det.observe(DEV, self.count, expected, at(self.t))]
+
+    def run_rate(self, per_min, minutes, expected):
+        events = []
+        for _ in range(minutes):
+            events += self.step(per_min, expected=expected)
+        return events
+
+
+class StopResumeTest(DetectorCase):
+    def test_first_observation_is_baseline(self):
+        self.assertEqual(self.det.observe(DEV, 100, None, T0), [])
+        # Mesmo instante (ou anterior) é ignorado
+        self.assertEqual(self.det.observe(DEV, 100, None, T0), [])
+
+    def test_stop_then_resume(self):
+        self.det.observe(DEV, 0, None, T0)
+        self.assertEqual(self.step(5), [])
+        self.assertEqual(self.step(0), [])
+        self.assertEqual(self.step(0), [])
+        events = self.det.observe(DEV, self.count, None, at(self.t + 60))
+        self.t += 60
+        self.assertEqual([e['tipo'] for e in events], ['parada'])
+        self.assertEqual(events[0]['inicio'], at(60))
+        self.assertEqual(self.det.open_stops(), [(DEV, None)])
+        # Parada já reportada: sem eventos repetidos
+        self.assertEqual(self.step(0), [])
+        self.det.set_stop_id(DEV, 17)
+        events = self.det.observe(DEV, self.count + 3, None, at(self.t + 60))
+        self.assertEqual(len(events), 1)
+        self.assertEqual(events[0]['tipo'], 'retomada')
+        self.assertEqual((events[0]['inicio'], events[0]['fim'], events[0]['stop_id']),
+                         (at(60), at(self.t + 60), 17))
+        self.assertEqual(self.det.open_stops(), [])
+
+    def test_expected_rate_extends_stop_limit(self):
+        # 0,5 peça/min: 3 peças levam 360 s, mais que stop_after_s
+        self.det.observe(DEV, 0, 0.5, T0)
+        self.assertEqual(self.step(0, seconds=120, expected=0.5), [])
+        self.assertEqual(self.step(0, seconds=120, expected=0.5), [])
+        # Aos 360 s: parada (tem precedência sobre lentidão)
+        self.assertEqual(self.step(0, seconds=120, expected=0.5), ['parada'])
+
+    def test_counter_going_back_is_not_progress(self):
+        # Contador menor (ex.: dispositivo reiniciou) não conta como avanço
+        self.det.observe(DEV, 50, None, T0)
+        self.assertEqual(self.det.observe(DEV, 10, None, at(100)), [])
+        events = self.det.observe(DEV, 10, None, at(200))
+        self.assertEqual([e['tipo'] for e in events], ['parada'])
+        events = self.det.observe(DEV, 11, None, at(260))
+        self.assertEqual([e['tipo'] for e in events], ['retomada'])
+
+    def test_resume_stop_from_database(self):
+        self.det.resume_stop(DEV, 99, at(-600))
+        self.det.observe(DEV, 0, None, T0)
+        events = self.det.observe(DEV, 1, None, at(30))
+        self.assertEqual([e['tipo'] for e in events], ['retomada'])
+        self.assertEqual((events[0]['inicio'], events[0]['stop_id']), (at(-600), 99))
+
+    def test_reset_forgets_state(self):
+        self.det.observe(DEV, 0, None, T0)
+        self.det.observe(DEV, 0, None, at(600))
+        self.assertTrue(self.det.open_stops())
+        self.det.reset('2024-05-06.2')
+        self.assertEqual((self.det.shift_key, self.det.open_stops()), ('2024-05-06.2', []))
+
+
+class SlowdownTest(DetectorCase):
+    EXPECTED = 10.0  # peças/min
+
+    def setUp(self):
+        super().setUp()
+        self.det.observe(DEV, 0, self.EXPECTED, T0)
+
+    def test_no_slowdown_before_tau(self):
+        # Ritmo baixo desde o início, mas ainda sem tau_s de observação
+        self.assertEqual(self.run_rate(2, 4, self.EXPECTED), [])
+        self.assertEqual(self.step(2, expected=self.EXPECTED), ['lentidao'])
+
+    def test_slowdown_and_recovery(self):
+        self.assertEqual(self.run_rate(10, 6, self.EXPECTED), [])
+        events = self.run_rate(4, 15, self.EXPECTED)
+        self.assertEqual(events, ['lentidao'])
+        events = self.run_rate(10, 15, self.EXPECTED)
+        self.assertEqual(events, ['normal'])
+
+    def test_hysteresis(self):
+        self.run_rate(10, 6, self.EXPECTED)
+        self.assertEqual(self.run_rate(4, 15, self.EXPECTED), ['lentidao'])
+        # 7/min passa do limiar de lentidão (6) mas não do de volta (8)
+        self.assertEqual(self.run_rate(7, 30, self.EXPECTED), [])
+
+    def test_resume_clears_slowdown(self):
+        self.run_rate(10, 6, self.EXPECTED)
+        self.assertEqual(self.run_rate(4, 15, self.EXPECTED), ['lentidao'])
+        self.assertEqual(self.step(0, seconds=200, expected=self.EXPECTED), ['parada'])
+        # Retomada reinicia o ritmo no atual: sem 'normal' nem nova 'lentidao' na hora
+        self.assertEqual(self.step(10, expected=self.EXPECTED), ['retomada'])
+        self.assertEqual(self.run_rate(10, 5, self.EXPECTED), [])
+
+    def test_no_expected_rate_no_slowdown(self):
+        self.assertEqual(self.run_rate(1, 30, None), [])
+
+
+if __name__ == '__main__':
+    unittest.main()
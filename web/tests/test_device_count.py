@@ -0,0 +1,145 @@
+# test_device_count.py
+"""Contador acumulado do dispositivo com requisições concorrentes (PostgreSQL).
+
+Reproduz a corrida da criação do turno: a primeira requisição insere a linha e,
+antes do commit, chega a segunda (reenvio após timeout, ou USB e Wi-Fi com o mesmo
+total). A soma dos deltas tem de ser o total do turno, e a meta padrão é copiada
+uma vez só.
+
+Precisa de um banco de testes descartável em TEST_DATABASE_URL (sem ele, os testes
+são pulados). Uso (na pasta web):
+    TEST_DATABASE_URL=postgresql://.../kalfix_test python -m unittest discover -s tests
+"""
+import os
+import sys
+import threading
+import time
+import unittest
+from datetime import date
+
+sys.path.append(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+TEST_DATABASE_URL = os.getenv('TEST_DATABASE_URL')
+DEVICE = 'test-corrida'
+TURNO = 'Turno 1 (06:00 - 16:00 h)'
+
+
+@unittest.skipUnless(TEST_DATABASE_URL, 'TEST_DATABASE_URL não definida')
+class ConcurrentFirstInsertTest(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        import psycopg2
+        from database import DatabaseManager
+        cls.db = DatabaseManager()
+        cls.db.config.DATABASE_URL = TEST_DATABASE_URL
+        assert cls.db.connect()
+        cls.db.create_tables()
+        cls.monitor = psycopg2.connect(TEST_DATABASE_URL)
+        cls.monitor.autocommit = True
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.monitor.close()
+        cls.db.disconnect()
+
+    def setUp(self):
+        self.clean()
+
+    def tearDown(self):
+        self.clean()
+
+    def clean(self):
+        with self.monitor.cursor() as cur:
+            cur.execute("DELETE FROM shifts WHERE device_id = %s", (DEVICE,))
+            cur.execute("DELETE FROM devices WHERE device_id = %s", (DEVICE,))
+
+    def wait_for_lock_waiter(self, timeout=5.0):
+        """Espera alguma sessão do banco ficar bloqueada num lock de linha."""
+        deadline = time.monotonic() + timeout
+        with self.monitor.cursor() as cur:
+            while time.monotonic() < deadline:
+                cur.execute("SELECT COUNT(*) FROM pg_stat_activity "
+                            "WHERE datname = current_database() AND wait_event_type = 'Lock'")
+                if cur.fetchone()[0]:
+                    return True
+                time.sleep(0.01)
+        return False
+
+    def race(self, day, first_value, second_value, first_call):
+        """Roda 'first_call' até a inserção, segura a transação até a segunda requisição
+        bloquear e então faz o commit. Retorna os dois resultados e as metas copiadas."""
+        db = self.db
+        inserted = threading.Event()
+        goal_calls = []
+        original = db._apply_default_goal
+        first_thread = []
+
+        def hooked(shift_id, turno_nome):
+            goal_calls.append(shift_id)
+            original(shift_id, turno_nome)
+            if threading.current_thread() in first_thread:
+                inserted.set()
+                self.assertTrue(self.wait_for_lock_waiter(), 'a segunda requisição não bloqueou')
+
+        results = {}
+
+        def run(name, value):
+            try:
+                results[name] = first_call(db, day, value)
+            finally:
+                db.release()
+
+        db._apply_default_goal = hooked
+        try:
+            a = threading.Thread(target=run, args=('a', first_value))
+            b = threading.Thread(target=run, args=('b', second_value))
+            first_thread.append(a)
+            a.start()
+            self.assertTrue(inserted.wait(5))
+            b.start()
+            a.join(10)
+            b.join(10)
+        finally:
+            del db._apply_default_goal
+        return results['a'], results['b'], goal_calls
+
+    @staticmethod
+    def update_shift(db, day, value):
+        return db.update_device_count(DEVICE, TURNO, day, value)
+
+    def test_same_total_counts_once(self):
+        a, b, goals = self.race(date(2001, 1, 1), 100, 100, self.update_shift)
+        self.assertEqual(a, (100, 100))
+        self.assertEqual(b, (100, 0))
+        self.assertEqual(len(goals), 1)
+
+    def test_larger_total_adds_only_the_difference(self):
+        a, b, goals = self.race(date(2001, 1, 2), 100, 150, self.update_shift)
+        self.assertEqual(a, (100, 100))
+        self.assertEqual(b, (150, 50))
+        self.assertEqual(len(goals), 1)
+
+    def test_smaller_total_keeps_maximum(self):
+        a, b, _ = self.race(date(2001, 1, 3), 100, 60, self.update_shift)
+        self.assertEqual(a, (100, 100))
+        self.assertEqual(b, (100, 0))
+
+    def test_sequential_updates(self):
+        day = date(2001, 1, 4)
+        self.assertEqual(self.db.update_device_count(DEVICE, TURNO, day, 10), (10, 10))
+        self.assertEqual(self.db.update_device_count(DEVICE, TURNO, day, 25), (25, 15))
+        self.assertEqual(self.db.update_device_count(DEVICE, TURNO, day, 20), (25, 0))
+        self.db.release()
+
+    def test_offshift_count(self):
+        db = self.db
+        self.assertEqual(db.update_offshift_count(DEVICE, 'k1', 7), (7, 7))
+        self.assertEqual(db.update_offshift_count(DEVICE, 'k1', 7), (7, 0))
+        self.assertEqual(db.update_offshift_count(DEVICE, 'k1', 9), (9, 2))
+        # Novo período fora de turno: recomeça
+        self.assertEqual(db.update_offshift_count(DEVICE, 'k2', 3), (3, 3))
+        db.release()
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,97 @@
+# test_pagination.py
+"""Cursores da paginação por chave: ida e volta, cursores inválidos e páginas.
+
+Uso (na pasta web): python -m unittest discover -s tests
+"""
+import base64
+import os
+import sys
+import unittest
+from datetime import date, datetime
+
+sys.path.append(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+import pagination  # noqa: E402
+
+
+class CursorTest(unittest.TestCase):
+    def test_round_trip(self):
+        cases = [
+            (date(2024, 5, 6), 0, date),
+            (date(2024, 12, 31), 123456789, date),
+            (datetime(2024, 5, 6, 22, 15, 3), 42, datetime),
+            (datetime(2024, 5, 6, 22, 15, 3, 120500), 7, datetime),
+        ]
+        for value, row_id, kind in cases:
+            with self.subTest(value=value, row_id=row_id):
+                text = pagination.encode_cursor(value, row_id)
+                # Opaco e seguro em URL: sem padding nem caracteres reservados
+                self.assertNotIn('=', text)
+                self.assertNotIn('+', text)
+                self.assertNotIn('/', text)
+                self.assertEqual(pagination.decode_cursor(text, kind), (value, row_id))
+
+    def test_no_cursor_is_first_page(self):
+        self.assertIsNone(pagination.decode_cursor(None))
+        self.assertIsNone(pagination.decode_cursor(''))
+
+    def test_invalid_cursors(self):
+        def b64(raw):
+            return base64.urlsafe_b64encode(raw).decode().rstrip('=')
+
+        cases = {
+            'nao e base64': '@@@',
+            'sem separador': b64(b'2024-05-06'),
+            'data invalida': b64(b'2024-13-40|1'),
+            'id nao numerico': b64(b'2024-05-06|abc'),
+            'bytes invalidos': b64(b'\xff\xfe|1'),
+            'timestamp como data': b64(b'2024-05-06T10:00:00|1'),
+        }
+        for name, text in cases.items():
+            with self.subTest(name):
+                with self.assertRaisesRegex(ValueError, 'cursor inválido'):
+                    pagination.decode_cursor(text, date)
+
+    def test_page_limit(self):
+        self.assertEqual(pagination.page_limit(None), pagination.DEFAULT_LIMIT)
+        self.assertEqual(pagination.page_limit(None, 50), 50)
+        self.assertEqual(pagination.page_limit(0), 1)
+        self.assertEqual(pagination.page_limit(-5), 1)
+        self.assertEqual(pagination.page_limit(10), 10)
+        self.assertEqual(pagination.page_limit(10 ** 6), pagination.MAX_LIMIT)
+
+
+class SplitPageTest(unittest.TestCase):
+    # Linhas (data, id) em ordem decrescente, com datas repetidas
+    ROWS = [(date(2024, 5, d), i) for i, d in enumerate([9, 9, 9, 8, 7, 7, 5, 5, 5, 5, 2], start=1)]
+    ROWS.sort(key=lambda r: (r[0], r[1]), reverse=True)
+
+    def fetch(self, after, limit):
+        """Simula a consulta: linhas abaixo da chave, LIMIT limit + 1."""
+        rows = [r for r in self.ROWS if after is None or (r[0], r[1]) < after]
+        return rows[:limit + 1]
+
+    def test_walk_all_pages_through_cursor(self):
+        for limit in (1, 2, 3, 4, 10, 11, 50):
+            with self.subTest(limit=limit):
+                seen, cursor = [], None
+                while True:
+                    after = pagination.decode_cursor(cursor, date)
+                    rows, next_key = pagination.split_page(self.fetch(after, limit), limit, lambda r: r)
+                    self.assertLessEqual(len(rows), limit)
+                    seen.extend(rows)
+                    if next_key is None:
+                        break
+                    cursor = pagination.encode_cursor(*next_key)
+                self.assertEqual(seen, self.ROWS)
+
+    def test_last_page_has_no_cursor(self):
+        rows, next_key = pagination.split_page(self.ROWS[:3], 3, lambda r: r)
+        self.assertEqual(len(rows), 3)
+        self.assertIsNone(next_key)
+        rows, next_key = pagination.split_page(self.ROWS[:4], 3, lambda r: r)
+        self.assertEqual(next_key, self.ROWS[2])
+
+
+if __name__ == '__main__':
+    unittest.main()
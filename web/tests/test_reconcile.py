@@ -0,0 +1,126 @@
+# test_reconcile.py
+"""Hashes e totais da reconciliação conferidos contra o firmware.
+
+Os vetores esperados foram gerados compilando no host as funções do firmware
+(days_from_civil, date_key_days, ledger_bucket, fnv1a e o laço de sync_run) com o
+mesmo ledger abaixo. Se o texto canônico mudar de um lado, estes testes quebram.
+
+Uso (na pasta web): python -m unittest discover -s tests
+"""
+import os
+import sys
+import unittest
+from datetime import date, timedelta
+
+sys.path.append(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+import reconcile  # noqa: E402
+
+T1, T2 = reconcile.SHIFT_NAMES[1], reconcile.SHIFT_NAMES[2]
+
+# Ledger do firmware: (AAAAMMDD, turno, total); o Turno 2 de 14/05 está aberto
+LEDGER = [
+    (date(2024, 5, 6), T1, 812),
+    (date(2024, 5, 6), T2, 640),
+    (date(2024, 5, 7), T1, 905),
+    (date(2024, 5, 12), T2, 17),
+    (date(2024, 5, 13), T1, 1000),
+    (date(2024, 5, 14), T2, 333),
+]
+OPEN = (date(2024, 5, 14), 2)
+# Saída do firmware para o ledger acima ("faixa:hash" de /sync/digest)
+FIRMWARE_DIGESTS = {2835: 0x90F57155, 2836: 0x0E3114E0}
+
+
+class FirmwareVectorTest(unittest.TestCase):
+    def test_empty_bucket_is_offset(self):
+        self.assertEqual(reconcile.EMPTY, 0x811C9DC5)
+        self.assertEqual(reconcile.fnv1a(b''), reconcile.EMPTY)
+
+    def test_single_entry(self):
+        self.assertEqual(reconcile.fnv1a(b'20240506.1:812;'), 0x6B0DCE75)
+
+    def test_buckets_match_firmware(self):
+        self.assertEqual(reconcile.bucket_of(date(2024, 5, 6)), 2835)
+        # Faixas começam na quinta-feira (1970-01-01)
+        self.assertEqual(reconcile.bucket_of(date(2024, 5, 8)), 2835)
+        self.assertEqual(reconcile.bucket_of(date(2024, 5, 9)), 2836)
+        self.assertEqual(reconcile.bucket_range(2836), (date(2024, 5, 9), date(2024, 5, 15)))
+
+    def test_digests_match_firmware(self):
+        self.assertEqual(reconcile.digests(LEDGER, exclude=OPEN), FIRMWARE_DIGESTS)
+
+    def test_digests_ignore_row_order_and_empty_shifts(self):
+        rows = list(reversed(LEDGER)) + [(date(2024, 5, 8), T1, 0), (date(2024, 5, 8), 'Outro', 50)]
+        self.assertEqual(reconcile.digests(rows, exclude=OPEN), FIRMWARE_DIGESTS)
+
+    def test_open_shift_changes_digest(self):
+        self.assertNotEqual(reconcile.digests(LEDGER)[2836], FIRMWARE_DIGESTS[2836])
+
+    def test_format_totals_round_trip(self):
+        text = reconcile.format_totals(LEDGER, exclude=OPEN)
+        self.assertEqual(text, '20240506.1:812,20240506.2:640,20240507.1:905,'
+                               '20240512.2:17,20240513.1:1000')
+        totals = reconcile.parse_totals(text)
+        self.assertEqual(totals[(date(2024, 5, 13), 1)], 1000)
+        self.assertEqual(len(totals), 5)
+
+    def test_parse_key(self):
+        self.assertEqual(reconcile.parse_key('20240514.2'), (date(2024, 5, 14), 2))
+        self.assertIsNone(reconcile.parse_key('0.0'))
+        self.assertIsNone(reconcile.parse_key('20240514.3'))
+        with self.assertRaises(ValueError):
+            reconcile.parse_totals('20240514.3:10')
+
+    def test_parse_digests(self):
+        self.assertEqual(reconcile.parse_digests('2835:90f57155,2836:0e3114e0'), FIRMWARE_DIGESTS)
+        self.assertEqual(reconcile.parse_digests(''), {})
+
+
+def full_ledger_total(day, turno):
+    """Total sintético do turno usado pelo gerador do vetor (ledger cheio)."""
+    return (int(f"{day:%Y%m%d}") % 97) * 7 + turno
+
+
+class FullLedgerTest(unittest.TestCase):
+    """Ledger cheio (LEDGER_MAX_SHIFTS = 64): a faixa mais antiga está só em parte na flash.
+
+    No vetor do firmware o ledger vai de 01/04/2024 Turno 2 a 03/05/2024 Turno 1 (o
+    Turno 1 de 01/04 já foi descartado) e a faixa 2830 começa em 28/03. O servidor tem
+    todos os turnos desde 28/03; com from=20240401.2 a faixa parcial confere.
+    """
+    START = (date(2024, 4, 1), 2)
+    FIRMWARE_DIGESTS = {
+        2830: 0xE0FF6CC0, 2831: 0xF35EC598, 2832: 0x9AD10046,
+        2833: 0xFE3A0E15, 2834: 0x176AE081, 2835: 0x03924AC4,
+    }
+
+    def server_rows(self):
+        rows = []
+        day = date(2024, 3, 28)
+        while day <= date(2024, 5, 3):
+            for turno in (1, 2):
+                rows.append((day, reconcile.SHIFT_NAMES[turno], full_ledger_total(day, turno)))
+            day += timedelta(days=1)
+        return rows
+
+    def test_digests_with_lower_bound_match_firmware(self):
+        open_key = (date(2024, 5, 3), 2)
+        got = reconcile.digests(self.server_rows(), exclude=open_key, start=self.START)
+        self.assertEqual(got, self.FIRMWARE_DIGESTS)
+
+    def test_without_lower_bound_oldest_bucket_always_differs(self):
+        got = reconcile.digests(self.server_rows(), exclude=(date(2024, 5, 3), 2))
+        self.assertNotEqual(got[2830], self.FIRMWARE_DIGESTS[2830])
+        self.assertEqual({b: h for b, h in got.items() if b != 2830},
+                         {b: h for b, h in self.FIRMWARE_DIGESTS.items() if b != 2830})
+
+    def test_totals_skip_shifts_before_lower_bound(self):
+        text = reconcile.format_totals(self.server_rows(), start=self.START)
+        self.assertTrue(text.startswith('20240401.2:'))
+        self.assertNotIn('20240401.1:', text)
+        self.assertNotIn('20240331.', text)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,84 @@
+# test_rollup_perdas.py
+"""Rollup de perdas por motivo ao apagar ou mover um turno fora da retenção (PostgreSQL).
+
+As perdas saem pelo CASCADE do turno; o desconto tem de cair no bucket do próprio
+dispositivo, não no 'default' nem no de outra linha.
+
+Precisa de um banco de testes descartável em TEST_DATABASE_URL (sem ele, os testes
+são pulados). Uso (na pasta web):
+    TEST_DATABASE_URL=postgresql://.../kalfix_test python -m unittest discover -s tests
+"""
+import os
+import sys
+import unittest
+from datetime import date, datetime
+
+sys.path.append(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+TEST_DATABASE_URL = os.getenv('TEST_DATABASE_URL')
+DEVICES = ('test-perdas-a', 'test-perdas-b', 'test-perdas-c', 'default')
+TURNO = 'Turno 1 (06:00 - 16:00 h)'
+DAY = date(2001, 2, 5)
+MOTIVO = 'test-rollup-perdas'
+
+
+@unittest.skipUnless(TEST_DATABASE_URL, 'TEST_DATABASE_URL não definida')
+class RollupPerdasDeleteTest(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        from database import DatabaseManager
+        cls.db = DatabaseManager()
+        cls.db.config.DATABASE_URL = TEST_DATABASE_URL
+        assert cls.db.connect()
+        cls.db.create_tables()
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.db.disconnect()
+
+    def setUp(self):
+        self.clean()
+        losses = [{'device_id': dev, 'turno_nome': TURNO, 'data_turno': DAY, 'quantidade': qtd,
+                   'motivo': MOTIVO, 'data_evento': datetime(2001, 2, 5, 9, 0)}
+                  for dev, qtd in (('test-perdas-a', 5), ('test-perdas-b', 7), ('default', 11))]
+        self.assertEqual(self.db.insert_losses(losses), 3)
+
+    def tearDown(self):
+        self.clean()
+        self.db.release()
+
+    def clean(self):
+        self.execute("DELETE FROM shifts WHERE device_id = ANY(%s) AND data_turno = %s", (list(DEVICES), DAY))
+        self.execute("DELETE FROM rollup_perdas_motivo WHERE motivo = %s", (MOTIVO,))
+
+    def execute(self, sql, params):
+        self.db.cursor.execute(sql, params)
+        self.db.conn.commit()
+
+    def totals(self, period='day'):
+        """Total do motivo de teste por dispositivo no bucket do dia."""
+        self.db.cursor.execute(
+            "SELECT device_id, total FROM rollup_perdas_motivo "
+            "WHERE motivo = %s AND granularidade = %s AND period_start = date_trunc(%s, %s::date)::date",
+            (MOTIVO, period, period, DAY))
+        return {dev: total for dev, total in self.db.cursor.fetchall() if total}
+
+    def test_delete_shift_discounts_its_own_device(self):
+        self.assertEqual(self.totals(), {'test-perdas-a': 5, 'test-perdas-b': 7, 'default': 11})
+        self.execute("DELETE FROM shifts WHERE device_id = %s AND data_turno = %s", ('test-perdas-a', DAY))
+        for period in ('day', 'week', 'month', 'year'):
+            self.assertEqual(self.totals(period), {'test-perdas-b': 7, 'default': 11}, period)
+
+    def test_delete_single_loss_still_discounts(self):
+        self.execute("DELETE FROM perdas p USING shifts s WHERE p.shift_id = s.id "
+                     "AND s.device_id = %s AND p.motivo = %s", ('test-perdas-b', MOTIVO))
+        self.assertEqual(self.totals(), {'test-perdas-a': 5, 'default': 11})
+
+    def test_move_shift_to_other_device(self):
+        self.execute("UPDATE shifts SET device_id = %s WHERE device_id = %s AND data_turno = %s",
+                     ('test-perdas-c', 'test-perdas-b', DAY))
+        self.assertEqual(self.totals(), {'test-perdas-a': 5, 'test-perdas-c': 7, 'default': 11})
+
+
+if __name__ == '__main__':
+    unittest.main()
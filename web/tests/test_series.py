@@ -0,0 +1,85 @@
+# test_series.py
+"""Redução LTTB das séries do gráfico: extremos mantidos, tamanho e ordem.
+
+Uso (na pasta web): python -m unittest discover -s tests
+"""
+import os
+import sys
+import unittest
+from datetime import datetime, timedelta
+
+sys.path.append(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+import series  # noqa: E402
+
+
+def shape(name, n):
+    """Séries de teste com formas diferentes (constante, rampa, serra, pico isolado)."""
+    if name == 'constante':
+        return [5] * n
+    if name == 'rampa':
+        return list(range(n))
+    if name == 'serra':
+        return [i % 7 for i in range(n)]
+    if name == 'pico':
+        return [1000 if i == n // 2 else 10 for i in range(n)]
+    raise ValueError(name)
+
+
+# (forma, n pontos, orçamento)
+CASES = [
+    ('constante', 10, 3),
+    ('constante', 500, 50),
+    ('rampa', 4, 3),
+    ('rampa', 100, 10),
+    ('rampa', 1001, 200),
+    ('serra', 37, 5),
+    ('serra', 365, 30),
+    ('pico', 99, 3),
+    ('pico', 1000, 20),
+]
+
+
+class LttbTest(unittest.TestCase):
+    def test_keeps_endpoints_and_budget(self):
+        for name, n, budget in CASES:
+            with self.subTest(forma=name, n=n, orcamento=budget):
+                ys = shape(name, n)
+                idx = series.lttb_indices(list(range(n)), ys, budget)
+                self.assertEqual(idx[0], 0)
+                self.assertEqual(idx[-1], n - 1)
+                self.assertEqual(len(idx), budget)
+                self.assertEqual(idx, sorted(set(idx)))
+
+    def test_keeps_isolated_peak(self):
+        for n, budget in ((99, 3), (1000, 20), (51, 10)):
+            with self.subTest(n=n, orcamento=budget):
+                idx = series.lttb_indices(list(range(n)), shape('pico', n), budget)
+                self.assertIn(n // 2, idx)
+
+    def test_no_reduction(self):
+        # Orçamento maior que a série ou menor que 3: todos os pontos
+        for n, budget in ((0, 10), (1, 10), (2, 2), (10, 10), (10, 50), (10, 2), (10, 0)):
+            with self.subTest(n=n, orcamento=budget):
+                self.assertEqual(series.lttb_indices(list(range(n)), [1] * n, budget), list(range(n)))
+
+    def test_downsample_points(self):
+        inicio = datetime(2024, 5, 1)
+        points = [{'x': (inicio + timedelta(hours=h)).isoformat(), 'producao': (h * 37) % 101, 'perdas': 0}
+                  for h in range(240)]
+        reduced = series.downsample(points, 24)
+        self.assertEqual(len(reduced), 24)
+        self.assertIs(reduced[0], points[0])
+        self.assertIs(reduced[-1], points[-1])
+        self.assertIs(series.downsample(points, 500), points)
+
+    def test_downsample_both_shifts_weight(self):
+        points = [{'x': datetime(2024, 5, d).isoformat(), 't1_producao': d, 't1_perdas': 0,
+                   't2_producao': 100 if d == 15 else 0, 't2_perdas': 0} for d in range(1, 31)]
+        reduced = series.downsample(points, 5)
+        self.assertIn(points[14], reduced)
+        self.assertEqual((reduced[0], reduced[-1]), (points[0], points[-1]))
+
+
+if __name__ == '__main__':
+    unittest.main()
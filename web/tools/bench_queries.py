@@ -0,0 +1,242 @@
+# bench_queries.py
+"""Benchmark das consultas de relatório do DatabaseManager com EXPLAIN ANALYZE.
+
+Para cada caso, chama o método real do DatabaseManager capturando o SQL que ele
+executa (cursor gravador) e roda `EXPLAIN (ANALYZE, BUFFERS, FORMAT JSON)` sobre
+cada SELECT capturado. Registra, pela mediana de N repetições:
+- tempo total do método (Python + rede + banco) e tempo de execução no banco;
+- tempo de planejamento, buffers lidos do cache/disco;
+- resumo do plano (nós e índices usados), para detectar Seq Scan inesperado.
+
+Os resultados podem ser gravados como baseline (--save) e comparados numa
+execução posterior (--compare): o script sai com código 1 se algum caso ficou
+mais lento que a tolerância ou passou a fazer Seq Scan em tabela grande.
+
+Rode contra um banco populado por tools/gen_dataset.py. Uso (na pasta web):
+    python tools/bench_queries.py --dsn postgresql://.../kalfix_bench --save bench_baseline.json
+    python tools/bench_queries.py --dsn postgresql://.../kalfix_bench --compare bench_baseline.json
+"""
+import argparse
+import json
+import os
+import statistics
+import sys
+import time
+from datetime import date, timedelta
+
+sys.path.append(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+TURNO_1 = 'Turno 1 (06:00 - 16:00 h)'
+TURNO_2 = 'Turno 2 (22:00 - 06:00 h)'
+# Tabelas em que um Seq Scan indica índice faltando (as demais são pequenas)
+LARGE_TABLES = {'shifts', 'perdas', 'metas', 'producao_minuto'}
+
+
+class RecordingCursor:
+    """Repassa tudo ao cursor real e guarda o SQL final (já com parâmetros) de cada execute."""
+
+    def __init__(self, cursor):
+        self._cursor = cursor
+        self.statements = []
+
+    def execute(self, query, params=None):
+        self.statements.append(self._cursor.mogrify(query, params).decode())
+        return self._cursor.execute(query, params)
+
+    def __getattr__(self, name):
+        return getattr(self._cursor, name)
+
+    def __iter__(self):
+        return iter(self._cursor)
+
+
+def build_cases(device_id):
+    """Casos do benchmark: (nome, nome do método, args, kwargs)."""
+    today = date.today()
+    yesterday = today - timedelta(days=1)
+    cases = [
+        ('historico_10d', 'get_shift_history', (10,), {}),
+        ('historico_90d', 'get_shift_history', (90,), {}),
+        ('historico_90d_device', 'get_shift_history', (90,), {'device_id': device_id}),
+        ('ranking_ontem', 'get_shifts_efficiency_ranking', (yesterday,), {}),
+        ('eficiencia_30d', 'get_daily_efficiency_series', (30,), {}),
+        ('eficiencia_30d_device', 'get_daily_efficiency_series', (30,), {'device_id': device_id}),
+        ('perdas_24h', 'get_losses_history', (24,), {}),
+        ('perdas_24h_device', 'get_losses_history', (24,), {'device_id': device_id}),
+        ('historico_pagina', 'get_shift_history_page', (today - timedelta(days=9),), {}),
+        ('turnos_pagina', 'get_shifts_page', (), {}),
+        ('turnos_pagina_device', 'get_shifts_page', (), {'device_id': device_id}),
+        ('perdas_pagina', 'get_losses_page', (), {}),
+        ('turnos_abertos', 'get_current_shifts', (), {}),
+        ('metricas_turno', 'get_shift_metrics', (TURNO_1, yesterday), {}),
+        ('metricas_turno_device', 'get_shift_metrics', (TURNO_1, yesterday), {'device_id': device_id}),
+        ('status_dispositivos', 'get_devices_status', (TURNO_1, today, None), {}),
+        ('vazao_8h', 'get_throughput', (None, None), {}),
+    ]
+    for period in ('day', 'week', 'month', 'year'):
+        cases.append((f'agregados_{period}', 'get_period_aggregates', (period, yesterday), {}))
+        cases.append((f'perdas_motivo_{period}', 'get_losses_distribution', (period, yesterday), {}))
+        for mode in ('total', 'ambos'):
+            cases.append((f'performance_{period}_{mode}', 'get_performance_data', (period, mode), {}))
+    cases.append(('performance_month_device', 'get_performance_data', ('month', 'total'), {'device_id': device_id}))
+    return cases
+
+
+def summarize_plan(node, summary):
+    """Percorre o plano JSON acumulando tipos de nó, índices e Seq Scans."""
+    kind = node.get('Node Type')
+    relation = node.get('Relation Name')
+    if kind:
+        summary['nodes'].add(kind)
+    if node.get('Index Name'):
+        summary['indexes'].add(node['Index Name'])
+    if kind == 'Seq Scan' and relation:
+        # Partições de producao_minuto contam como a tabela-mãe
+        base = 'producao_minuto' if relation.startswith('producao_minuto') else relation
+        summary['seq_scans'].add(base)
+    for child in node.get('Plans', []):
+        summarize_plan(child, summary)
+
+
+def explain(db, statement):
+    """EXPLAIN ANALYZE de uma consulta; retorna (exec ms, plan ms, buffers hit, buffers read, resumo)."""
+    cur = db.conn.cursor()
+    try:
+        cur.execute("EXPLAIN (ANALYZE, BUFFERS, FORMAT JSON) " + statement)
+        result = cur.fetchone()[0]
+        plan = result[0] if isinstance(result, list) else json.loads(result)[0]
+    finally:
+        cur.close()
+        # EXPLAIN ANALYZE executa a consulta: nunca deixa efeitos colaterais
+        db.conn.rollback()
+    root = plan['Plan']
+    summary = {'nodes': set(), 'indexes': set(), 'seq_scans': set()}
+    summarize_plan(root, summary)
+    return (plan.get('Execution Time', 0.0), plan.get('Planning Time', 0.0),
+            root.get('Shared Hit Blocks', 0), root.get('Shared Read Blocks', 0), summary)
+
+
+def run_case(db, method_name, args, kwargs, repeat):
+    """Executa o caso N vezes; retorna as medianas e o resumo dos planos."""
+    method = getattr(db, method_name)
+    if method_name == 'get_throughput':
+        # Janela relativa ao momento da execução
+        from datetime import datetime
+        fim = datetime.now()
+        args = (fim - timedelta(hours=8), fim)
+
+    wall, exec_ms, plan_ms, hit, read = [], [], [], [], []
+    summary = {'nodes': set(), 'indexes': set(), 'seq_scans': set()}
+    statements = []
+    for _ in range(repeat):
+        recorder = RecordingCursor(db.conn.cursor())
+        db._local.cursor = recorder
+        start = time.perf_counter()
+        method(*args, **kwargs)
+        wall.append((time.perf_counter() - start) * 1000.0)
+        db.conn.rollback()
+        db._local.cursor = None
+        statements = [s for s in recorder.statements
+                      if s.lstrip().upper().startswith(('SELECT', 'WITH'))]
+        total = [0.0, 0.0, 0, 0]
+        for statement in statements:
+            e, p, h, r, s = explain(db, statement)
+            total[0] += e
+            total[1] += p
+            total[2] += h
+            total[3] += r
+            for key in summary:
+                summary[key] |= s[key]
+        exec_ms.append(total[0])
+        plan_ms.append(total[1])
+        hit.append(total[2])
+        read.append(total[3])
+    return {
+        'metodo': method_name,
+        'consultas': len(statements),
+        'wall_ms': round(statistics.median(wall), 3),
+        'exec_ms': round(statistics.median(exec_ms), 3),
+        'plan_ms': round(statistics.median(plan_ms), 3),
+        'buffers_hit': int(statistics.median(hit)),
+        'buffers_read': int(statistics.median(read)),
+        'nos': sorted(summary['nodes']),
+        'indices': sorted(summary['indexes']),
+        'seq_scans': sorted(summary['seq_scans'] & LARGE_TABLES),
+    }
+
+
+def compare(results, baseline, tolerance, min_delta_ms):
+    """Lista as regressões em relação ao baseline."""
+    regressions = []
+    for name, cur in results.items():
+        base = baseline.get(name)
+        if not base:
+            continue
+        delta = cur['exec_ms'] - base['exec_ms']
+        if cur['exec_ms'] > base['exec_ms'] * (1 + tolerance) and delta > min_delta_ms:
+            regressions.append(f"{name}: {base['exec_ms']:.2f} ms -> {cur['exec_ms']:.2f} ms (+{delta:.2f} ms)")
+        novos = set(cur['seq_scans']) - set(base['seq_scans'])
+        if novos:
+            regressions.append(f"{name}: novo Seq Scan em {', '.join(sorted(novos))}")
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--dsn', default=None, help='banco a medir (padrão: DATABASE_URL do .env)')
+    parser.add_argument('--repeat', type=int, default=5, help='repetições por caso (mediana)')
+    parser.add_argument('--device', default='sim-linha01', help='dispositivo usado nos casos filtrados')
+    parser.add_argument('--only', default=None, help='roda apenas casos cujo nome contém este texto')
+    parser.add_argument('--save', default=None, help='grava os resultados como baseline JSON')
+    parser.add_argument('--compare', default=None, help='compara com um baseline JSON')
+    parser.add_argument('--tolerance', type=float, default=0.25, help='piora relativa aceita (0.25 = 25%%)')
+    parser.add_argument('--min-delta-ms', type=float, default=2.0, help='piora absoluta mínima para acusar regressão')
+    opts = parser.parse_args()
+
+    from database import db_manager
+    if opts.dsn:
+        db_manager.config.DATABASE_URL = opts.dsn
+    if not db_manager.connect():
+        print("[ERRO] Não foi possível conectar ao banco")
+        return 1
+
+    db_manager.cursor.execute("SELECT COUNT(*) FROM shifts")
+    n_shifts = db_manager.cursor.fetchone()[0]
+    db_manager.conn.rollback()
+    print(f"[INFO] {n_shifts} turnos no banco; {opts.repeat} repetição(ões) por caso.\n")
+
+    results = {}
+    print(f"{'caso':34s} {'wall ms':>9s} {'exec ms':>9s} {'plan ms':>8s} {'hit':>8s} {'read':>7s}  índices / seq scans")
+    for name, method_name, args, kwargs in build_cases(opts.device):
+        if opts.only and opts.only not in name:
+            continue
+        r = run_case(db_manager, method_name, args, kwargs, opts.repeat)
+        results[name] = r
+        extra = ', '.join(r['indices']) or '-'
+        if r['seq_scans']:
+            extra += f"  [SEQ: {', '.join(r['seq_scans'])}]"
+        print(f"{name:34s} {r['wall_ms']:9.2f} {r['exec_ms']:9.2f} {r['plan_ms']:8.2f} "
+              f"{r['buffers_hit']:8d} {r['buffers_read']:7d}  {extra}")
+    db_manager.disconnect()
+
+    payload = {'shifts': n_shifts, 'repeat': opts.repeat, 'casos': results}
+    if opts.save:
+        with open(opts.save, 'w', encoding='utf-8') as f:
+            json.dump(payload, f, indent=2, ensure_ascii=False)
+        print(f"\n[OK] Baseline gravado em {opts.save}")
+
+    if opts.compare:
+        with open(opts.compare, encoding='utf-8') as f:
+            baseline = json.load(f)
+        regressions = compare(results, baseline.get('casos', {}), opts.tolerance, opts.min_delta_ms)
+        if regressions:
+            print(f"\n[ERRO] {len(regressions)} regressão(ões) em relação a {opts.compare}:")
+            for line in regressions:
+                print(f"  - {line}")
+            return 1
+        print(f"\n[OK] Nenhuma regressão em relação a {opts.compare}")
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
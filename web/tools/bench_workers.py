@@ -0,0 +1,131 @@
+# bench_workers.py
+"""Mede a vazão de /update em função do número de workers do gunicorn.
+
+Para cada quantidade de workers, sobe o servidor em modo de produção (wsgi.py +
+gunicorn.conf.py), dispara dispositivos simulados enviando contadores crescentes
+e mede requisições/s e latência. Requer o mesmo .env do servidor (DATABASE_URL,
+SOCKETIO_MESSAGE_QUEUE) e grava dados com device_id 'bench-*'.
+
+Uso (na pasta web):
+    python tools/bench_workers.py --workers 1,2,4,8 --devices 200 --duration 20
+"""
+import argparse
+import http.client
+import multiprocessing
+import os
+import subprocess
+import sys
+import time
+
+WEB_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+
+def wait_ready(host, port, timeout_s=30):
+    """Aguarda o servidor responder em /debug_status."""
+    deadline = time.time() + timeout_s
+    while time.time() < deadline:
+        try:
+            conn = http.client.HTTPConnection(host, port, timeout=2)
+            conn.request('GET', '/debug_status')
+            if conn.getresponse().status == 200:
+                return True
+        except OSError:
+            pass
+        time.sleep(0.5)
+    return False
+
+
+def run_devices(args):
+    """Processo gerador: cada dispositivo envia contadores crescentes em sequência."""
+    host, port, device_ids, duration_s = args
+    conns = {d: http.client.HTTPConnection(host, port, timeout=10) for d in device_ids}
+    counters = dict.fromkeys(device_ids, 0)
+    latencies = []
+    errors = 0
+    end = time.time() + duration_s
+    while time.time() < end:
+        for device_id in device_ids:
+            counters[device_id] += 1
+            t0 = time.perf_counter()
+            try:
+                conn = conns[device_id]
+                conn.request('GET', f"/update?counter={counters[device_id]}&device={device_id}")
+                resp = conn.getresponse()
+                resp.read()
+                if resp.status != 200:
+                    errors += 1
+            except OSError:
+                errors += 1
+                conns[device_id] = http.client.HTTPConnection(host, port, timeout=10)
+            latencies.append(time.perf_counter() - t0)
+    return latencies, errors
+
+
+def bench(workers, opts):
+    env = dict(os.environ,
+               WEB_WORKERS=str(workers),
+               FLASK_SERVER_HOST=opts.host,
+               FLASK_SERVER_PORT=str(opts.port),
+               SOCKETIO_WEBSOCKET_ONLY='true')
+    server = subprocess.Popen([sys.executable, '-m', 'gunicorn', '-c', 'gunicorn.conf.py', 'wsgi:app'],
+                              cwd=WEB_DIR, env=env,
+                              stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    try:
+        if not wait_ready(opts.host, opts.port):
+            print(f"[ERRO] Servidor com {workers} worker(s) não respondeu")
+            return None
+        device_ids = [f"bench-{i:04d}" for i in range(opts.devices)]
+        chunks = [device_ids[i::opts.procs] for i in range(opts.procs)]
+        t0 = time.time()
+        with multiprocessing.Pool(opts.procs) as pool:
+            results = pool.map(run_devices, [(opts.host, opts.port, c, opts.duration) for c in chunks if c])
+        elapsed = time.time() - t0
+        latencies = sorted(l for lat, _ in results for l in lat)
+        errors = sum(e for _, e in results)
+        if not latencies:
+            return None
+        return {
+            'workers': workers,
+            'rps': len(latencies) / elapsed,
+            'p50_ms': latencies[len(latencies) // 2] * 1000,
+            'p99_ms': latencies[int(len(latencies) * 0.99)] * 1000,
+            'errors': errors
+        }
+    finally:
+        server.terminate()
+        server.wait(timeout=15)
+        # Dá tempo ao SO para liberar a porta
+        time.sleep(1)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--workers', default='1,2,4', help='quantidades de workers, separadas por vírgula')
+    parser.add_argument('--devices', type=int, default=100, help='dispositivos simulados')
+    parser.add_argument('--procs', type=int, default=max(multiprocessing.cpu_count() // 2, 1),
+                        help='processos geradores de carga')
+    parser.add_argument('--duration', type=float, default=15, help='segundos de carga por rodada')
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=5055)
+    opts = parser.parse_args()
+
+    rows = []
+    for workers in [int(w) for w in opts.workers.split(',')]:
+        print(f"[INFO] Rodada com {workers} worker(s)...")
+        row = bench(workers, opts)
+        if row:
+            rows.append(row)
+
+    if not rows:
+        print("[ERRO] Nenhuma rodada concluída")
+        return 1
+    base = rows[0]['rps']
+    print()
+    print(f"{'workers':>8} {'req/s':>10} {'escala':>8} {'p50 ms':>8} {'p99 ms':>8} {'erros':>6}")
+    for r in rows:
+        print(f"{r['workers']:>8} {r['rps']:>10.1f} {r['rps'] / base:>7.2f}x {r['p50_ms']:>8.1f} {r['p99_ms']:>8.1f} {r['errors']:>6}")
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,270 @@
+# gen_dataset.py
+"""Gera um histórico sintético de vários anos e várias linhas para testes de consulta.
+
+Preenche `devices`, `shifts`, `metas` e `perdas` (e opcionalmente a série por
+minuto `producao_minuto`) com dados realistas até a data de hoje:
+- um dispositivo por linha, cada linha com ritmo e meta próprios;
+- Turno 1 todos os dias úteis e sábados, Turno 2 apenas em dias úteis;
+- produção em torno da meta com variação diária, sazonalidade anual e paradas;
+- de 0 a 6 registros de perda por turno, com motivos de frequências diferentes.
+
+Os triggers de rollup são desligados durante a carga e os rollups são
+reconstruídos ao final (muito mais rápido que manter linha a linha).
+
+Use um banco dedicado a testes. Uso (na pasta web):
+    python tools/gen_dataset.py --dsn postgresql://.../kalfix_bench --years 3 --lines 20
+    python tools/gen_dataset.py --dsn ... --years 1 --lines 5 --series-days 30 --truncate
+"""
+import argparse
+import math
+import os
+import random
+import sys
+import time
+from datetime import date, datetime, timedelta
+
+import psycopg2
+import psycopg2.extras
+
+sys.path.append(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+TURNO_1 = 'Turno 1 (06:00 - 16:00 h)'
+TURNO_2 = 'Turno 2 (22:00 - 06:00 h)'
+# (nome, hora de início, duração em horas)
+TURNOS = ((TURNO_1, 6, 10), (TURNO_2, 22, 8))
+# Motivos de perda e peso relativo
+MOTIVOS = (
+    ('Peça com rebarba', 30),
+    ('Dimensional fora da tolerância', 20),
+    ('Setup de máquina', 15),
+    ('Matéria-prima com defeito', 12),
+    ('Quebra de ferramenta', 8),
+    ('Perda registrada manualmente', 15),
+)
+ROLLUP_TRIGGERS = (('shifts', 'trg_rollup_shifts'), ('shifts', 'trg_rollup_shifts_del'),
+                   ('metas', 'trg_rollup_metas'), ('perdas', 'trg_rollup_perdas'))
+BATCH = 5000
+
+
+def shift_runs(day, turno_nome):
+    """Se o turno ocorre neste dia (domingo parado; Turno 2 só de segunda a sexta)."""
+    weekday = day.weekday()
+    if weekday == 6:
+        return False
+    if turno_nome == TURNO_2 and weekday == 5:
+        return False
+    return True
+
+
+def generate_shifts(lines, start, end, rng):
+    """Gera as linhas de shifts (e a meta de cada uma) por linha e dia."""
+    rows = []
+    day = start
+    while day <= end:
+        # Sazonalidade: demanda ~10% menor no meio do ano e em dezembro
+        season = 1.0 - 0.06 * math.cos(2 * math.pi * (day.timetuple().tm_yday / 365.0)) \
+                     - (0.08 if day.month == 12 else 0.0)
+        for line in lines:
+            for turno_nome, hora, duracao in TURNOS:
+                if not shift_runs(day, turno_nome):
+                    continue
+                meta = line['meta'] if turno_nome == TURNO_1 else int(line['meta'] * duracao / 10)
+                # Parada longa ocasional derruba a produção do turno
+                stop_factor = rng.uniform(0.2, 0.7) if rng.random() < 0.03 else 1.0
+                produced = max(int(rng.gauss(meta * line['eficiencia'] * season, meta * 0.08) * stop_factor), 0)
+                inicio = datetime.combine(day, datetime.min.time()) + timedelta(hours=hora, minutes=rng.randint(0, 4))
+                fim = inicio + timedelta(hours=duracao, minutes=rng.randint(-3, 6))
+                # O turno corrente ainda está aberto
+                if fim > datetime.now():
+                    fim = None
+                rows.append((line['device_id'], turno_nome, day, produced, inicio, fim, meta))
+        day += timedelta(days=1)
+    return rows
+
+
+def generate_losses(shift_rows, rng):
+    """Gera os registros de perda de cada turno: (índice do turno, quantidade, motivo, data_evento)."""
+    motivos, pesos = zip(*MOTIVOS)
+    losses = []
+    for idx, (_, _, _, produced, inicio, fim, _) in enumerate(shift_rows):
+        if produced == 0:
+            continue
+        n = min(int(rng.expovariate(1 / 1.8)), 6)
+        end = fim or datetime.now()
+        span = max((end - inicio).total_seconds(), 60)
+        for _ in range(n):
+            quantidade = max(int(rng.expovariate(1 / max(produced * 0.006, 1))), 1)
+            when = inicio + timedelta(seconds=rng.uniform(0, span))
+            losses.append((idx, quantidade, rng.choices(motivos, pesos)[0], when))
+    return losses
+
+
+def insert_shifts(cur, rows):
+    """Insere os turnos em lotes e devolve os ids na mesma ordem."""
+    ids = []
+    for i in range(0, len(rows), BATCH):
+        chunk = rows[i:i + BATCH]
+        result = psycopg2.extras.execute_values(
+            cur,
+            """
+            INSERT INTO shifts (device_id, turno_nome, data_turno, contador, inicio_turno, fim_turno)
+            VALUES %s
+            ON CONFLICT (device_id, turno_nome, data_turno) DO UPDATE SET contador = EXCLUDED.contador
+            RETURNING id
+            """,
+            [r[:6] for r in chunk], page_size=BATCH, fetch=True
+        )
+        ids.extend(row[0] for row in result)
+    return ids
+
+
+def insert_series(cur, shift_rows, series_days, rng):
+    """Distribui a produção dos últimos N dias na série por minuto."""
+    from database import db_manager
+    cutoff = date.today() - timedelta(days=series_days)
+    total = 0
+    batch = []
+    for device_id, _, day, produced, inicio, fim, _ in shift_rows:
+        if day < cutoff or produced == 0:
+            continue
+        end = fim or datetime.now()
+        minutes = max(int((end - inicio).total_seconds() // 60), 1)
+        per_minute = {}
+        for _ in range(produced):
+            m = rng.randrange(minutes)
+            per_minute[m] = per_minute.get(m, 0) + 1
+        base = inicio.replace(second=0, microsecond=0)
+        for m, count in per_minute.items():
+            batch.append((device_id, 0, base + timedelta(minutes=m), count))
+        if len(batch) >= BATCH * 4:
+            total += flush_series(cur, batch, db_manager)
+            batch = []
+    total += flush_series(cur, batch, db_manager)
+    return total
+
+
+def flush_series(cur, batch, db_manager):
+    if not batch:
+        return 0
+    # Turnos vizinhos podem cair no mesmo minuto: soma antes do INSERT (o ON CONFLICT
+    # não aceita a mesma chave duas vezes no mesmo comando)
+    merged = {}
+    for device_id, canal, minuto, count in batch:
+        key = (device_id, canal, minuto)
+        merged[key] = merged.get(key, 0) + count
+    batch = [key + (count,) for key, count in merged.items()]
+    # Garante as partições mensais cobertas pelo lote
+    for month in {(row[2].year, row[2].month) for row in batch}:
+        db_manager.ensure_production_partition(datetime(month[0], month[1], 1))
+    psycopg2.extras.execute_values(
+        cur,
+        """
+        INSERT INTO producao_minuto (device_id, canal, minuto, contagem) VALUES %s
+        ON CONFLICT (device_id, canal, minuto) DO UPDATE SET contagem = producao_minuto.contagem + EXCLUDED.contagem
+        """,
+        batch, page_size=BATCH
+    )
+    return len(batch)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--dsn', default=None, help='banco de destino (padrão: DATABASE_URL do .env)')
+    parser.add_argument('--years', type=float, default=3, help='anos de histórico até hoje')
+    parser.add_argument('--lines', type=int, default=20, help='linhas de produção (um dispositivo por linha)')
+    parser.add_argument('--series-days', type=int, default=0, help='dias recentes também gravados na série por minuto')
+    parser.add_argument('--seed', type=int, default=42)
+    parser.add_argument('--truncate', action='store_true', help='apaga shifts/metas/perdas/devices/séries antes de gerar')
+    opts = parser.parse_args()
+
+    from database import db_manager
+    if opts.dsn:
+        db_manager.config.DATABASE_URL = opts.dsn
+    if not db_manager.connect() or not db_manager.create_tables():
+        print("[ERRO] Não foi possível preparar o banco de destino")
+        return 1
+
+    rng = random.Random(opts.seed)
+    end = date.today()
+    start = end - timedelta(days=int(opts.years * 365))
+    lines = [{
+        'device_id': f"sim-linha{i + 1:02d}",
+        'nome': f"Contador Linha {i + 1:02d}",
+        'linha': f"Linha {i + 1:02d}",
+        'meta': rng.choice((600, 800, 1000, 1200, 1500)),
+        'eficiencia': rng.uniform(0.82, 1.05)
+    } for i in range(opts.lines)]
+
+    t0 = time.time()
+    print(f"[INFO] Gerando {opts.years:g} ano(s) ({start} a {end}) para {opts.lines} linha(s)...")
+    shift_rows = generate_shifts(lines, start, end, rng)
+    losses = generate_losses(shift_rows, rng)
+
+    conn = db_manager.conn
+    cur = db_manager.cursor
+    try:
+        if opts.truncate:
+            cur.execute("TRUNCATE perdas, metas, shifts, devices, producao_minuto RESTART IDENTITY CASCADE")
+            cur.execute("TRUNCATE rollup_producao, rollup_perdas_motivo")
+            print("[INFO] Tabelas esvaziadas.")
+        for table, trigger in ROLLUP_TRIGGERS:
+            cur.execute(f"ALTER TABLE {table} DISABLE TRIGGER {trigger}")
+
+        psycopg2.extras.execute_values(
+            cur,
+            """
+            INSERT INTO devices (device_id, nome, linha, first_seen, last_seen) VALUES %s
+            ON CONFLICT (device_id) DO UPDATE SET nome = EXCLUDED.nome, linha = EXCLUDED.linha
+            """,
+            [(l['device_id'], l['nome'], l['linha'], datetime.combine(start, datetime.min.time()), datetime.now())
+             for l in lines]
+        )
+        ids = insert_shifts(cur, shift_rows)
+        print(f"[OK] {len(ids)} turnos inseridos.")
+
+        psycopg2.extras.execute_values(
+            cur,
+            """
+            INSERT INTO metas (shift_id, meta_turno) VALUES %s
+            ON CONFLICT (shift_id) DO UPDATE SET meta_turno = EXCLUDED.meta_turno
+            """,
+            [(shift_id, row[6]) for shift_id, row in zip(ids, shift_rows)], page_size=BATCH
+        )
+        print(f"[OK] {len(ids)} metas inseridas.")
+
+        psycopg2.extras.execute_values(
+            cur,
+            "INSERT INTO perdas (shift_id, quantidade, motivo, data_evento) VALUES %s",
+            [(ids[idx], q, motivo, when) for idx, q, motivo, when in losses], page_size=BATCH
+        )
+        # shifts.perdas é somado pelo trigger de total de perdas (um UPDATE por lote)
+        print(f"[OK] {len(losses)} perdas inseridas.")
+
+        if opts.series_days > 0:
+            n = insert_series(cur, shift_rows, opts.series_days, rng)
+            print(f"[OK] {n} minutos de série inseridos (últimos {opts.series_days} dias).")
+        conn.commit()
+    except Exception as e:
+        print(f"[ERRO] Falha na geração: {e}")
+        conn.rollback()
+        return 1
+    finally:
+        for table, trigger in ROLLUP_TRIGGERS:
+            cur.execute(f"ALTER TABLE {table} ENABLE TRIGGER {trigger}")
+        conn.commit()
+
+    if not db_manager.rebuild_rollups():
+        return 1
+    conn = db_manager.conn
+    conn.autocommit = True
+    # VACUUM marca as páginas como visíveis: sem ele a primeira medição lê o heap
+    # em cada Index Only Scan e não representa o banco em regime
+    db_manager.cursor.execute("VACUUM ANALYZE")
+    conn.autocommit = False
+    print(f"[OK] Dataset gerado em {time.time() - t0:.1f} s.")
+    db_manager.disconnect()
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
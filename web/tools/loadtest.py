@@ -0,0 +1,392 @@
+# loadtest.py
+"""Teste de carga: dispositivos e painéis simulados contra um servidor em execução.
+
+Simula N contadores (Pico W) enviando /update no ritmo de pulsos configurado e
+M painéis Socket.IO que se comportam como o index.html: a cada evento 'status'
+buscam /metrics/performance, /debug_status e /metrics/shift, e repetem a busca
+dos KPIs a cada 15 s. Quedas de Wi-Fi simuladas deixam os dispositivos offline e,
+na volta, todos reenviam juntos o contador acumulado (rajada de recuperação).
+
+Para cada cenário informa vazão, latência p50/p99 e taxa de erro por tipo de
+requisição, eventos 'status' recebidos e a carga no PostgreSQL (transações/s,
+leituras de disco, taxa de cache e pico de conexões) lida de pg_stat_database.
+
+Requisitos além do requirements.txt: `pip install "python-socketio[client]"`.
+
+Uso (na pasta web, com o servidor rodando e o .env apontando para o mesmo banco):
+    python tools/loadtest.py --url http://127.0.0.1:5000
+    python tools/loadtest.py --scenario frota --duration 120 --json resultado.json
+    python tools/loadtest.py --devices 300 --dashboards 20 --pulses-per-min 40 --outage-at 30 --outage-s 20
+"""
+import argparse
+import calendar
+import http.client
+import json
+import os
+import random
+import sys
+import threading
+import time
+from urllib.parse import urlsplit, quote
+
+sys.path.append(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+# Intervalo mínimo entre envios do firmware (WIFI_SEND_RETRY_MS)
+DEVICE_SEND_INTERVAL_S = 1.0
+# Período do setInterval(scheduleRefresh, 15000) do index.html
+DASHBOARD_REFRESH_S = 15.0
+
+# Cenários prontos: (dispositivos, painéis, pulsos/min por dispositivo, queda em s, duração da queda)
+SCENARIOS = {
+    'linha':   dict(devices=1,   dashboards=2,  pulses_per_min=30, outage_at=None, outage_s=0),
+    'planta':  dict(devices=20,  dashboards=5,  pulses_per_min=30, outage_at=None, outage_s=0),
+    'frota':   dict(devices=200, dashboards=20, pulses_per_min=30, outage_at=None, outage_s=0),
+    'queda':   dict(devices=200, dashboards=20, pulses_per_min=30, outage_at=20,   outage_s=30),
+    'rajada':  dict(devices=500, dashboards=10, pulses_per_min=120, outage_at=10,  outage_s=15),
+}
+
+
+class Recorder:
+    """Latências e erros por tipo de requisição, seguro para threads."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.latencies = {}
+        self.errors = {}
+        self.status_events = 0
+
+    def record(self, kind, seconds, ok):
+        with self.lock:
+            self.latencies.setdefault(kind, []).append(seconds)
+            if not ok:
+                self.errors[kind] = self.errors.get(kind, 0) + 1
+
+    def status_event(self):
+        with self.lock:
+            self.status_events += 1
+
+    def summary(self, elapsed):
+        rows = []
+        with self.lock:
+            for kind, values in sorted(self.latencies.items()):
+                values = sorted(values)
+                n = len(values)
+                errors = self.errors.get(kind, 0)
+                rows.append({
+                    'tipo': kind,
+                    'requisicoes': n,
+                    'req_s': n / elapsed if elapsed > 0 else 0.0,
+                    'p50_ms': values[n // 2] * 1000,
+                    'p99_ms': values[min(int(n * 0.99), n - 1)] * 1000,
+                    'erros': errors,
+                    'taxa_erro': errors / n if n else 0.0
+                })
+            return rows, self.status_events
+
+
+class HttpClient:
+    """Conexão HTTP persistente (keep-alive), como o navegador/dispositivo manteria."""
+
+    def __init__(self, base_url, recorder, timeout=10):
+        parts = urlsplit(base_url)
+        self.https = parts.scheme == 'https'
+        self.host = parts.hostname
+        self.port = parts.port or (443 if self.https else 80)
+        self.timeout = timeout
+        self.recorder = recorder
+        self.conn = None
+
+    def _connect(self):
+        cls = http.client.HTTPSConnection if self.https else http.client.HTTPConnection
+        self.conn = cls(self.host, self.port, timeout=self.timeout)
+
+    def get(self, kind, path):
+        """GET registrando a latência; retorna o corpo ou None em caso de erro."""
+        if self.conn is None:
+            self._connect()
+        start = time.perf_counter()
+        body = None
+        try:
+            self.conn.request('GET', path)
+            resp = self.conn.getresponse()
+            data = resp.read()
+            if resp.status < 400:
+                body = data
+        except (OSError, http.client.HTTPException):
+            self.conn.close()
+            self.conn = None
+        self.recorder.record(kind, time.perf_counter() - start, body is not None)
+        return body
+
+
+class Outage:
+    """Janela de queda de Wi-Fi compartilhada por todos os dispositivos."""
+
+    def __init__(self, start_at, duration_s, t0):
+        self.start = t0 + start_at if start_at is not None else None
+        self.end = self.start + duration_s if self.start is not None else None
+
+    def offline(self, now):
+        return self.start is not None and self.start <= now < self.end
+
+
+def device_loop(device_id, opts, recorder, outage, stop):
+    """Um Pico W: conta pulsos (Poisson) e envia o contador acumulado quando muda."""
+    client = HttpClient(opts.url, recorder)
+    rate_s = opts.pulses_per_min / 60.0 * random.uniform(0.7, 1.3)
+    counter = 0
+    sent = 0
+    fails = 0
+    last_pulse = time.time()
+    next_pulse = time.time() + random.expovariate(rate_s) if rate_s > 0 else float('inf')
+    # Espalha o início para não sincronizar todos os dispositivos
+    next_send = time.time() + random.uniform(0, DEVICE_SEND_INTERVAL_S)
+    while not stop.is_set():
+        now = time.time()
+        while now >= next_pulse:
+            counter += 1
+            last_pulse = next_pulse
+            next_pulse += random.expovariate(rate_s)
+        if now >= next_send:
+            next_send = now + DEVICE_SEND_INTERVAL_S
+            if counter > sent:
+                if outage.offline(now):
+                    # Sem rede: o firmware guarda o último valor e tenta de novo depois
+                    fails += 1
+                else:
+                    # ts como o firmware envia: hora local do último pulso, em segundos "como UTC"
+                    ts = calendar.timegm(time.localtime(last_pulse))
+                    path = f"/update?counter={counter}&device={device_id}&ts={ts}&retry={fails}"
+                    if client.get('update', path) is not None:
+                        sent = counter
+                        fails = 0
+                    else:
+                        fails += 1
+        stop.wait(min(max(min(next_pulse, next_send) - time.time(), 0.01), 0.5))
+
+
+def dashboard_loop(opts, recorder, stop):
+    """Um painel aberto: conecta via Socket.IO e repete as buscas do index.html."""
+    import socketio
+
+    client = HttpClient(opts.url, recorder)
+    pending = threading.Event()
+    sio = socketio.Client(reconnection=True)
+
+    @sio.on('status')
+    def on_status(data):
+        recorder.status_event()
+        pending.set()
+
+    shift = {'key': None}
+
+    def fetch_shift_key():
+        # fetchCurrentShiftKey()
+        body = client.get('painel:debug_status', '/debug_status')
+        if body:
+            try:
+                shift['key'] = json.loads(body).get('shift_key') or shift['key']
+            except ValueError:
+                pass
+
+    def load_kpis():
+        # scheduleRefresh() -> loadKPIs() (usa a chave de turno já conhecida)
+        key = shift['key']
+        if key and ' - ' in key:
+            turno, data = key.rsplit(' - ', 1)
+            client.get('painel:shift', f"/metrics/shift?turno_nome={quote(turno)}&data_turno={data}")
+
+    transports = ['websocket'] if opts.websocket_only else ['polling', 'websocket']
+    start = time.perf_counter()
+    try:
+        sio.connect(opts.url, transports=transports, wait_timeout=10)
+        recorder.record('painel:conexao', time.perf_counter() - start, True)
+        sio.emit('request_initial_data')
+    except Exception:
+        recorder.record('painel:conexao', time.perf_counter() - start, False)
+        return
+
+    next_refresh = time.time() + DASHBOARD_REFRESH_S
+    while not stop.is_set():
+        if pending.wait(0.2):
+            pending.clear()
+            # Handler de 'status' do index.html: updateChart, fetchCurrentShiftKey, scheduleRefresh
+            client.get('painel:performance', '/metrics/performance?period=day&mode=total')
+            fetch_shift_key()
+            load_kpis()
+        if time.time() >= next_refresh:
+            next_refresh = time.time() + DASHBOARD_REFRESH_S
+            load_kpis()
+    sio.disconnect()
+
+
+class DbSampler:
+    """Amostra pg_stat_database/pg_stat_activity durante o cenário."""
+
+    def __init__(self, dsn):
+        self.dsn = dsn
+        self.peak_connections = 0
+        self.start_stats = None
+        self.end_stats = None
+        self.stop = threading.Event()
+        self.thread = None
+
+    def _stats(self, cur):
+        cur.execute("""
+            SELECT xact_commit + xact_rollback, xact_rollback, blks_read, blks_hit, tup_returned + tup_fetched
+            FROM pg_stat_database WHERE datname = current_database()
+        """)
+        return cur.fetchone()
+
+    def __enter__(self):
+        if not self.dsn:
+            return self
+        import psycopg2
+        self.conn = psycopg2.connect(self.dsn)
+        self.conn.autocommit = True
+        with self.conn.cursor() as cur:
+            cur.execute("SELECT pg_stat_clear_snapshot()")
+            self.start_stats = self._stats(cur)
+        self.thread = threading.Thread(target=self._sample, daemon=True)
+        self.thread.start()
+        return self
+
+    def _sample(self):
+        with self.conn.cursor() as cur:
+            while not self.stop.wait(1.0):
+                cur.execute("SELECT count(*) FROM pg_stat_activity WHERE datname = current_database()")
+                self.peak_connections = max(self.peak_connections, cur.fetchone()[0])
+
+    def __exit__(self, *exc):
+        if not self.dsn:
+            return False
+        self.stop.set()
+        self.thread.join()
+        # As estatísticas são publicadas pelo coletor com atraso curto
+        time.sleep(1)
+        with self.conn.cursor() as cur:
+            cur.execute("SELECT pg_stat_clear_snapshot()")
+            self.end_stats = self._stats(cur)
+        self.conn.close()
+        return False
+
+    def summary(self, elapsed):
+        if not self.start_stats or not self.end_stats:
+            return None
+        d = [b - a for a, b in zip(self.start_stats, self.end_stats)]
+        blocks = d[2] + d[3]
+        return {
+            'transacoes_s': d[0] / elapsed,
+            'rollbacks': d[1],
+            'blocos_lidos_disco': d[2],
+            'taxa_cache': d[3] / blocks if blocks else 1.0,
+            'linhas_lidas_s': d[4] / elapsed,
+            'pico_conexoes': self.peak_connections
+        }
+
+
+def run_scenario(name, params, opts):
+    print(f"[INFO] Cenário '{name}': {params['devices']} dispositivo(s), {params['dashboards']} painel(is), "
+          f"{params['pulses_per_min']} pulsos/min, {opts.duration:.0f} s")
+    run_opts = argparse.Namespace(**vars(opts))
+    run_opts.pulses_per_min = params['pulses_per_min']
+    recorder = Recorder()
+    stop = threading.Event()
+    t0 = time.time()
+    outage = Outage(params['outage_at'], params['outage_s'], t0)
+    prefix = f"lt-{name}-{int(t0) % 100000}"
+
+    threads = [threading.Thread(target=device_loop, args=(f"{prefix}-{i:04d}", run_opts, recorder, outage, stop),
+                                daemon=True) for i in range(params['devices'])]
+    threads += [threading.Thread(target=dashboard_loop, args=(run_opts, recorder, stop), daemon=True)
+                for _ in range(params['dashboards'])]
+
+    with DbSampler(opts.dsn) as db:
+        start = time.time()
+        for t in threads:
+            t.start()
+        stop.wait(opts.duration)
+        stop.set()
+        for t in threads:
+            t.join(timeout=15)
+        elapsed = time.time() - start
+
+    rows, status_events = recorder.summary(elapsed)
+    return {
+        'cenario': name,
+        'parametros': params,
+        'duracao_s': elapsed,
+        'requisicoes': rows,
+        'eventos_status': status_events,
+        'eventos_status_s_por_painel': status_events / elapsed / max(params['dashboards'], 1),
+        'banco': db.summary(elapsed)
+    }
+
+
+def print_report(result):
+    print()
+    print(f"=== {result['cenario']} ({result['duracao_s']:.0f} s) ===")
+    print(f"{'tipo':<24} {'req':>8} {'req/s':>9} {'p50 ms':>9} {'p99 ms':>9} {'erros':>7}")
+    for r in result['requisicoes']:
+        print(f"{r['tipo']:<24} {r['requisicoes']:>8} {r['req_s']:>9.1f} {r['p50_ms']:>9.1f} "
+              f"{r['p99_ms']:>9.1f} {r['taxa_erro']:>6.1%}")
+    print(f"Eventos 'status' por painel: {result['eventos_status_s_por_painel']:.2f}/s")
+    db = result['banco']
+    if db:
+        print(f"Banco: {db['transacoes_s']:.0f} transações/s, {db['linhas_lidas_s']:.0f} linhas lidas/s, "
+              f"cache {db['taxa_cache']:.1%}, {db['blocos_lidos_disco']} blocos do disco, "
+              f"{db['rollbacks']} rollbacks, pico de {db['pico_conexoes']} conexões")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--url', default='http://127.0.0.1:5000', help='URL base do servidor')
+    parser.add_argument('--scenario', default=None,
+                        help=f"cenários prontos separados por vírgula ({', '.join(SCENARIOS)}) ou 'todos'")
+    parser.add_argument('--devices', type=int, default=None, help='cenário personalizado: dispositivos')
+    parser.add_argument('--dashboards', type=int, default=5, help='cenário personalizado: painéis')
+    parser.add_argument('--pulses-per-min', type=float, default=30, help='cenário personalizado: pulsos/min por dispositivo')
+    parser.add_argument('--outage-at', type=float, default=None, help='cenário personalizado: início da queda de Wi-Fi (s)')
+    parser.add_argument('--outage-s', type=float, default=0, help='cenário personalizado: duração da queda (s)')
+    parser.add_argument('--duration', type=float, default=60, help='duração de cada cenário (s)')
+    parser.add_argument('--websocket-only', action='store_true', help='painéis usam apenas WebSocket')
+    parser.add_argument('--dsn', default=None, help='PostgreSQL para medir a carga (padrão: DATABASE_URL do .env)')
+    parser.add_argument('--json', default=None, help='grava os resultados neste arquivo')
+    opts = parser.parse_args()
+
+    if opts.dsn is None:
+        try:
+            from config import Config
+            opts.dsn = Config.DATABASE_URL
+        except Exception:
+            opts.dsn = None
+
+    if opts.devices is not None:
+        scenarios = {'personalizado': dict(devices=opts.devices, dashboards=opts.dashboards,
+                                           pulses_per_min=opts.pulses_per_min,
+                                           outage_at=opts.outage_at, outage_s=opts.outage_s)}
+    elif opts.scenario in (None, 'todos'):
+        scenarios = SCENARIOS
+    else:
+        names = opts.scenario.split(',')
+        unknown = [n for n in names if n not in SCENARIOS]
+        if unknown:
+            print(f"[ERRO] Cenário(s) desconhecido(s): {', '.join(unknown)}")
+            return 2
+        scenarios = {n: SCENARIOS[n] for n in names}
+
+    results = []
+    for name, params in scenarios.items():
+        result = run_scenario(name, params, opts)
+        print_report(result)
+        results.append(result)
+
+    if opts.json:
+        with open(opts.json, 'w', encoding='utf-8') as f:
+            json.dump(results, f, ensure_ascii=False, indent=2)
+        print(f"\n[OK] Resultados gravados em {opts.json}")
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,242 @@
+# usb_bridge.py
+"""Ponte USB -> servidor para contadores sem Wi-Fi.
+
+Lê a porta USB-CDC do Pico W (ex.: /dev/ttyACM0), separa o texto do printf dos
+quadros binários da telemetria (COBS delimitado por 0x00, CRC32) e encaminha os
+contadores e eventos em lotes para POST /ingest. Cada contador só é confirmado
+ao dispositivo (ACK status 0) depois que o servidor o gravou; sem confirmação o
+firmware reenvia. Eventos são confirmados ao chegar.
+
+Quadro (antes do COBS): [versão][tipo][seq u16][payload][crc32 u32], little-endian.
+- 0x01 contador: board_id[8], counter u32, ts u32, retries u16
+- 0x02 evento:   board_id[8], código u8, valor u32, ts u32
+- 0x81 ACK:      seq u16, status u8 (ponte -> dispositivo)
+
+Só biblioteca padrão (Linux). Uso:
+    python tools/usb_bridge.py --port /dev/ttyACM0 --server http://192.168.18.184:5000
+Como serviço (systemd), com Restart=always: a ponte reabre a porta quando o Pico
+é reconectado e nunca confirma o que não chegou ao servidor.
+"""
+import argparse
+import json
+import os
+import select
+import struct
+import sys
+import termios
+import time
+import tty
+import urllib.error
+import urllib.request
+import zlib
+
+VERSION = 1
+TLM_COUNTER = 0x01
+TLM_EVENT = 0x02
+TLM_ACK = 0x81
+EVENTS = {1: 'boot', 2: 'wifi_up', 3: 'wifi_down', 4: 'troca_turno'}
+# ACK status: 0 = gravado; 1 = rejeitado pelo servidor; 2 = servidor inacessível
+ACK_OK, ACK_REJECTED, ACK_UNREACHABLE = 0, 1, 2
+
+
+def cobs_encode(data):
+    out = bytearray()
+    block = bytearray()
+    for byte in data:
+        if byte == 0:
+            out.append(len(block) + 1)
+            out += block
+            block = bytearray()
+        else:
+            block.append(byte)
+            if len(block) == 254:
+                out.append(255)
+                out += block
+                block = bytearray()
+    out.append(len(block) + 1)
+    out += block
+    return bytes(out)
+
+
+def cobs_decode(data):
+    """Bytes decodificados ou None se o bloco não é COBS válido."""
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        i += 1
+        if code == 0 or i + code - 1 > len(data):
+            return None
+        out += data[i:i + code - 1]
+        i += code - 1
+        if code != 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def parse_frame(chunk):
+    """(tipo, seq, payload) de um quadro válido, ou None (texto do printf ou quadro corrompido)."""
+    raw = cobs_decode(chunk)
+    if raw is None or len(raw) < 8 or raw[0] != VERSION:
+        return None
+    body, crc = raw[:-4], struct.unpack('<I', raw[-4:])[0]
+    if zlib.crc32(body) != crc:
+        return None
+    return raw[1], struct.unpack('<H', raw[2:4])[0], raw[4:-4]
+
+
+def ack_frame(seq, status):
+    raw = struct.pack('<BBHHB', VERSION, TLM_ACK, 0, seq, status)
+    raw += struct.pack('<I', zlib.crc32(raw))
+    return b'\x00' + cobs_encode(raw) + b'\x00'
+
+
+class Bridge:
+    def __init__(self, opts):
+        self.opts = opts
+        self.fd = None
+        self.buffer = bytearray()
+        self.text = bytearray()
+        # Contadores aguardando o servidor: (seq, item); eventos não pedem resposta
+        self.updates = []
+        self.events = []
+        self.first_pending = None
+        self.sent = 0
+
+    def open(self):
+        self.fd = os.open(self.opts.port, os.O_RDWR | os.O_NOCTTY | os.O_NONBLOCK)
+        tty.setraw(self.fd)
+        attrs = termios.tcgetattr(self.fd)
+        attrs[2] |= termios.CLOCAL
+        termios.tcsetattr(self.fd, termios.TCSANOW, attrs)
+        termios.tcflush(self.fd, termios.TCIFLUSH)
+        self.buffer.clear()
+        print(f"[OK] Porta {self.opts.port} aberta")
+
+    def close(self):
+        if self.fd is not None:
+            try:
+                os.close(self.fd)
+            except OSError:
+                pass
+            self.fd = None
+
+    def write_ack(self, seq, status):
+        try:
+            os.write(self.fd, ack_frame(seq, status))
+        except OSError as e:
+            print(f"[ERRO] Falha ao enviar ACK {seq}: {e}")
+
+    def handle_text(self, data):
+        if self.opts.quiet:
+            return
+        self.text += data
+        while b'\n' in self.text:
+            line, _, rest = bytes(self.text).partition(b'\n')
+            self.text = bytearray(rest)
+            print(f"[PICO] {line.decode('utf-8', 'replace').rstrip()}")
+
+    def handle_chunk(self, chunk):
+        frame = parse_frame(chunk) if chunk else None
+        if frame is None:
+            self.handle_text(chunk)
+            return
+        tipo, seq, payload = frame
+        now = int(time.time())
+        if tipo == TLM_COUNTER and len(payload) == 18:
+            uid, counter, ts, retries = struct.unpack('<8sIIH', payload)
+            self.updates.append((seq, {'device': uid.hex().upper(), 'counter': counter,
+                                       'ts': ts or None, 'retry': retries}))
+        elif tipo == TLM_EVENT and len(payload) == 17:
+            uid, code, valor, ts = struct.unpack('<8sBII', payload)
+            self.events.append({'device': uid.hex().upper(), 'tipo': EVENTS.get(code, f'evento_{code}'),
+                                'valor': valor, 'ts': ts or now})
+            self.write_ack(seq, ACK_OK)
+        else:
+            return
+        if self.first_pending is None:
+            self.first_pending = time.monotonic()
+
+    def read(self, timeout):
+        ready, _, _ = select.select([self.fd], [], [], timeout)
+        if not ready:
+            return
+        data = os.read(self.fd, 4096)
+        if not data:
+            raise OSError('porta fechada')
+        self.buffer += data
+        while b'\x00' in self.buffer:
+            chunk, _, rest = bytes(self.buffer).partition(b'\x00')
+            self.buffer = bytearray(rest)
+            self.handle_chunk(chunk)
+        # Texto longo sem quadros: não acumula indefinidamente
+        if len(self.buffer) > 4096:
+            self.handle_text(bytes(self.buffer))
+            self.buffer.clear()
+
+    def due(self):
+        if self.first_pending is None:
+            return False
+        return (len(self.updates) + len(self.events) >= self.opts.batch_size
+                or (time.monotonic() - self.first_pending) * 1000.0 >= self.opts.batch_ms)
+
+    def flush(self):
+        """Envia o lote ao servidor e responde os ACKs dos contadores."""
+        updates, events = self.updates, self.events
+        self.updates, self.events, self.first_pending = [], [], None
+        body = json.dumps({'via': 'usb', 'updates': [item for _, item in updates], 'events': events}).encode()
+        request = urllib.request.Request(self.opts.server.rstrip('/') + '/ingest', data=body,
+                                         headers={'Content-Type': 'application/json'})
+        try:
+            with urllib.request.urlopen(request, timeout=self.opts.timeout) as response:
+                results = json.load(response).get('results', [])
+        except (urllib.error.URLError, OSError, ValueError) as e:
+            print(f"[ERRO] Servidor inacessível ({e}); {len(updates)} contador(es) serão reenviados pelo dispositivo")
+            for seq, _ in updates:
+                self.write_ack(seq, ACK_UNREACHABLE)
+            return
+        for (seq, item), result in zip(updates, results):
+            ok = bool(result.get('ok'))
+            self.write_ack(seq, ACK_OK if ok else ACK_REJECTED)
+            if not ok:
+                print(f"[ERRO] Contador rejeitado ({item['device']}={item['counter']}): {result.get('error')}")
+        self.sent += len(updates)
+        if self.opts.verbose:
+            print(f"[INFO] Lote: {len(updates)} contador(es), {len(events)} evento(s); total {self.sent}")
+
+    def run(self):
+        while True:
+            try:
+                if self.fd is None:
+                    self.open()
+                self.read(self.opts.batch_ms / 1000.0)
+                if self.due():
+                    self.flush()
+            except OSError as e:
+                if self.fd is not None:
+                    print(f"[INFO] Porta {self.opts.port} indisponível ({e}); tentando novamente")
+                self.close()
+                # Contadores sem ACK serão reenviados pelo dispositivo
+                self.updates, self.events, self.first_pending = [], [], None
+                time.sleep(self.opts.reopen_s)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--port', default='/dev/ttyACM0', help='porta USB-CDC do Pico W')
+    parser.add_argument('--server', default='http://192.168.18.184:5000', help='URL base do servidor')
+    parser.add_argument('--batch-ms', type=float, default=100, help='espera máxima para agrupar um lote (ms)')
+    parser.add_argument('--batch-size', type=int, default=50, help='itens que disparam o envio imediato')
+    parser.add_argument('--timeout', type=float, default=5, help='timeout HTTP (s)')
+    parser.add_argument('--reopen-s', type=float, default=2, help='espera para reabrir a porta (s)')
+    parser.add_argument('--quiet', action='store_true', help='não repete o printf do dispositivo')
+    parser.add_argument('--verbose', action='store_true', help='registra cada lote enviado')
+    opts = parser.parse_args()
+    try:
+        Bridge(opts).run()
+    except KeyboardInterrupt:
+        return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,181 @@
+# versioning.py
+"""Versões dos dados para GET condicional (ETag/Last-Modified) e cache de respostas.
+
+Triggers por comando em cada tabela lida pelos endpoints publicam
+`NOTIFY kalfix_dados, '<tabela>:<txid>'`. Cada worker mantém uma conexão em LISTEN e
+guarda, por tabela, o id da última transação notificada (ou um token de início do
+worker, se ainda não recebeu nenhuma). A ETag de um endpoint combina as versões das
+tabelas de que ele depende com o contexto (data e turno corrente): se nada mudou,
+a resposta é 304 sem tocar no banco, e dashboards diferentes com a mesma URL
+compartilham a resposta já calculada.
+
+Como as versões são ids de transação, workers diferentes que viram a mesma última
+alteração geram a mesma ETag. Um worker que ainda não viu nenhuma alteração usa um
+token próprio (nunca coincide com outro), o que só custa um recálculo.
+Sem a conexão LISTEN (banco fora do ar), os endpoints respondem sem cache.
+"""
+import functools
+import hashlib
+import os
+import select
+import threading
+import time
+from collections import OrderedDict
+from datetime import datetime, timezone
+
+import psycopg2
+from flask import request, make_response
+
+CHANNEL = 'kalfix_dados'
+# Tabelas observadas (a criação dos triggers fica em DatabaseManager.create_change_notify)
+TABLES = ('shifts', 'metas', 'metas_p_turno', 'perdas', 'paradas', 'devices', 'producao_minuto',
+          'producao_hora')
+# Respostas calculadas mantidas por worker (por URL + ETag)
+CACHE_ENTRIES = 256
+
+_lock = threading.Lock()
+_start_token = f"s{os.getpid()}.{time.time_ns()}"
+_versions = {table: _start_token for table in TABLES}
+_modified = {table: time.time() for table in TABLES}
+_healthy = False
+_cache = OrderedDict()
+# Contexto extra da ETag (ex.: turno corrente), definido pelo servidor
+context = lambda: ''
+
+
+def _bump(payload):
+    table, _, txid = payload.partition(':')
+    if table in _versions:
+        with _lock:
+            _versions[table] = txid or str(time.time_ns())
+            _modified[table] = time.time()
+
+
+def _reset():
+    """Sem LISTEN as notificações podem ter sido perdidas: invalida tudo."""
+    global _start_token
+    with _lock:
+        _start_token = f"s{os.getpid()}.{time.time_ns()}"
+        for table in TABLES:
+            _versions[table] = _start_token
+            _modified[table] = time.time()
+        _cache.clear()
+
+
+def listen_loop(dsn, sleep):
+    """Mantém a conexão LISTEN e aplica as notificações (tarefa de fundo do worker).
+
+    'sleep' é a função de espera cooperativa (socketio.sleep).
+    """
+    global _healthy
+    while True:
+        conn = None
+        try:
+            conn = psycopg2.connect(dsn)
+            conn.autocommit = True
+            with conn.cursor() as cur:
+                cur.execute(f"LISTEN {CHANNEL}")
+            # Alterações feitas enquanto não escutávamos são desconhecidas
+            _reset()
+            _healthy = True
+            print(f"[OK] Worker {os.getpid()} escutando alterações de dados ({CHANNEL})")
+            while True:
+                if select.select([conn], [], [], 30)[0]:
+                    conn.poll()
+                    while conn.notifies:
+                        _bump(conn.notifies.pop(0).payload)
+                else:
+                    # Sem notificações: confirma que a conexão continua viva
+                    with conn.cursor() as cur:
+                        cur.execute("SELECT 1")
+        except Exception as e:
+            if _healthy:
+                print(f"[ERRO] Conexão LISTEN perdida: {e}")
+            _healthy = False
+            _reset()
+        finally:
+            if conn is not None:
+                try:
+                    conn.close()
+                except Exception:
+                    pass
+        sleep(5)
+
+
+def etag(tables, ttl=None):
+    """ETag para os dados das tabelas + contexto; None se as versões não são confiáveis."""
+    if not _healthy:
+        return None
+    with _lock:
+        parts = [_versions[t] for t in tables]
+    parts.append(datetime.now().strftime('%Y-%m-%d'))
+    parts.append(str(context() or ''))
+    if ttl:
+        # Endpoints com janela relativa ao relógio mudam mesmo sem alterações
+        parts.append(str(int(time.time() // ttl)))
+    return hashlib.sha1('|'.join(parts).encode('utf-8')).hexdigest()[:20]
+
+
+def last_modified(tables):
+    with _lock:
+        ts = max(_modified[t] for t in tables)
+    return datetime.fromtimestamp(int(ts), tz=timezone.utc)
+
+
+def conditional(*tables, ttl=None):
+    """Decorator de rota GET: ETag/Last-Modified, 304 e cache da resposta calculada.
+
+    tables: tabelas de que a resposta depende; ttl: segundos de validade para
+    respostas que dependem do relógio (janelas 'últimas N horas').
+    """
+    def decorator(view):
+        @functools.wraps(view)
+        def wrapper(*args, **kwargs):
+            tag = etag(tables, ttl)
+            if tag is None:
+                return view(*args, **kwargs)
+            modified = last_modified(tables)
+            if request.if_none_match:
+                if request.if_none_match.contains_weak(tag):
+                    return _not_modified(tag, modified)
+            elif request.if_modified_since and not ttl and modified <= request.if_modified_since:
+                return _not_modified(tag, modified)
+
+            key = (request.full_path, tag)
+            with _lock:
+                cached = _cache.get(key)
+                if cached is not None:
+                    _cache.move_to_end(key)
+            if cached is not None:
+                body, mimetype = cached
+                response = make_response(body)
+                response.mimetype = mimetype
+            else:
+                response = make_response(view(*args, **kwargs))
+                if response.status_code != 200 or response.is_streamed:
+                    return response
+                with _lock:
+                    _cache[key] = (response.get_data(), response.mimetype)
+                    while len(_cache) > CACHE_ENTRIES:
+                        _cache.popitem(last=False)
+            return _validators(response, tag, modified)
+        return wrapper
+    return decorator
+
+
+def _validators(response, tag, modified):
+    response.set_etag(tag, weak=True)
+    response.last_modified = modified
+    # O navegador guarda a resposta, mas sempre revalida (If-None-Match)
+    response.headers['Cache-Control'] = 'no-cache'
+    return response
+
+
+def _not_modified(tag, modified):
+    return _validators(make_response('', 304), tag, modified)
+
+
+def stats():
+    """(LISTEN ativo, respostas em cache) para /metrics."""
+    with _lock:
+        return _healthy, len(_cache)
@@ -0,0 +1,19 @@
+# wsgi.py
+# Ponto de entrada do modo de produção (vários workers):
+#     gunicorn -c gunicorn.conf.py wsgi:app
+import os
+
+# Define o modo assíncrono antes de importar config/server
+os.environ.setdefault('SOCKETIO_ASYNC_MODE', 'eventlet')
+
+import eventlet
+eventlet.monkey_patch()
+
+# psycopg2 é uma extensão C: sem este patch cada consulta bloquearia o worker inteiro
+from psycogreen.eventlet import patch_psycopg
+patch_psycopg()
+
+from server import app, start_worker
+
+# Cada worker (processo) cria o próprio pool de conexões e as próprias tarefas de fundo
+start_worker()